@@ -47,7 +47,7 @@ struct indexed_multi_geom
             geoms.emplace_back(geom);
         }
 
-        bool first;
+        bool first = true;
         for (auto const & geom : geoms)
         {
             if (first)
@@ -82,45 +82,45 @@ struct geometry_indexer
     {
     }
 
-    void operator() (mapbox::geometry::point<std::int64_t> & geom)
+    void operator() (mapbox::geometry::point<std::int64_t> const & geom)
     {
         indexed_point indexed(geom);
         next_(indexed);
     }
 
-    void operator() (mapbox::geometry::multi_point<std::int64_t> & geom)
+    void operator() (mapbox::geometry::multi_point<std::int64_t> const & geom)
     {
         indexed_multi_point indexed(geom);
         next_(indexed);
     }
 
-    void operator() (mapbox::geometry::geometry_collection<std::int64_t> & geom)
+    void operator() (mapbox::geometry::geometry_collection<std::int64_t> const & geom)
     {
-        for (auto & g : geom)
+        for (auto const & g : geom)
         {
             mapbox::util::apply_visitor((*this), g);
         }
     }
 
-    void operator() (mapbox::geometry::line_string<std::int64_t> & geom)
+    void operator() (mapbox::geometry::line_string<std::int64_t> const & geom)
     {
         indexed_line_string indexed(geom);
         next_(indexed);
     }
 
-    void operator() (mapbox::geometry::multi_line_string<std::int64_t> & geom)
+    void operator() (mapbox::geometry::multi_line_string<std::int64_t> const & geom)
     {
         indexed_multi_line_string indexed(geom);
         next_(indexed);
     }
 
-    void operator() (mapbox::geometry::polygon<std::int64_t> & geom)
+    void operator() (mapbox::geometry::polygon<std::int64_t> const & geom)
     {
         indexed_polygon indexed(geom);
         next_(indexed);
     }
 
-    void operator() (mapbox::geometry::multi_polygon<std::int64_t> & geom)
+    void operator() (mapbox::geometry::multi_polygon<std::int64_t> const & geom)
     {
         indexed_multi_polygon indexed(geom);
         next_(indexed);
@@ -9,12 +9,16 @@
 #include "vector_tile_tile.hpp"
 #include "vector_tile_wafer.hpp"
 #include "vector_tile_layer.hpp"
+#include "vector_tile_stats.hpp"
 
 // mapnik
 #include <mapnik/box2d.hpp>
 #include <mapnik/box2d_impl.hpp>
 #include <mapnik/feature.hpp>
 
+// std
+#include <algorithm>
+
 namespace mapnik
 {
 
@@ -33,6 +37,29 @@ struct simple_tiler
         layer_(layer),
         builder_(layer.name(), layer.layer_extent(), layer.get_data())
     {
+        builder_.budget = layer.get_byte_budget();
+        builder_.values_cache = layer.get_value_cache();
+        builder_.attributes = layer.get_attribute_filter();
+        builder_.compact = layer.get_compact();
+        builder_.hilbert_order = layer.get_hilbert_order();
+        if (layer.get_feature_merging().enabled)
+        {
+            builder_.merger.reset(new feature_merger(layer.get_feature_merging().drop_ids));
+        }
+    }
+
+    // Encodes a chunk of the features of a layer into its own buffer, which
+    // is then merged into the builder of the layer. The byte budget, the
+    // compaction and the Hilbert ordering apply to the whole layer and are
+    // left to that builder, layers whose features are merged are not split
+    // into chunks.
+    simple_tiler(Tile & tile, tile_layer & layer, std::string & buffer) :
+        tile_(tile),
+        layer_(layer),
+        builder_(layer.name(), layer.layer_extent(), buffer)
+    {
+        builder_.values_cache = layer.get_value_cache();
+        builder_.attributes = layer.get_attribute_filter();
     }
 
     ~simple_tiler()
@@ -45,6 +72,16 @@ struct simple_tiler
         return layer_;
     }
 
+    void set_recorder(detail::stats_recorder * recorder)
+    {
+        builder_.recorder = recorder;
+    }
+
+    bool exhausted() const
+    {
+        return builder_.exhausted();
+    }
+
     struct visitor
     {
         visitor(visitor &&) = default;
@@ -87,6 +124,10 @@ struct simple_tiler
     }
 };
 
+// Wafer ranges of at most this many sub-tiles are not split into
+// quadrants by quadtree clipping
+constexpr std::int64_t quadtree_leaf_cells = 4;
+
 struct wafer_tiler
 {
     merc_wafer & wafer_;
@@ -106,6 +147,15 @@ struct wafer_tiler
         for (auto & buffer : layer_.buffers())
         {
             builders_.emplace_back(layer.name(), tile_size_, buffer);
+            builders_.back().budget = layer.get_byte_budget();
+            builders_.back().values_cache = layer.get_value_cache();
+            builders_.back().attributes = layer.get_attribute_filter();
+            builders_.back().compact = layer.get_compact();
+            builders_.back().hilbert_order = layer.get_hilbert_order();
+            if (layer.get_feature_merging().enabled)
+            {
+                builders_.back().merger.reset(new feature_merger(layer.get_feature_merging().drop_ids));
+            }
         }
     }
 
@@ -117,6 +167,59 @@ struct wafer_tiler
         }
     }
 
+    void set_recorder(detail::stats_recorder * recorder)
+    {
+        for (auto & builder : builders_)
+        {
+            builder.recorder = recorder;
+        }
+    }
+
+    // Number of sub-tiles along each axis of the wafer
+    std::int64_t cells() const
+    {
+        return (wafer_.tile_size() + tile_size_ - 1) / tile_size_;
+    }
+
+    // Range of the sub-tiles along one axis whose buffered box holds the
+    // coordinates from min to max, empty when first > last
+    void cell_range(std::int64_t min, std::int64_t max,
+                    std::int64_t & first, std::int64_t & last) const
+    {
+        const std::int64_t tile_size = tile_size_;
+        const std::int64_t buffer_size = buffer_size_;
+        // Floor division, coordinates can be negative within the buffer
+        auto floor_div = [tile_size](std::int64_t value)
+        {
+            return value >= 0 ? value / tile_size : -((-value + tile_size - 1) / tile_size);
+        };
+        first = std::max<std::int64_t>(-floor_div(buffer_size - min) - 1, 0);
+        last = std::min<std::int64_t>(floor_div(max + buffer_size), cells() - 1);
+    }
+
+    // Buffered box of the sub-tiles from first_x to last_x and from first_y
+    // to last_y
+    mapnik::box2d<std::int64_t> cells_box(std::int64_t first_x, std::int64_t last_x,
+                                          std::int64_t first_y, std::int64_t last_y) const
+    {
+        mapnik::box2d<std::int64_t> box(first_x * tile_size_, first_y * tile_size_,
+                                        (last_x + 1) * tile_size_, (last_y + 1) * tile_size_);
+        box.pad(buffer_size_);
+        return box;
+    }
+
+    bool exhausted() const
+    {
+        for (auto const& builder : builders_)
+        {
+            if (!builder.exhausted())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
     struct visitor
     {
         visitor(visitor &&) = default;
@@ -129,6 +232,9 @@ struct wafer_tiler
         mapnik::feature_impl const& mapnik_feature_;
         std::deque<Encoder> encoders_;
         clipper_params const & clipper_params_;
+        // Parameters of the clipping of geometries reduced to a quadrant,
+        // their rings were already checked against the area threshold
+        clipper_params reduced_params_;
 
         visitor(wafer_tiler & tiler,
                 mapnik::feature_impl const& mapnik_feature,
@@ -136,33 +242,170 @@ struct wafer_tiler
                 clipper_params const & clip_params) :
             tiler_(tiler),
             mapnik_feature_(mapnik_feature),
-            clipper_params_(clip_params)
+            clipper_params_(clip_params),
+            reduced_params_(clip_params)
         {
+            reduced_params_.area_threshold = 0.0;
             for (auto & builder : builders)
             {
                 encoders_.emplace_back(mapnik_feature, builder);
             }
         }
 
+        // Forwards the geometries reduced to a quadrant of sub-tiles to the
+        // sub-tiles of the quadrant
+        struct quadrant
+        {
+            visitor & visitor_;
+            std::int64_t first_x, last_x, first_y, last_y;
+
+            template <typename T>
+            void operator() (T const& indexed_geom)
+            {
+                visitor_.clip_cells(indexed_geom, first_x, last_x, first_y, last_y, true);
+            }
+        };
+
+        // Clips a geometry to the sub-tiles of a range it intersects. With
+        // quadtree clipping the geometry is first reduced to each quadrant
+        // of a range of more than quadtree_leaf_cells sub-tiles. Reduced
+        // geometries are clipped without the area threshold.
+        template <typename T>
+        void clip_cells(T const& indexed_geom,
+                        std::int64_t first_x, std::int64_t last_x,
+                        std::int64_t first_y, std::int64_t last_y,
+                        bool reduced)
+        {
+            std::int64_t geom_first_x, geom_last_x, geom_first_y, geom_last_y;
+            tiler_.cell_range(indexed_geom.envelope.minx(), indexed_geom.envelope.maxx(), geom_first_x, geom_last_x);
+            tiler_.cell_range(indexed_geom.envelope.miny(), indexed_geom.envelope.maxy(), geom_first_y, geom_last_y);
+            first_x = std::max(first_x, geom_first_x);
+            last_x = std::min(last_x, geom_last_x);
+            first_y = std::max(first_y, geom_first_y);
+            last_y = std::min(last_y, geom_last_y);
+            if (first_x > last_x || first_y > last_y)
+            {
+                return;
+            }
+            const std::int64_t tile_size = tiler_.tile_size_;
+            if (tiler_.wafer_.quadtree_clipping() &&
+                (last_x - first_x + 1) * (last_y - first_y + 1) > quadtree_leaf_cells)
+            {
+                if (reduced)
+                {
+                    clip_quadrants(indexed_geom, first_x, last_x, first_y, last_y);
+                }
+                else
+                {
+                    reduce_quadrants(indexed_geom, first_x, last_x, first_y, last_y);
+                }
+                return;
+            }
+            const std::int64_t cells = tiler_.cells();
+            for (std::int64_t j = first_y; j <= last_y; ++j)
+            {
+                for (std::int64_t i = first_x; i <= last_x; ++i)
+                {
+                    mapnik::box2d<std::int64_t> tile_box(tiler_.cells_box(i, i, j, j));
+                    Translator translate(-i * tile_size, -j * tile_size, encoders_[j * cells + i]);
+                    Clipper clipper(tile_box, reduced ? reduced_params_ : clipper_params_, translate);
+                    clipper(indexed_geom);
+                }
+            }
+        }
+
+        // Reduces a geometry to the quadrants of a range of sub-tiles
+        template <typename T>
+        void clip_quadrants(T const& indexed_geom,
+                            std::int64_t first_x, std::int64_t last_x,
+                            std::int64_t first_y, std::int64_t last_y)
+        {
+            const std::int64_t middle_x = first_x + (last_x - first_x) / 2;
+            const std::int64_t middle_y = first_y + (last_y - first_y) / 2;
+            const std::int64_t quadrants[4][4] = {
+                { first_x, middle_x, first_y, middle_y },
+                { middle_x + 1, last_x, first_y, middle_y },
+                { first_x, middle_x, middle_y + 1, last_y },
+                { middle_x + 1, last_x, middle_y + 1, last_y }
+            };
+            for (auto const& q : quadrants)
+            {
+                if (q[0] > q[1] || q[2] > q[3])
+                {
+                    continue;
+                }
+                mapnik::box2d<std::int64_t> quadrant_box(tiler_.cells_box(q[0], q[1], q[2], q[3]));
+                quadrant next { *this, q[0], q[1], q[2], q[3] };
+                geometry_box_clipper<quadrant> clipper(quadrant_box, next);
+                clipper(indexed_geom);
+            }
+        }
+
+        // Drops the rings below the area threshold before a geometry is
+        // reduced, only polygons have rings to drop
+        template <typename T>
+        void reduce_quadrants(T const& indexed_geom,
+                              std::int64_t first_x, std::int64_t last_x,
+                              std::int64_t first_y, std::int64_t last_y)
+        {
+            clip_quadrants(indexed_geom, first_x, last_x, first_y, last_y);
+        }
+
+        void reduce_quadrants(indexed_polygon const& indexed_geom,
+                              std::int64_t first_x, std::int64_t last_x,
+                              std::int64_t first_y, std::int64_t last_y)
+        {
+            mapbox::geometry::polygon<std::int64_t> poly(indexed_geom.geom);
+            if (drop_small_rings(poly, clipper_params_))
+            {
+                indexed_polygon indexed(poly);
+                clip_quadrants(indexed, first_x, last_x, first_y, last_y);
+            }
+        }
+
+        void reduce_quadrants(indexed_multi_polygon const& indexed_geom,
+                              std::int64_t first_x, std::int64_t last_x,
+                              std::int64_t first_y, std::int64_t last_y)
+        {
+            mapbox::geometry::multi_polygon<std::int64_t> multi;
+            for (auto const& indexed_poly : indexed_geom.geoms)
+            {
+                mapbox::geometry::polygon<std::int64_t> poly(indexed_poly.geom);
+                if (drop_small_rings(poly, clipper_params_))
+                {
+                    multi.push_back(std::move(poly));
+                }
+            }
+            if (!multi.empty())
+            {
+                indexed_multi_polygon indexed(multi);
+                clip_quadrants(indexed, first_x, last_x, first_y, last_y);
+            }
+        }
+
         template <typename T>
         void operator() (T const& indexed_geom)
         {
-            auto encoder = encoders_.begin();
-            std::int32_t wafer_size = tiler_.wafer_.tile_size();
-            for (std::int64_t y = 0; y < wafer_size; y += tiler_.tile_size_)
+            const std::int64_t cells = tiler_.cells();
+            clip_cells(indexed_geom, 0, cells - 1, 0, cells - 1, false);
+        }
+
+        // Points within the range of a sub-tile are within its buffered box,
+        // so they are not clipped
+        void operator() (indexed_point const& indexed_geom)
+        {
+            std::int64_t first_x, last_x, first_y, last_y;
+            tiler_.cell_range(indexed_geom.geom.x, indexed_geom.geom.x, first_x, last_x);
+            tiler_.cell_range(indexed_geom.geom.y, indexed_geom.geom.y, first_y, last_y);
+            const std::int64_t tile_size = tiler_.tile_size_;
+            const std::int64_t cells = tiler_.cells();
+            for (std::int64_t j = first_y; j <= last_y; ++j)
             {
-                for (std::int64_t x = 0; x < wafer_size; x += tiler_.tile_size_)
+                for (std::int64_t i = first_x; i <= last_x; ++i)
                 {
-                    mapnik::box2d<std::int64_t> tile_box(
-                        x, y, x + tiler_.tile_size_, y + tiler_.tile_size_);
-                    tile_box.pad(tiler_.buffer_size_);
-                    if (indexed_geom.envelope.intersects(tile_box))
-                    {
-                        Translator translate(-x, -y, *encoder);
-                        Clipper clipper(tile_box, clipper_params_, translate);
-                        clipper(indexed_geom);
-                    }
-                    ++encoder;
+                    mapbox::geometry::point<std::int64_t> point(indexed_geom.geom);
+                    Translator translate(-i * tile_size, -j * tile_size, encoders_[j * cells + i]);
+                    translate(point);
                 }
             }
         }
@@ -0,0 +1,2 @@
+#include "vector_tile_buffer_pool.hpp"
+#include "vector_tile_buffer_pool.ipp"
@@ -0,0 +1,82 @@
+#ifndef __MAPNIK_VECTOR_TILE_BUFFER_POOL_H__
+#define __MAPNIK_VECTOR_TILE_BUFFER_POOL_H__
+
+// mapnik-vector-tile
+#include "vector_tile_config.hpp"
+
+// mapnik
+#include <mapnik/util/noncopyable.hpp>
+
+// std
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+/*
+  Recycles the buffers of layers and tiles so that their capacity is
+  kept from one tile to the next. Buffers handed out for a layer are
+  reserved for the size that layer took on average in the previous
+  tiles. At most max_buffers free buffers are kept and buffers smaller
+  than min_capacity or larger than max_capacity bytes are not kept at
+  all. The pool can be shared by any number of processors and threads.
+*/
+
+class buffer_pool : private mapnik::util::noncopyable
+{
+    std::mutex mutex_;
+    std::vector<std::string> buffers_;
+    // Running estimate of the size of every layer by name
+    std::unordered_map<std::string, std::size_t> estimates_;
+    std::size_t max_buffers_;
+    std::size_t min_capacity_;
+    std::size_t max_capacity_;
+
+public:
+    explicit buffer_pool(std::size_t max_buffers = 64,
+                         std::size_t max_capacity = 16 << 20,
+                         std::size_t min_capacity = 4096)
+        : mutex_(),
+          buffers_(),
+          estimates_(),
+          max_buffers_(max_buffers),
+          min_capacity_(min_capacity),
+          max_capacity_(max_capacity) {}
+
+    // Returns a buffer of size bytes, reserved for the estimated size of
+    // the layer called name
+    MAPNIK_VECTOR_INLINE std::string acquire(std::string const& name, std::size_t size);
+
+    // Takes back a buffer, whose content is discarded. Buffers a string
+    // was moved from keep at most their small string capacity and are
+    // dropped like any buffer below min_capacity.
+    MAPNIK_VECTOR_INLINE void release(std::string && buffer);
+
+    // Updates the size estimate of the layer called name with the size of
+    // its buffer once encoded
+    MAPNIK_VECTOR_INLINE void record(std::string const& name, std::size_t size);
+
+    // Estimated size of the layer called name, zero when unknown
+    MAPNIK_VECTOR_INLINE std::size_t estimate(std::string const& name);
+
+    // Number of free buffers
+    MAPNIK_VECTOR_INLINE std::size_t size();
+
+    MAPNIK_VECTOR_INLINE void clear();
+};
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
+
+#if !defined(MAPNIK_VECTOR_TILE_LIBRARY)
+#include "vector_tile_buffer_pool.ipp"
+#endif
+
+#endif // __MAPNIK_VECTOR_TILE_BUFFER_POOL_H__
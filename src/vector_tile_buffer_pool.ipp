@@ -0,0 +1,107 @@
+// std
+#include <algorithm>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+MAPNIK_VECTOR_INLINE std::string buffer_pool::acquire(std::string const& name, std::size_t size)
+{
+    std::string buffer;
+    std::size_t reserved = size;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto estimate = estimates_.find(name);
+        if (estimate != estimates_.end())
+        {
+            // Some room for layers growing from one tile to the next
+            reserved = std::max(reserved, estimate->second + estimate->second / 4);
+        }
+        if (!buffers_.empty())
+        {
+            // Buffers are ordered by capacity, the smallest one large enough
+            // is taken or else the largest one
+            auto itr = std::lower_bound(buffers_.begin(), buffers_.end(), reserved,
+                                        [](std::string const& other, std::size_t capacity)
+                                        {
+                                            return other.capacity() < capacity;
+                                        });
+            if (itr == buffers_.end())
+            {
+                --itr;
+            }
+            buffer.swap(*itr);
+            buffers_.erase(itr);
+        }
+    }
+    reserved = std::min(reserved, max_capacity_);
+    // A smaller request could shrink the buffer with some libraries
+    if (buffer.capacity() < reserved)
+    {
+        buffer.reserve(reserved);
+    }
+    buffer.assign(size, '\0');
+    return buffer;
+}
+
+MAPNIK_VECTOR_INLINE void buffer_pool::release(std::string && buffer)
+{
+    if (buffer.capacity() < min_capacity_ || buffer.capacity() > max_capacity_)
+    {
+        return;
+    }
+    buffer.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffers_.size() >= max_buffers_)
+    {
+        // Replace the smallest buffer if this one is larger
+        if (buffers_.empty() || buffers_.front().capacity() >= buffer.capacity())
+        {
+            return;
+        }
+        buffers_.erase(buffers_.begin());
+    }
+    auto pos = std::upper_bound(buffers_.begin(), buffers_.end(), buffer.capacity(),
+                                [](std::size_t capacity, std::string const& other)
+                                {
+                                    return capacity < other.capacity();
+                                });
+    buffers_.emplace(pos, std::move(buffer));
+}
+
+MAPNIK_VECTOR_INLINE void buffer_pool::record(std::string const& name, std::size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto result = estimates_.emplace(name, size);
+    if (!result.second)
+    {
+        std::size_t & estimate = result.first->second;
+        estimate = (estimate * 3 + size) / 4;
+    }
+}
+
+MAPNIK_VECTOR_INLINE std::size_t buffer_pool::estimate(std::string const& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto itr = estimates_.find(name);
+    return itr == estimates_.end() ? 0 : itr->second;
+}
+
+MAPNIK_VECTOR_INLINE std::size_t buffer_pool::size()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return buffers_.size();
+}
+
+MAPNIK_VECTOR_INLINE void buffer_pool::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.clear();
+    estimates_.clear();
+}
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
@@ -0,0 +1,66 @@
+#ifndef __MAPNIK_VECTOR_TILE_BYTE_BUDGET_H__
+#define __MAPNIK_VECTOR_TILE_BYTE_BUDGET_H__
+
+// mapnik-vector-tile
+#include "vector_tile_config.hpp"
+
+// std
+#include <cstdint>
+#include <string>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+// Which features are kept first when a layer exceeds its budget
+enum budget_priority : std::uint8_t
+{
+    BUDGET_FEATURE_ORDER = 0, // features read first
+    BUDGET_AREA,              // polygons with the largest area
+    BUDGET_ATTRIBUTE          // largest value of an attribute
+};
+
+/*
+  Upper bounds of the encoded size of tiles and of their layers. When a
+  layer is larger than its budget the features with the lowest priority
+  are dropped, together with the keys and values only they reference.
+  A zero size means unlimited.
+*/
+
+struct byte_budget
+{
+    std::size_t tile_bytes;
+    std::size_t layer_bytes;
+    budget_priority priority;
+    // Attribute used with BUDGET_ATTRIBUTE, features without it go last
+    std::string attribute;
+
+    byte_budget()
+        : tile_bytes(0),
+          layer_bytes(0),
+          priority(BUDGET_FEATURE_ORDER),
+          attribute() {}
+
+    bool enabled() const
+    {
+        return tile_bytes > 0 || layer_bytes > 0;
+    }
+
+    // A single layer can never use more than the whole tile
+    std::size_t layer_limit() const
+    {
+        if (tile_bytes > 0 && (layer_bytes == 0 || tile_bytes < layer_bytes))
+        {
+            return tile_bytes;
+        }
+        return layer_bytes;
+    }
+};
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
+
+#endif // __MAPNIK_VECTOR_TILE_BYTE_BUDGET_H__
@@ -0,0 +1,95 @@
+#ifndef __MAPNIK_VECTOR_TILE_CANCELLATION_H__
+#define __MAPNIK_VECTOR_TILE_CANCELLATION_H__
+
+// mapnik-vector-tile
+#include "vector_tile_config.hpp"
+
+// std
+#include <atomic>
+#include <chrono>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+/*
+  Stops the generation of tiles, either when cancel is called from any
+  thread or once a deadline has passed. The processor checks it between
+  features, a tile whose generation was stopped holds the features
+  encoded until then and is marked as partial.
+*/
+
+class cancellation_token
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+private:
+    mutable std::atomic<bool> cancelled_;
+    std::atomic<clock::rep> deadline_;
+
+public:
+    cancellation_token()
+        : cancelled_(false),
+          deadline_(clock::time_point::max().time_since_epoch().count()) {}
+
+    explicit cancellation_token(clock::time_point deadline)
+        : cancelled_(false),
+          deadline_(deadline.time_since_epoch().count()) {}
+
+    cancellation_token(cancellation_token const&) = delete;
+    cancellation_token & operator=(cancellation_token const&) = delete;
+
+    void cancel()
+    {
+        cancelled_.store(true, std::memory_order_relaxed);
+    }
+
+    void set_deadline(clock::time_point deadline)
+    {
+        deadline_.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    void set_timeout(clock::duration timeout)
+    {
+        set_deadline(clock::now() + timeout);
+    }
+
+    clock::time_point deadline() const
+    {
+        return clock::time_point(clock::duration(deadline_.load(std::memory_order_relaxed)));
+    }
+
+    // Once true it stays true, even if the deadline is moved later
+    bool cancelled() const
+    {
+        if (cancelled_.load(std::memory_order_relaxed))
+        {
+            return true;
+        }
+        if (clock::now().time_since_epoch().count() >= deadline_.load(std::memory_order_relaxed))
+        {
+            cancelled_.store(true, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+};
+
+namespace detail
+{
+
+inline bool is_cancelled(cancellation_token const* token)
+{
+    return token && token->cancelled();
+}
+
+} // end ns detail
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
+
+#endif // __MAPNIK_VECTOR_TILE_CANCELLATION_H__
@@ -0,0 +1,333 @@
+#ifndef __MAPNIK_VECTOR_TILE_FEATURE_MERGER_H__
+#define __MAPNIK_VECTOR_TILE_FEATURE_MERGER_H__
+
+// mapnik-vector-tile
+#include "vector_tile_config.hpp"
+#include "vector_tile_geometry_encoder_pbf.hpp"
+
+// mapbox
+#include <mapbox/geometry/geometry.hpp>
+#include <mapbox/geometry/wagyu/wagyu.hpp>
+
+// protozero
+#include <protozero/pbf_writer.hpp>
+
+// std
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+// Merging of the features of a layer, read from the mvt_merge_features
+// and mvt_merge_drop_ids datasource parameters
+struct feature_merging
+{
+    bool enabled;
+    // Merged features have no id instead of the id of their first part
+    bool drop_ids;
+
+    feature_merging()
+        : enabled(false),
+          drop_ids(false) {}
+};
+
+namespace detail
+{
+
+// Joins lines whose last point is the first point of another line, the
+// direction of the lines is kept
+inline mapbox::geometry::multi_line_string<std::int64_t> merge_lines(mapbox::geometry::multi_line_string<std::int64_t> const& lines)
+{
+    using key_type = std::pair<std::int64_t, std::int64_t>;
+    constexpr std::size_t none = std::numeric_limits<std::size_t>::max();
+
+    std::multimap<key_type, std::size_t> starts;
+    std::multimap<key_type, std::size_t> ends;
+    for (std::size_t i = 0; i < lines.size(); ++i)
+    {
+        starts.emplace(key_type(lines[i].front().x, lines[i].front().y), i);
+        ends.emplace(key_type(lines[i].back().x, lines[i].back().y), i);
+    }
+    std::vector<bool> used(lines.size(), false);
+    auto find = [&used](std::multimap<key_type, std::size_t> const& index,
+                        mapbox::geometry::point<std::int64_t> const& pt) -> std::size_t
+    {
+        auto range = index.equal_range(key_type(pt.x, pt.y));
+        for (auto itr = range.first; itr != range.second; ++itr)
+        {
+            if (!used[itr->second])
+            {
+                return itr->second;
+            }
+        }
+        return none;
+    };
+
+    mapbox::geometry::multi_line_string<std::int64_t> result;
+    for (std::size_t i = 0; i < lines.size(); ++i)
+    {
+        if (used[i])
+        {
+            continue;
+        }
+        used[i] = true;
+        mapbox::geometry::line_string<std::int64_t> line(lines[i]);
+        for (std::size_t next = find(starts, line.back()); next != none; next = find(starts, line.back()))
+        {
+            used[next] = true;
+            line.insert(line.end(), lines[next].begin() + 1, lines[next].end());
+        }
+        for (std::size_t previous = find(ends, line.front()); previous != none; previous = find(ends, line.front()))
+        {
+            used[previous] = true;
+            line.insert(line.begin(), lines[previous].begin(), lines[previous].end() - 1);
+        }
+        result.push_back(std::move(line));
+    }
+    return result;
+}
+
+// Union of polygons, overlapping and adjacent polygons become one
+inline mapbox::geometry::multi_polygon<std::int64_t> merge_polygons(mapbox::geometry::multi_polygon<std::int64_t> const& polygons)
+{
+    if (polygons.size() < 2)
+    {
+        return polygons;
+    }
+    mapbox::geometry::wagyu::wagyu<std::int64_t> clipper;
+    for (auto const& poly : polygons)
+    {
+        for (auto const& ring : poly)
+        {
+            clipper.add_ring(ring);
+        }
+    }
+    mapbox::geometry::multi_polygon<std::int64_t> result;
+    clipper.execute(mapbox::geometry::wagyu::clip_type_union,
+                    result,
+                    mapbox::geometry::wagyu::fill_type_non_zero,
+                    mapbox::geometry::wagyu::fill_type_non_zero);
+    return result;
+}
+
+} // end ns detail
+
+/*
+  Collects the clipped geometries of the features of a layer by geometry
+  type and tags, every group is encoded as a single feature once all the
+  features of the layer were added. Lines touching end to start are
+  joined and polygons are unioned.
+*/
+
+class feature_merger
+{
+    struct group
+    {
+        std::uint64_t id;
+        mapbox::geometry::multi_point<std::int64_t> points;
+        mapbox::geometry::multi_line_string<std::int64_t> lines;
+        mapbox::geometry::multi_polygon<std::int64_t> polygons;
+    };
+
+    using key_type = std::pair<int, std::vector<std::uint32_t> >;
+
+    const bool drop_ids_;
+    std::map<key_type, std::size_t> index_;
+    std::vector<std::pair<key_type, group> > groups_;
+
+    group & find(int type, std::vector<std::uint32_t> const& tags, std::uint64_t id)
+    {
+        key_type key(type, tags);
+        auto result = index_.emplace(key, groups_.size());
+        if (result.second)
+        {
+            groups_.emplace_back(std::move(key), group());
+            groups_.back().second.id = id;
+        }
+        return groups_[result.first->second].second;
+    }
+
+public:
+    explicit feature_merger(bool drop_ids)
+        : drop_ids_(drop_ids),
+          index_(),
+          groups_() {}
+
+    bool empty() const
+    {
+        return groups_.empty();
+    }
+
+    // Whether add would keep any part of a geometry, checked before the
+    // attributes of its feature are added to the layer
+    static bool accepts(mapbox::geometry::point<std::int64_t> const&)
+    {
+        return true;
+    }
+
+    static bool accepts(mapbox::geometry::multi_point<std::int64_t> const& geom)
+    {
+        return !geom.empty();
+    }
+
+    static bool accepts(mapbox::geometry::line_string<std::int64_t> const& geom)
+    {
+        return geom.size() >= 2;
+    }
+
+    static bool accepts(mapbox::geometry::multi_line_string<std::int64_t> const& geom)
+    {
+        for (auto const& line : geom)
+        {
+            if (accepts(line))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool accepts(mapbox::geometry::polygon<std::int64_t> const& geom)
+    {
+        return !geom.empty();
+    }
+
+    static bool accepts(mapbox::geometry::multi_polygon<std::int64_t> const& geom)
+    {
+        for (auto const& poly : geom)
+        {
+            if (accepts(poly))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool add(std::vector<std::uint32_t> const& tags,
+             std::uint64_t id,
+             mapbox::geometry::point<std::int64_t> const& geom)
+    {
+        find(Geometry_Type::POINT, tags, id).points.push_back(geom);
+        return true;
+    }
+
+    bool add(std::vector<std::uint32_t> const& tags,
+             std::uint64_t id,
+             mapbox::geometry::multi_point<std::int64_t> const& geom)
+    {
+        if (!accepts(geom))
+        {
+            return false;
+        }
+        auto & points = find(Geometry_Type::POINT, tags, id).points;
+        points.insert(points.end(), geom.begin(), geom.end());
+        return true;
+    }
+
+    bool add(std::vector<std::uint32_t> const& tags,
+             std::uint64_t id,
+             mapbox::geometry::line_string<std::int64_t> const& geom)
+    {
+        if (!accepts(geom))
+        {
+            return false;
+        }
+        find(Geometry_Type::LINESTRING, tags, id).lines.push_back(geom);
+        return true;
+    }
+
+    bool add(std::vector<std::uint32_t> const& tags,
+             std::uint64_t id,
+             mapbox::geometry::multi_line_string<std::int64_t> const& geom)
+    {
+        bool success = false;
+        for (auto const& line : geom)
+        {
+            if (add(tags, id, line))
+            {
+                success = true;
+            }
+        }
+        return success;
+    }
+
+    bool add(std::vector<std::uint32_t> const& tags,
+             std::uint64_t id,
+             mapbox::geometry::polygon<std::int64_t> const& geom)
+    {
+        if (!accepts(geom))
+        {
+            return false;
+        }
+        find(Geometry_Type::POLYGON, tags, id).polygons.push_back(geom);
+        return true;
+    }
+
+    bool add(std::vector<std::uint32_t> const& tags,
+             std::uint64_t id,
+             mapbox::geometry::multi_polygon<std::int64_t> const& geom)
+    {
+        bool success = false;
+        for (auto const& poly : geom)
+        {
+            if (add(tags, id, poly))
+            {
+                success = true;
+            }
+        }
+        return success;
+    }
+
+    // Encodes a feature per group into the layer, in the order the groups
+    // were first added to
+    void write(protozero::pbf_writer & layer_writer)
+    {
+        for (auto const& entry : groups_)
+        {
+            std::vector<std::uint32_t> const& tags = entry.first.second;
+            group const& g = entry.second;
+            std::int32_t x = 0;
+            std::int32_t y = 0;
+            protozero::pbf_writer feature_writer(layer_writer, Layer_Encoding::FEATURES);
+            bool success = false;
+            switch (entry.first.first)
+            {
+                case Geometry_Type::POINT:
+                    success = encode_geometry_pbf(g.points, feature_writer, x, y);
+                    break;
+                case Geometry_Type::LINESTRING:
+                    success = encode_geometry_pbf(detail::merge_lines(g.lines), feature_writer, x, y);
+                    break;
+                default:
+                    success = encode_geometry_pbf(detail::merge_polygons(g.polygons), feature_writer, x, y);
+                    break;
+            }
+            if (!success)
+            {
+                feature_writer.rollback();
+                continue;
+            }
+            if (!drop_ids_)
+            {
+                feature_writer.add_uint64(Feature_Encoding::ID, g.id);
+            }
+            feature_writer.add_packed_uint32(Feature_Encoding::TAGS, tags.begin(), tags.end());
+        }
+        index_.clear();
+        groups_.clear();
+    }
+};
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
+
+#endif // __MAPNIK_VECTOR_TILE_FEATURE_MERGER_H__
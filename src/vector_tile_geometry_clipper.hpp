@@ -401,5 +401,207 @@ public:
     }
 };
 
+// Drops the rings of a polygon that geometry_clipper would drop because of
+// their area, false when the whole polygon is dropped. Rings reduced to a
+// box are smaller than the original ones, so the area of a polygon is
+// checked before geometry_box_clipper and not by the clipping after it.
+inline bool drop_small_rings(mapbox::geometry::polygon<std::int64_t> & poly, clipper_params const& params)
+{
+    if (poly.empty() || params.area_threshold <= 0)
+    {
+        return true;
+    }
+    auto const& exterior = poly.front();
+    if (exterior.size() >= 3 &&
+        std::abs(detail::area(exterior)) < params.area_threshold &&
+        !params.process_all_rings)
+    {
+        return false;
+    }
+    poly.erase(std::remove_if(poly.begin() + 1, poly.end(),
+        [&params](mapbox::geometry::linear_ring<std::int64_t> const& ring)
+        {
+            return ring.size() >= 3 && std::abs(detail::area(ring)) < params.area_threshold;
+        }), poly.end());
+    return true;
+}
+
+/*
+  Reduces geometries to a box before they are clipped by geometry_clipper
+  to smaller boxes within it. Rings are clipped without being fixed and
+  keep their place in their polygon. No ring is dropped by area, the rings
+  below the area threshold have to be dropped with drop_small_rings before
+  the reduction and the clipping after it must not use the threshold.
+  Geometries within the box are passed on as is, the results of the others
+  are indexed again.
+*/
+
+template <typename NextProcessor>
+class geometry_box_clipper
+{
+    NextProcessor & next_;
+    mapnik::box2d<std::int64_t> const& box_;
+
+    mapbox::geometry::linear_ring<std::int64_t> clip_box() const
+    {
+        mapbox::geometry::linear_ring<std::int64_t> ring;
+        ring.reserve(5);
+        ring.emplace_back(box_.minx(), box_.miny());
+        ring.emplace_back(box_.maxx(), box_.miny());
+        ring.emplace_back(box_.maxx(), box_.maxy());
+        ring.emplace_back(box_.minx(), box_.maxy());
+        ring.emplace_back(box_.minx(), box_.miny());
+        return ring;
+    }
+
+    // Empty when no ring of the polygon is left within the box
+    mapbox::geometry::polygon<std::int64_t> clip_polygon(mapbox::geometry::polygon<std::int64_t> const& poly) const
+    {
+        mapbox::geometry::box<std::int64_t> b(
+            mapbox::geometry::point<std::int64_t>(box_.minx(), box_.miny()),
+            mapbox::geometry::point<std::int64_t>(box_.maxx(), box_.maxy()));
+        mapbox::geometry::polygon<std::int64_t> result;
+        bool has_ring = false;
+        for (auto const& ring : poly)
+        {
+            if (ring.size() < 3)
+            {
+                result.emplace_back();
+                continue;
+            }
+            result.push_back(mapbox::geometry::wagyu::quick_clip::quick_lr_clip(ring, b));
+            has_ring = has_ring || !result.back().empty();
+        }
+        if (!has_ring)
+        {
+            result.clear();
+        }
+        return result;
+    }
+
+public:
+    geometry_box_clipper(mapnik::box2d<std::int64_t> const& box,
+                         NextProcessor & next) :
+        next_(next),
+        box_(box)
+    {
+    }
+
+    void operator() (indexed_point const & geom)
+    {
+        if (box_.intersects(geom.geom.x, geom.geom.y))
+        {
+            next_(geom);
+        }
+    }
+
+    void operator() (indexed_multi_point const & geom)
+    {
+        if (box_.contains(geom.envelope))
+        {
+            next_(geom);
+            return;
+        }
+        mapbox::geometry::multi_point<std::int64_t> result;
+        std::copy_if(geom.geom.begin(), geom.geom.end(),
+            std::back_inserter(result),
+            [&](mapbox::geometry::point<std::int64_t> const & p)
+            {
+                return box_.intersects(p.x, p.y);
+            });
+        if (!result.empty())
+        {
+            indexed_multi_point indexed(result);
+            next_(indexed);
+        }
+    }
+
+    void operator() (indexed_line_string const & geom)
+    {
+        if (box_.contains(geom.envelope))
+        {
+            next_(geom);
+            return;
+        }
+        if (geom.geom.size() < 2)
+        {
+            return;
+        }
+        mapbox::geometry::multi_line_string<std::int64_t> result;
+        boost::geometry::intersection(clip_box(), geom.geom, result);
+        if (!result.empty())
+        {
+            indexed_multi_line_string indexed(result);
+            next_(indexed);
+        }
+    }
+
+    void operator() (indexed_multi_line_string const & geom)
+    {
+        if (box_.contains(geom.envelope))
+        {
+            next_(geom);
+            return;
+        }
+        mapbox::geometry::linear_ring<std::int64_t> ring(clip_box());
+        mapbox::geometry::multi_line_string<std::int64_t> result;
+        for (auto const& indexed_line : geom.geoms)
+        {
+            if (indexed_line.geom.size() < 2 || !box_.intersects(indexed_line.envelope))
+            {
+                continue;
+            }
+            boost::geometry::intersection(ring, indexed_line.geom, result);
+        }
+        if (!result.empty())
+        {
+            indexed_multi_line_string indexed(result);
+            next_(indexed);
+        }
+    }
+
+    void operator() (indexed_polygon const & geom)
+    {
+        if (box_.contains(geom.envelope))
+        {
+            next_(geom);
+            return;
+        }
+        mapbox::geometry::polygon<std::int64_t> result(clip_polygon(geom.geom));
+        if (!result.empty())
+        {
+            indexed_polygon indexed(result);
+            next_(indexed);
+        }
+    }
+
+    void operator() (indexed_multi_polygon const & geom)
+    {
+        if (box_.contains(geom.envelope))
+        {
+            next_(geom);
+            return;
+        }
+        mapbox::geometry::multi_polygon<std::int64_t> result;
+        for (auto const& indexed_poly : geom.geoms)
+        {
+            if (!box_.intersects(indexed_poly.envelope))
+            {
+                continue;
+            }
+            mapbox::geometry::polygon<std::int64_t> poly(clip_polygon(indexed_poly.geom));
+            if (!poly.empty())
+            {
+                result.push_back(std::move(poly));
+            }
+        }
+        if (!result.empty())
+        {
+            indexed_multi_polygon indexed(result);
+            next_(indexed);
+        }
+    }
+};
+
 } // end ns vector_tile_impl
 } // end ns mapnik
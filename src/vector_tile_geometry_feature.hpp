@@ -5,6 +5,7 @@
 #include "vector_tile_config.hpp"
 #include "vector_tile_layer.hpp"
 #include "vector_tile_geometry_encoder_pbf.hpp"
+#include "vector_tile_stats.hpp"
 
 // mapnik
 #include <mapnik/feature.hpp>
@@ -45,6 +46,31 @@ struct geometry_to_feature_pbf_visitor
     template <typename T>
     void operator() (T const& geom)
     {
+        if (builder_.recorder)
+        {
+            auto start = builder_.recorder->now();
+            bool success = encode(geom);
+            builder_.recorder->encoded(geom, start, success);
+        }
+        else
+        {
+            encode(geom);
+        }
+    }
+
+    template <typename T>
+    bool encode(T const& geom)
+    {
+        if (builder_.merger)
+        {
+            if (!builder_.merger->accepts(geom))
+            {
+                return false;
+            }
+            std::vector<std::uint32_t> feature_tags;
+            builder_.add_feature(mapnik_feature_, feature_tags);
+            return builder_.merger->add(feature_tags, static_cast<std::uint64_t>(mapnik_feature_.id()), geom);
+        }
         std::int32_t x = 0;
         std::int32_t y = 0;
         bool success = false;
@@ -62,7 +88,8 @@ struct geometry_to_feature_pbf_visitor
             {
                 feature_writer.rollback();
             }
-        }   
+        }
+        return success;
     }
 
     void operator() (mapbox::geometry::geometry_collection<std::int64_t> const& collection)
@@ -2,7 +2,14 @@
 #define __MAPNIK_VECTOR_TILE_LAYER_H__
 
 // mapnik-vector-tile
+#include "vector_tile_buffer_pool.hpp"
+#include "vector_tile_byte_budget.hpp"
 #include "vector_tile_config.hpp"
+#include "vector_tile_feature_merger.hpp"
+#include "vector_tile_point_thinner.hpp"
+#include "vector_tile_projection_cache.hpp"
+#include "vector_tile_style_filter.hpp"
+#include "vector_tile_value_cache.hpp"
 
 // mapnik
 #include <mapnik/box2d.hpp>
@@ -18,13 +25,19 @@
 #include <mapnik/value.hpp>
 #include <mapnik/view_transform.hpp>
 #include <mapnik/rule_cache.hpp>
-#include <mapnik/expression_evaluator.hpp>
 
 // protozero
 #include <protozero/pbf_writer.hpp>
 
 // std
+#include <cmath>
+#include <limits>
 #include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 #include <unordered_map>
 #include <utility>
 
@@ -34,20 +47,121 @@ namespace mapnik
 namespace vector_tile_impl
 {
 
+namespace detail
+{
+
+class stats_recorder;
+
+// Size of a field of a layer message holding size bytes, all the fields of
+// layers use a single byte key
+inline std::size_t framed_size(std::size_t size)
+{
+    std::size_t length = 1;
+    for (std::size_t value = size; value >= 0x80; value >>= 7)
+    {
+        ++length;
+    }
+    return 1 + length + size;
+}
+
+} // end ns detail
+
+// Key slot of layer_builder_pbf whose attribute was not used yet
+constexpr unsigned unassigned_key_slot = std::numeric_limits<unsigned>::max();
+// Key slot of layer_builder_pbf whose attribute is not encoded
+constexpr unsigned excluded_key_slot = unassigned_key_slot - 1;
+
+// Attributes of the features of a layer that are queried and encoded
+struct attribute_filter
+{
+    bool has_include;
+    std::set<std::string> include;
+    std::set<std::string> exclude;
+
+    attribute_filter()
+        : has_include(false),
+          include(),
+          exclude() {}
+
+    bool enabled() const
+    {
+        return has_include || !exclude.empty();
+    }
+
+    bool accepts(std::string const& name) const
+    {
+        return (!has_include || include.count(name) > 0) && exclude.count(name) == 0;
+    }
+};
+
+// Drops the features with the lowest priority from the layer message
+// starting at offset in layer_buffer until the message is at most budget
+// bytes, keys and values no longer referenced are dropped as well. The
+// message is removed when no feature fits, the bytes before offset are
+// kept. Returns the number of dropped features.
+MAPNIK_VECTOR_INLINE std::size_t apply_byte_budget(std::string & layer_buffer,
+                                                   std::size_t offset,
+                                                   std::size_t budget,
+                                                   byte_budget const& params);
+
+// Rewrites the layer message starting at offset in layer_buffer with its
+// keys and values ordered by the number of features referencing them, the
+// most referenced first, and integer values in their smallest encoding.
+// Keys and values no feature references are dropped.
+MAPNIK_VECTOR_INLINE void compact_layer(std::string & layer_buffer, std::size_t offset);
+
+// Rewrites the layer message starting at offset in layer_buffer with its
+// features ordered along a Hilbert curve over the tile by the center of
+// their envelope, features of the same cell of the curve keep their order.
+MAPNIK_VECTOR_INLINE void hilbert_order_layer(std::string & layer_buffer, std::size_t offset);
+
 struct layer_builder_pbf
 {
     typedef std::map<std::string, unsigned> keys_container;
     typedef std::unordered_map<mapnik::value, unsigned> values_container;
+    // Key index by attribute index of a context, unassigned_key_slot
+    // until the attribute is first used
+    typedef std::vector<unsigned> key_slots_container;
 
     keys_container keys;
     values_container values;
+    // Features of a layer usually share a single context, the key of
+    // their attributes is then found by attribute index instead of by name
+    mapnik::context_ptr slots_context;
+    key_slots_container key_slots;
     std::string & layer_buffer;
+    std::size_t start;
     std::size_t initial_size;
+    // Set while statistics are collected for the layer
+    detail::stats_recorder * recorder;
+    // Set when the size of the layer is bounded
+    byte_budget const* budget;
+    // Set when encoded values are shared across tiles
+    value_cache * values_cache;
+    // Set when only some attributes are encoded
+    attribute_filter const* attributes;
+    // Whether the layer is compacted once finalized
+    bool compact;
+    // Whether the features are ordered along a Hilbert curve once finalized
+    bool hilbert_order;
+    // Set when the features of the layer are merged, they are then only
+    // encoded once finalized
+    std::unique_ptr<feature_merger> merger;
 
     layer_builder_pbf(std::string const & name, std::uint32_t extent, std::string & _layer_buffer)
         : keys(),
           values(),
-          layer_buffer(_layer_buffer)
+          slots_context(),
+          key_slots(),
+          layer_buffer(_layer_buffer),
+          start(_layer_buffer.size()),
+          recorder(nullptr),
+          budget(nullptr),
+          values_cache(nullptr),
+          attributes(nullptr),
+          compact(false),
+          hilbert_order(false),
+          merger()
     {
         protozero::pbf_writer layer_writer(layer_buffer);
         layer_writer.add_uint32(Layer_Encoding::VERSION, 2);
@@ -61,16 +175,59 @@ struct layer_builder_pbf
         return layer_buffer.size() <= initial_size;
     }
 
+    std::size_t size() const
+    {
+        return layer_buffer.size() - start;
+    }
+
+    // No feature added from now on could be kept within the budget
+    bool exhausted() const
+    {
+        return budget &&
+               budget->priority == BUDGET_FEATURE_ORDER &&
+               budget->layer_limit() > 0 &&
+               size() > budget->layer_limit();
+    }
+
     void finalize()
     {
+        if (merger)
+        {
+            protozero::pbf_writer layer_writer(layer_buffer);
+            merger->write(layer_writer);
+            merger.reset();
+        }
+        if (budget && budget->layer_limit() > 0 && size() > budget->layer_limit())
+        {
+            apply_byte_budget(layer_buffer, start, budget->layer_limit(), *budget);
+        }
+        if (hilbert_order && !empty())
+        {
+            hilbert_order_layer(layer_buffer, start);
+        }
+        if (compact && !empty())
+        {
+            compact_layer(layer_buffer, start);
+        }
         if (empty())
         {
-            layer_buffer.clear();
+            layer_buffer.resize(start);
         }
     }
 
+    // Index of a key, added to the layer on its first use
+    MAPNIK_VECTOR_INLINE unsigned key_index(protozero::pbf_writer & layer_writer, std::string const& name);
+
+    // Adds the Value message of a value new to the layer
+    MAPNIK_VECTOR_INLINE void add_value(protozero::pbf_writer & layer_writer, mapnik::value const& val);
+
     MAPNIK_VECTOR_INLINE protozero::pbf_writer add_feature(mapnik::feature_impl const& mapnik_feature,
                                                            std::vector<std::uint32_t> & feature_tags);
+
+    // Appends the features of another encoded layer, its keys and values
+    // are merged into the dictionaries of this layer and the tags of the
+    // features are remapped accordingly.
+    MAPNIK_VECTOR_INLINE void merge(std::string const& buffer);
 };
 
 class vector_layer
@@ -82,16 +239,58 @@ protected:
     double scale_denom_;
     std::int32_t buffer_size_;
     mapnik::datasource_ptr ds_;
-    mapnik::projection target_proj_;
-    mapnik::projection source_proj_;
-    mapnik::proj_transform prj_trans_;
+    layer_projections_ptr projections_;
     std::string name_;
     std::uint32_t layer_extent_;
     mapnik::box2d<double> target_buffered_extent_;
     mapnik::box2d<double> source_buffered_extent_;
+    attribute_filter attributes_;
+    style_filter_cache * style_filter_cache_;
     boost::optional<mapnik::query> query_;
     mapnik::view_transform view_trans_;
     const double simplify_distance_;
+    point_thinning thinning_;
+    feature_merging merging_;
+    byte_budget const* byte_budget_;
+    value_cache * value_cache_;
+    bool compact_;
+    bool hilbert_order_;
+    bool partial_;
+
+    // Rules of the layer styles active at its scale denominator
+    std::vector<mapnik::rule_cache> get_active_rules() const
+    {
+        std::vector<mapnik::rule_cache> active_rules;
+
+        for (auto const & style_name : layer_.styles())
+        {
+            boost::optional<mapnik::feature_type_style const &> style = map_.find_style(style_name);
+
+            if (!style)
+            {
+                continue;
+            }
+
+            active_rules.emplace_back();
+            bool has_active_rules = false;
+
+            for (auto const & rule : style->get_rules())
+            {
+                if (rule.active(scale_denom_))
+                {
+                    has_active_rules = true;
+                    active_rules.back().add_rule(rule);
+                }
+            }
+
+            if (!has_active_rules)
+            {
+                active_rules.pop_back();
+            }
+        }
+
+        return active_rules;
+    }
 
 public:
     vector_layer(mapnik::Map const& map,
@@ -106,20 +305,29 @@ public:
                bool style_level_filter,
                double simplify_distance,
                mapnik::attributes const& vars,
-               unsigned span)
+               unsigned span,
+               projection_cache * proj_cache,
+               style_filter_cache * filter_cache = nullptr)
         : span_(span),
           map_(map),
           layer_(lay),
           scale_denom_(scale_denom),
           buffer_size_(calc_buffer_size(buffer_size, tile_size, span, lay)),
           ds_(lay.datasource()),
-          target_proj_(map.srs(), true),
-          source_proj_(lay.srs(), true),
-          prj_trans_(target_proj_, source_proj_),
+          projections_(proj_cache ? proj_cache->get(map.srs(), lay.srs())
+                                  : std::make_shared<layer_projections>(map.srs(), lay.srs())),
           name_(lay.name()),
+          style_filter_cache_(filter_cache),
           query_(calc_query(tile_size, scale_factor, scale_denom, tile_extent_bbox, map, lay, style_level_filter, vars)),
           view_trans_(layer_extent_, layer_extent_, tile_extent_bbox, offset_x, offset_y),
-          simplify_distance_(calc_simplify_distance(simplify_distance))
+          simplify_distance_(calc_simplify_distance(simplify_distance)),
+          thinning_(calc_point_thinning()),
+          merging_(calc_feature_merging()),
+          byte_budget_(nullptr),
+          value_cache_(nullptr),
+          compact_(false),
+          hilbert_order_(false),
+          partial_(false)
     {
     }
 
@@ -131,16 +339,23 @@ public:
           scale_denom_(std::move(rhs.scale_denom_)),
           buffer_size_(std::move(rhs.buffer_size_)),
           ds_(std::move(rhs.ds_)),
-          target_proj_(std::move(rhs.target_proj_)),
-          source_proj_(std::move(rhs.source_proj_)),
-          prj_trans_(target_proj_, source_proj_),
+          projections_(std::move(rhs.projections_)),
           name_(std::move(rhs.name_)),
           layer_extent_(std::move(rhs.layer_extent_)),
           target_buffered_extent_(std::move(rhs.target_buffered_extent_)),
           source_buffered_extent_(std::move(rhs.source_buffered_extent_)),
+          attributes_(std::move(rhs.attributes_)),
+          style_filter_cache_(rhs.style_filter_cache_),
           query_(std::move(rhs.query_)),
           view_trans_(std::move(rhs.view_trans_)),
-          simplify_distance_(std::move(rhs.simplify_distance_))
+          simplify_distance_(std::move(rhs.simplify_distance_)),
+          thinning_(std::move(rhs.thinning_)),
+          merging_(rhs.merging_),
+          byte_budget_(rhs.byte_budget_),
+          value_cache_(rhs.value_cache_),
+          compact_(rhs.compact_),
+          hilbert_order_(rhs.hilbert_order_),
+          partial_(rhs.partial_)
     {
     }
 
@@ -163,6 +378,97 @@ public:
         return simplify_distance;
     }
 
+    point_thinning calc_point_thinning() const
+    {
+        point_thinning thinning;
+        if (ds_)
+        {
+            mapnik::parameters const& params = ds_->params();
+            auto grid = params.template get<mapnik::value_double>("mvt_thin_grid");
+            if (grid && *grid > 0.0)
+            {
+                thinning.grid = *grid;
+                thinning.priority = *params.template get<std::string>("mvt_thin_priority", std::string());
+                thinning.count = *params.template get<std::string>("mvt_thin_count", std::string());
+            }
+        }
+        return thinning;
+    }
+
+    feature_merging calc_feature_merging() const
+    {
+        feature_merging merging;
+        if (ds_)
+        {
+            mapnik::parameters const& params = ds_->params();
+            auto enabled = params.template get<mapnik::value_bool>("mvt_merge_features");
+            if (enabled && *enabled)
+            {
+                merging.enabled = true;
+                auto drop_ids = params.template get<mapnik::value_bool>("mvt_merge_drop_ids");
+                merging.drop_ids = drop_ids && *drop_ids;
+            }
+        }
+        return merging;
+    }
+
+    // Reads a list of attributes from a datasource parameter. Entries are
+    // separated by commas and are either "name", "name:minzoom" or
+    // "name:minzoom-maxzoom", only the entries covering the zoom level of
+    // the scale denominator are added to names.
+    bool calc_attribute_list(std::string const& param,
+                             double scale_denom,
+                             std::set<std::string> & names) const
+    {
+        if (!ds_)
+        {
+            return false;
+        }
+        auto val = ds_->params().template get<std::string>(param);
+        if (!val)
+        {
+            return false;
+        }
+        const long zoom = scale_denom > 0.0 ? std::lround(std::log2(559082264.0287178 / scale_denom)) : 0;
+        std::istringstream entries(*val);
+        std::string entry;
+        while (std::getline(entries, entry, ','))
+        {
+            long min_zoom = std::numeric_limits<long>::min();
+            long max_zoom = std::numeric_limits<long>::max();
+            std::string::size_type colon = entry.find(':');
+            if (colon != std::string::npos)
+            {
+                std::string range = entry.substr(colon + 1);
+                entry.erase(colon);
+                std::string::size_type dash = range.find('-');
+                try
+                {
+                    min_zoom = std::stol(range.substr(0, dash));
+                    if (dash != std::string::npos)
+                    {
+                        max_zoom = std::stol(range.substr(dash + 1));
+                    }
+                }
+                catch (std::exception const&)
+                {
+                    throw std::runtime_error("vector_tile_processor: invalid zoom range in " + param + ": " + range);
+                }
+            }
+            std::string::size_type first = entry.find_first_not_of(" \t\n\r");
+            if (first == std::string::npos)
+            {
+                continue;
+            }
+            std::string::size_type last = entry.find_last_not_of(" \t\n\r");
+            if (zoom >= min_zoom && zoom <= max_zoom)
+            {
+                names.insert(entry.substr(first, last - first + 1));
+            }
+        }
+        return true;
+    }
+
     std::uint32_t calc_extent(std::uint32_t layer_extent) const
     {
         if (!ds_)
@@ -246,7 +552,7 @@ public:
         if (scale_denom <= 0.0)
         {
             double scale = tile_extent_bbox.width() / (VT_LEGACY_IMAGE_SIZE * span_);
-            scale_denom = mapnik::scale_denominator(scale, target_proj_.is_geographic());
+            scale_denom = mapnik::scale_denominator(scale, projections_->target.is_geographic());
         }
         scale_denom *= scale_factor;
         if (!is_active(map, lay, scale_denom, style_level_filter))
@@ -260,22 +566,22 @@ public:
         mapnik::box2d<double> query_extent(lay.envelope()); // source projection
 
         // first, try intersection of map extent forward projected into layer srs
-        if (prj_trans_.forward(source_buffered_extent_, PROJ_ENVELOPE_POINTS) && source_buffered_extent_.intersects(query_extent))
+        if (projections_->transform.forward(source_buffered_extent_, PROJ_ENVELOPE_POINTS) && source_buffered_extent_.intersects(query_extent))
         {
             // this modifies the query_extent by clipping to the buffered_ext
             query_extent.clip(source_buffered_extent_);
         }
         // if no intersection and projections are also equal, early return
-        else if (prj_trans_.equal())
+        else if (projections_->transform.equal())
         {
             return boost::none;
         }
         // next try intersection of layer extent back projected into map srs
-        else if (prj_trans_.backward(query_extent, PROJ_ENVELOPE_POINTS) && target_buffered_extent_.intersects(query_extent))
+        else if (projections_->transform.backward(query_extent, PROJ_ENVELOPE_POINTS) && target_buffered_extent_.intersects(query_extent))
         {
             query_extent.clip(target_buffered_extent_);
             // forward project layer extent back into native projection
-            if (!prj_trans_.forward(query_extent, PROJ_ENVELOPE_POINTS))
+            if (!projections_->transform.forward(query_extent, PROJ_ENVELOPE_POINTS))
             {
                 throw std::runtime_error("vector_tile_processor: query extent did not reproject back to map projection");
             }
@@ -287,15 +593,15 @@ public:
         }
 
         mapnik::box2d<double> unbuffered_query_extent(tile_extent_bbox);
-        if (!prj_trans_.equal())
+        if (!projections_->transform.equal())
         {
-            if (!prj_trans_.forward(unbuffered_query_extent, PROJ_ENVELOPE_POINTS))
+            if (!projections_->transform.forward(unbuffered_query_extent, PROJ_ENVELOPE_POINTS))
             {
                 unbuffered_query_extent = lay.envelope();
-                if (prj_trans_.backward(unbuffered_query_extent, PROJ_ENVELOPE_POINTS))
+                if (projections_->transform.backward(unbuffered_query_extent, PROJ_ENVELOPE_POINTS))
                 {
                     unbuffered_query_extent.clip(tile_extent_bbox);
-                    prj_trans_.forward(unbuffered_query_extent, PROJ_ENVELOPE_POINTS);
+                    projections_->transform.forward(unbuffered_query_extent, PROJ_ENVELOPE_POINTS);
                 }
             }
         }
@@ -316,13 +622,37 @@ public:
         mapnik::query q(query_extent, res, scale_denom, unbuffered_query_extent);
         if (ds_)
         {
+            attributes_.has_include = calc_attribute_list("mvt_include_attributes", scale_denom, attributes_.include);
+            calc_attribute_list("mvt_exclude_attributes", scale_denom, attributes_.exclude);
             mapnik::layer_descriptor lay_desc = ds_->get_descriptor();
             for (mapnik::attribute_descriptor const& desc : lay_desc.get_descriptors())
             {
-                q.add_property_name(desc.get_name());
+                if (attributes_.accepts(desc.get_name()))
+                {
+                    q.add_property_name(desc.get_name());
+                }
             }
         }
-        q.set_variables(vars);
+        // Datasources substituting query variables into their SQL can
+        // select only the features passing the style filters
+        boost::optional<mapnik::value_bool> pushdown;
+        if (ds_)
+        {
+            pushdown = ds_->params().template get<mapnik::value_bool>("mvt_filter_pushdown");
+        }
+        if (pushdown && *pushdown)
+        {
+            mapnik::attributes query_vars(vars);
+            std::string const predicate(style_level_filter ?
+                                        get_style_filter()->predicate(ds_->get_descriptor()) :
+                                        "TRUE");
+            query_vars["mvt_filter"] = mapnik::value_unicode_string::fromUTF8(predicate);
+            q.set_variables(query_vars);
+        }
+        else
+        {
+            q.set_variables(vars);
+        }
         return q;
     }
 
@@ -359,65 +689,24 @@ public:
         return false;
     }
 
-    std::vector<mapnik::rule_cache> get_active_rules() const
+    // The active rules compiled into a filter, shared by all the layers
+    // of the same scale denominator when a cache is set
+    style_filter_ptr get_style_filter() const
     {
-        std::vector<mapnik::rule_cache> active_rules;
-
-        for (auto const & style_name : layer_.styles())
+        if (style_filter_cache_)
         {
-            boost::optional<mapnik::feature_type_style const &> style = map_.find_style(style_name);
-
-            if (!style)
+            style_filter_ptr filter = style_filter_cache_->find(layer_, scale_denom_);
+            if (filter)
             {
-                continue;
-            }
-
-            active_rules.emplace_back();
-            bool has_active_rules = false;
-
-            for (auto const & rule : style->get_rules())
-            {
-                if (rule.active(scale_denom_))
-                {
-                    has_active_rules = true;
-                    active_rules.back().add_rule(rule);
-                }
-            }
-
-            if (!has_active_rules)
-            {
-                active_rules.pop_back();
+                return filter;
             }
         }
-
-        return active_rules;
-    }
-
-    bool evaluate_feature(feature_impl const & feature,
-                          std::vector<mapnik::rule_cache> const & active_rules) const
-    {
-        // TODO: accept vars
-        mapnik::attributes vars;
-
-        for (auto const & rc : active_rules)
+        auto filter = std::make_shared<style_filter const>(get_active_rules());
+        if (style_filter_cache_)
         {
-            for (mapnik::rule const* r : rc.get_if_rules())
-            {
-                expression_ptr const& expr = r->get_filter();
-                mapnik::value result = mapnik::util::apply_visitor(
-                    mapnik::evaluate<feature_impl, value_type, attributes>(feature, vars), *expr);
-                if (result.to_bool())
-                {
-                    return true;
-                }
-            }
-
-            if (rc.get_else_rules().size() > 0)
-            {
-                return true;
-            }
+            return style_filter_cache_->insert(layer_, scale_denom_, filter);
         }
-        return false;
+        return filter;
     }
 
     mapnik::datasource_ptr get_ds() const
@@ -439,6 +728,24 @@ public:
         return query_;
     }
 
+    // Whether the features of both layers can be read by a single query
+    bool shares_query(vector_layer const& other) const
+    {
+        if (!ds_ || ds_ != other.ds_ || !query_ || !other.query_)
+        {
+            return false;
+        }
+        mapnik::query const& q = *query_;
+        mapnik::query const& other_q = *other.query_;
+        return q.get_bbox() == other_q.get_bbox() &&
+               q.get_unbuffered_bbox() == other_q.get_unbuffered_bbox() &&
+               q.resolution() == other_q.resolution() &&
+               q.scale_denominator() == other_q.scale_denominator() &&
+               q.get_filter_factor() == other_q.get_filter_factor() &&
+               q.property_names() == other_q.property_names() &&
+               q.variables() == other_q.variables();
+    }
+
     mapnik::view_transform const& get_view_transform() const
     {
         return view_trans_;
@@ -446,7 +753,13 @@ public:
 
     mapnik::proj_transform const& get_proj_transform() const
     {
-        return prj_trans_;
+        return projections_->transform;
+    }
+
+    // The transformation can be used by several threads at once
+    bool thread_safe_projections() const
+    {
+        return projections_->thread_safe();
     }
 
     mapnik::box2d<double> const& get_source_buffered_extent() const
@@ -469,6 +782,12 @@ public:
         return layer_extent_;
     }
 
+    // Number of tiles along each axis covered by the layer
+    unsigned span() const
+    {
+        return span_;
+    }
+
     std::string const& name() const
     {
         return name_;
@@ -483,6 +802,88 @@ public:
     {
         return simplify_distance_;
     }
+
+    point_thinning const& get_point_thinning() const
+    {
+        return thinning_;
+    }
+
+    feature_merging const& get_feature_merging() const
+    {
+        return merging_;
+    }
+
+    byte_budget const* get_byte_budget() const
+    {
+        return byte_budget_;
+    }
+
+    void set_byte_budget(byte_budget const* budget)
+    {
+        byte_budget_ = budget;
+    }
+
+    // Null when all the attributes are encoded
+    attribute_filter const* get_attribute_filter() const
+    {
+        return attributes_.enabled() ? &attributes_ : nullptr;
+    }
+
+    value_cache * get_value_cache() const
+    {
+        return value_cache_;
+    }
+
+    void set_value_cache(value_cache * cache)
+    {
+        value_cache_ = cache;
+    }
+
+    // Whether the keys and values of the layer are ordered by frequency
+    // once all its features are encoded
+    bool get_compact() const
+    {
+        return compact_;
+    }
+
+    void set_compact(bool compact)
+    {
+        compact_ = compact;
+    }
+
+    // Whether the features of the layer are ordered along a Hilbert curve
+    // once all of them are encoded
+    bool get_hilbert_order() const
+    {
+        return hilbert_order_;
+    }
+
+    void set_hilbert_order(bool hilbert_order)
+    {
+        hilbert_order_ = hilbert_order;
+    }
+
+    style_filter_cache * get_style_filter_cache() const
+    {
+        return style_filter_cache_;
+    }
+
+    void set_style_filter_cache(style_filter_cache * cache)
+    {
+        style_filter_cache_ = cache;
+    }
+
+    // The encoding of the layer was cancelled before all its features
+    // were read
+    bool is_partial() const
+    {
+        return partial_;
+    }
+
+    void set_partial()
+    {
+        partial_ = true;
+    }
 };
 
 class tile_layer : public vector_layer
@@ -500,11 +901,13 @@ public:
                int offset_y,
                bool style_level_filter,
                double simplify_distance,
-               mapnik::attributes const& vars) :
+               mapnik::attributes const& vars,
+               projection_cache * proj_cache = nullptr,
+               style_filter_cache * filter_cache = nullptr) :
         vector_layer(map, lay, tile.extent(), tile.tile_size(),
                      tile.buffer_size(), scale_factor, scale_denom,
                      offset_x, offset_y, style_level_filter,
-                     simplify_distance, vars, 1)
+                     simplify_distance, vars, 1, proj_cache, filter_cache)
     {
     }
 
@@ -530,6 +933,25 @@ public:
     {
         return buffer_.empty();
     }
+
+    // Takes the buffer from a pool, must be called before encoding
+    void acquire_buffers(buffer_pool & pool)
+    {
+        buffer_ = pool.acquire(name_, 0);
+    }
+
+    void record_buffers(buffer_pool & pool) const
+    {
+        pool.record(name_, buffer_.size());
+    }
+
+    // Hands the buffer back to the pool, for layers whose buffer was not
+    // moved into a tile
+    void release_buffers(buffer_pool & pool)
+    {
+        pool.release(std::move(buffer_));
+        buffer_.clear();
+    }
 };
 
 class wafer_layer : public vector_layer
@@ -547,11 +969,13 @@ public:
                int offset_y,
                bool style_level_filter,
                double simplify_distance,
-               mapnik::attributes const& vars) :
+               mapnik::attributes const& vars,
+               projection_cache * proj_cache = nullptr,
+               style_filter_cache * filter_cache = nullptr) :
         vector_layer(map, lay, wafer.extent(), wafer.tile_size(),
                      wafer.buffer_size(), scale_factor, scale_denom,
                      offset_x, offset_y, style_level_filter,
-                     simplify_distance, vars, wafer.span()),
+                     simplify_distance, vars, wafer.span(), proj_cache, filter_cache),
         buffers_(wafer.tiles().size())
     {
     }
@@ -586,11 +1010,32 @@ public:
         return true;
     }
 
-    // TODO: Fake support for rasters
-    std::string raster_buffer_;
-    std::string & get_data()
+    // Takes the buffers from a pool, must be called before encoding
+    void acquire_buffers(buffer_pool & pool)
+    {
+        for (auto & buffer : buffers_)
+        {
+            buffer = pool.acquire(name_, 0);
+        }
+    }
+
+    void record_buffers(buffer_pool & pool) const
     {
-        return raster_buffer_;
+        for (auto const & buffer : buffers_)
+        {
+            pool.record(name_, buffer.size());
+        }
+    }
+
+    // Hands the buffers back to the pool, for layers whose buffers were
+    // not moved into the tiles of a wafer
+    void release_buffers(buffer_pool & pool)
+    {
+        for (auto & buffer : buffers_)
+        {
+            pool.release(std::move(buffer));
+            buffer.clear();
+        }
     }
 
     std::int32_t buffer_size() const
@@ -5,9 +5,14 @@
 #include <mapnik/unicode.hpp>
 
 // protozero
+#include <protozero/pbf_reader.hpp>
 #include <protozero/pbf_writer.hpp>
+#include <protozero/varint.hpp>
 
 // std
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <map>
 #include <unordered_map>
 
@@ -64,8 +69,788 @@ private:
     protozero::pbf_writer & value_;
 };
 
+inline mapnik::value decode_tile_value(protozero::pbf_reader value_msg,
+                                       mapnik::transcoder const& tr)
+{
+    while (value_msg.next())
+    {
+        switch (value_msg.tag())
+        {
+            case Value_Encoding::STRING:
+                {
+                    const auto str = value_msg.get_view();
+                    return mapnik::value(tr.transcode(str.data(), static_cast<std::int32_t>(str.size())));
+                }
+            case Value_Encoding::FLOAT:
+                return mapnik::value(static_cast<mapnik::value_double>(value_msg.get_float()));
+            case Value_Encoding::DOUBLE:
+                return mapnik::value(static_cast<mapnik::value_double>(value_msg.get_double()));
+            case Value_Encoding::INT:
+                return mapnik::value(static_cast<mapnik::value_integer>(value_msg.get_int64()));
+            case Value_Encoding::UINT:
+                return mapnik::value(static_cast<mapnik::value_integer>(value_msg.get_uint64()));
+            case Value_Encoding::SINT:
+                return mapnik::value(static_cast<mapnik::value_integer>(value_msg.get_sint64()));
+            case Value_Encoding::BOOL:
+                return mapnik::value(static_cast<mapnik::value_bool>(value_msg.get_bool()));
+            default:
+                value_msg.skip();
+                break;
+        }
+    }
+    return mapnik::value();
+}
+
+// Copies a feature message, tags are translated through the key and
+// value index maps.
+inline void copy_feature_pbf(protozero::pbf_reader feature_msg,
+                             std::vector<std::uint32_t> const& key_map,
+                             std::vector<std::uint32_t> const& value_map,
+                             protozero::pbf_writer & feature_writer)
+{
+    while (feature_msg.next())
+    {
+        switch (feature_msg.tag())
+        {
+            case Feature_Encoding::ID:
+                feature_writer.add_uint64(Feature_Encoding::ID, feature_msg.get_uint64());
+                break;
+            case Feature_Encoding::TAGS:
+                {
+                    std::vector<std::uint32_t> feature_tags;
+                    bool is_key = true;
+                    for (auto tag : feature_msg.get_packed_uint32())
+                    {
+                        feature_tags.push_back(is_key ? key_map.at(tag) : value_map.at(tag));
+                        is_key = !is_key;
+                    }
+                    feature_writer.add_packed_uint32(Feature_Encoding::TAGS, feature_tags.begin(), feature_tags.end());
+                }
+                break;
+            case Feature_Encoding::TYPE:
+                feature_writer.add_enum(Feature_Encoding::TYPE, feature_msg.get_enum());
+                break;
+            case Feature_Encoding::GEOMETRY:
+            case Feature_Encoding::RASTER:
+                {
+                    const protozero::pbf_tag_type tag = feature_msg.tag();
+                    const auto data = feature_msg.get_view();
+                    feature_writer.add_bytes(tag, data.data(), data.size());
+                }
+                break;
+            default:
+                feature_msg.skip();
+                break;
+        }
+    }
+}
+
+// Value message holding the same value with the smallest encoding, integers
+// are encoded as uint or sint instead of int
+inline std::string compact_tile_value(protozero::data_view const& value)
+{
+    protozero::pbf_reader value_msg(value.data(), value.size());
+    while (value_msg.next())
+    {
+        if (value_msg.tag() != Value_Encoding::INT)
+        {
+            value_msg.skip();
+            continue;
+        }
+        const std::int64_t val = value_msg.get_int64();
+        std::string result;
+        protozero::pbf_writer value_writer(result);
+        if (val < 0)
+        {
+            value_writer.add_sint64(Value_Encoding::SINT, val);
+        }
+        else
+        {
+            value_writer.add_uint64(Value_Encoding::UINT, static_cast<std::uint64_t>(val));
+        }
+        return result;
+    }
+    return std::string(value.data(), value.size());
+}
+
+// Indices sorted by decreasing count, unused indices are left out
+inline std::vector<std::size_t> order_by_count(std::vector<std::size_t> const& counts)
+{
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < counts.size(); ++i)
+    {
+        if (counts[i] > 0)
+        {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&counts](std::size_t lhs, std::size_t rhs)
+    {
+        return counts[lhs] > counts[rhs];
+    });
+    return order;
+}
+
+// Area of the polygons of an encoded geometry, zero for other geometries
+template <typename Commands>
+double encoded_polygon_area(Commands const& commands)
+{
+    double area = 0.0;
+    double ring = 0.0;
+    double x = 0.0;
+    double y = 0.0;
+    double start_x = 0.0;
+    double start_y = 0.0;
+    auto itr = commands.begin();
+    auto end = commands.end();
+    while (itr != end)
+    {
+        const std::uint32_t cmd_length = *itr++;
+        const std::uint32_t cmd = cmd_length & 0x7;
+        if (cmd == 7) // ClosePath
+        {
+            ring += x * start_y - start_x * y;
+            area += ring;
+            ring = 0.0;
+            continue;
+        }
+        for (std::uint32_t count = cmd_length >> 3; count > 0 && itr != end; --count)
+        {
+            const double dx = protozero::decode_zigzag32(*itr++);
+            if (itr == end)
+            {
+                break;
+            }
+            const double dy = protozero::decode_zigzag32(*itr++);
+            const double prev_x = x;
+            const double prev_y = y;
+            x += dx;
+            y += dy;
+            if (cmd == 1) // MoveTo
+            {
+                start_x = x;
+                start_y = y;
+                ring = 0.0;
+            }
+            else if (cmd == 2) // LineTo
+            {
+                ring += prev_x * y - x * prev_y;
+            }
+        }
+    }
+    return std::abs(area * 0.5);
+}
+
+// Center of the envelope of an encoded geometry, false when the geometry
+// has no point
+template <typename Commands>
+bool encoded_center(Commands const& commands, double & center_x, double & center_y)
+{
+    std::int64_t x = 0;
+    std::int64_t y = 0;
+    std::int64_t min_x = std::numeric_limits<std::int64_t>::max();
+    std::int64_t min_y = std::numeric_limits<std::int64_t>::max();
+    std::int64_t max_x = std::numeric_limits<std::int64_t>::min();
+    std::int64_t max_y = std::numeric_limits<std::int64_t>::min();
+    auto itr = commands.begin();
+    auto end = commands.end();
+    while (itr != end)
+    {
+        const std::uint32_t cmd_length = *itr++;
+        if ((cmd_length & 0x7) == 7) // ClosePath
+        {
+            continue;
+        }
+        for (std::uint32_t count = cmd_length >> 3; count > 0 && itr != end; --count)
+        {
+            x += protozero::decode_zigzag32(*itr++);
+            if (itr == end)
+            {
+                break;
+            }
+            y += protozero::decode_zigzag32(*itr++);
+            min_x = std::min(min_x, x);
+            min_y = std::min(min_y, y);
+            max_x = std::max(max_x, x);
+            max_y = std::max(max_y, y);
+        }
+    }
+    if (min_x > max_x)
+    {
+        return false;
+    }
+    center_x = 0.5 * static_cast<double>(min_x + max_x);
+    center_y = 0.5 * static_cast<double>(min_y + max_y);
+    return true;
+}
+
+// Distance along a Hilbert curve filling a grid of 2^16 by 2^16 cells
+inline std::uint32_t hilbert_index(std::uint32_t x, std::uint32_t y)
+{
+    std::uint32_t index = 0;
+    for (std::uint32_t s = 1u << 15; s > 0; s >>= 1)
+    {
+        const std::uint32_t rx = (x & s) > 0 ? 1 : 0;
+        const std::uint32_t ry = (y & s) > 0 ? 1 : 0;
+        index += s * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant so that the curve stays continuous
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - (x & (s - 1));
+                y = s - 1 - (y & (s - 1));
+            }
+            std::swap(x, y);
+        }
+        x &= s - 1;
+        y &= s - 1;
+    }
+    return index;
+}
+
 } // end ns detail
 
+MAPNIK_VECTOR_INLINE std::size_t apply_byte_budget(std::string & layer_buffer,
+                                                   std::size_t offset,
+                                                   std::size_t budget,
+                                                   byte_budget const& params)
+{
+    struct feature_entry
+    {
+        protozero::data_view data;
+        std::vector<std::uint32_t> tags;
+        double priority;
+    };
+
+    std::uint32_t version = 2;
+    std::string name;
+    std::uint32_t extent = 4096;
+    std::vector<protozero::data_view> keys;
+    std::vector<protozero::data_view> values;
+    std::vector<feature_entry> features;
+
+    protozero::pbf_reader layer_msg(layer_buffer.data() + offset, layer_buffer.size() - offset);
+    while (layer_msg.next())
+    {
+        switch (layer_msg.tag())
+        {
+            case Layer_Encoding::VERSION:
+                version = layer_msg.get_uint32();
+                break;
+            case Layer_Encoding::NAME:
+                name = layer_msg.get_string();
+                break;
+            case Layer_Encoding::EXTENT:
+                extent = layer_msg.get_uint32();
+                break;
+            case Layer_Encoding::KEYS:
+                keys.push_back(layer_msg.get_view());
+                break;
+            case Layer_Encoding::VALUES:
+                values.push_back(layer_msg.get_view());
+                break;
+            case Layer_Encoding::FEATURES:
+                {
+                    feature_entry feature;
+                    feature.data = layer_msg.get_view();
+                    feature.priority = -static_cast<double>(features.size());
+                    if (params.priority == BUDGET_AREA)
+                    {
+                        feature.priority = 0.0;
+                    }
+                    protozero::pbf_reader feature_msg(feature.data.data(), feature.data.size());
+                    while (feature_msg.next())
+                    {
+                        switch (feature_msg.tag())
+                        {
+                            case Feature_Encoding::TAGS:
+                                for (auto tag : feature_msg.get_packed_uint32())
+                                {
+                                    feature.tags.push_back(tag);
+                                }
+                                break;
+                            case Feature_Encoding::GEOMETRY:
+                                if (params.priority == BUDGET_AREA)
+                                {
+                                    feature.priority = detail::encoded_polygon_area(feature_msg.get_packed_uint32());
+                                }
+                                else
+                                {
+                                    feature_msg.skip();
+                                }
+                                break;
+                            default:
+                                feature_msg.skip();
+                                break;
+                        }
+                    }
+                    features.push_back(std::move(feature));
+                }
+                break;
+            default:
+                layer_msg.skip();
+                break;
+        }
+    }
+
+    if (params.priority == BUDGET_ATTRIBUTE)
+    {
+        // Keys are unique within a layer
+        std::uint32_t priority_key = 0;
+        bool has_key = false;
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            if (params.attribute.size() == keys[i].size() &&
+                params.attribute.compare(0, std::string::npos, keys[i].data(), keys[i].size()) == 0)
+            {
+                priority_key = static_cast<std::uint32_t>(i);
+                has_key = true;
+            }
+        }
+        mapnik::transcoder tr("utf-8");
+        for (auto & feature : features)
+        {
+            feature.priority = -std::numeric_limits<double>::infinity();
+            for (std::size_t i = 0; has_key && i + 1 < feature.tags.size(); i += 2)
+            {
+                if (feature.tags[i] == priority_key && feature.tags[i + 1] < values.size())
+                {
+                    protozero::data_view const& value = values[feature.tags[i + 1]];
+                    feature.priority = detail::decode_tile_value(
+                        protozero::pbf_reader(value.data(), value.size()), tr).to_double();
+                }
+            }
+        }
+    }
+
+    std::vector<std::size_t> order(features.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&features](std::size_t lhs, std::size_t rhs)
+    {
+        return features[lhs].priority > features[rhs].priority;
+    });
+
+    std::string result(layer_buffer, 0, offset);
+    protozero::pbf_writer layer_writer(result);
+    layer_writer.add_uint32(Layer_Encoding::VERSION, version);
+    layer_writer.add_string(Layer_Encoding::NAME, name);
+    layer_writer.add_uint32(Layer_Encoding::EXTENT, extent);
+
+    // Keep the features with the highest priority as long as they fit, the
+    // sizes are upper bounds as remapped tags can only get shorter
+    std::size_t total = result.size() - offset;
+    std::vector<bool> keep(features.size(), false);
+    std::vector<bool> key_used(keys.size(), false);
+    std::vector<bool> value_used(values.size(), false);
+    std::size_t kept = 0;
+    for (std::size_t index : order)
+    {
+        feature_entry const& feature = features[index];
+        std::size_t cost = detail::framed_size(feature.data.size());
+        std::vector<std::uint32_t> new_keys;
+        std::vector<std::uint32_t> new_values;
+        for (std::size_t i = 0; i + 1 < feature.tags.size(); i += 2)
+        {
+            std::uint32_t key = feature.tags[i];
+            std::uint32_t value = feature.tags[i + 1];
+            if (key < keys.size() && !key_used[key] &&
+                std::find(new_keys.begin(), new_keys.end(), key) == new_keys.end())
+            {
+                new_keys.push_back(key);
+                cost += detail::framed_size(keys[key].size());
+            }
+            if (value < values.size() && !value_used[value] &&
+                std::find(new_values.begin(), new_values.end(), value) == new_values.end())
+            {
+                new_values.push_back(value);
+                cost += detail::framed_size(values[value].size());
+            }
+        }
+        if (total + cost > budget)
+        {
+            break;
+        }
+        total += cost;
+        keep[index] = true;
+        ++kept;
+        for (auto key : new_keys)
+        {
+            key_used[key] = true;
+        }
+        for (auto value : new_values)
+        {
+            value_used[value] = true;
+        }
+    }
+
+    if (kept == 0)
+    {
+        layer_buffer.resize(offset);
+        return features.size();
+    }
+
+    std::vector<std::uint32_t> key_map(keys.size(), 0);
+    std::uint32_t next_key = 0;
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        if (key_used[i])
+        {
+            layer_writer.add_bytes(Layer_Encoding::KEYS, keys[i].data(), keys[i].size());
+            key_map[i] = next_key++;
+        }
+    }
+    std::vector<std::uint32_t> value_map(values.size(), 0);
+    std::uint32_t next_value = 0;
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        if (value_used[i])
+        {
+            layer_writer.add_message(Layer_Encoding::VALUES, values[i].data(), values[i].size());
+            value_map[i] = next_value++;
+        }
+    }
+    for (std::size_t i = 0; i < features.size(); ++i)
+    {
+        if (keep[i])
+        {
+            protozero::pbf_writer feature_writer(layer_writer, Layer_Encoding::FEATURES);
+            detail::copy_feature_pbf(protozero::pbf_reader(features[i].data.data(), features[i].data.size()),
+                                     key_map, value_map, feature_writer);
+        }
+    }
+
+    layer_buffer.swap(result);
+    return features.size() - kept;
+}
+
+MAPNIK_VECTOR_INLINE void compact_layer(std::string & layer_buffer, std::size_t offset)
+{
+    std::uint32_t version = 2;
+    std::string name;
+    std::uint32_t extent = 4096;
+    std::vector<protozero::data_view> keys;
+    std::vector<protozero::data_view> features;
+    // Values are deduplicated once compacted
+    std::vector<std::string> values;
+    std::map<std::string, std::uint32_t> value_index;
+    std::vector<std::uint32_t> value_dedup;
+
+    protozero::pbf_reader layer_msg(layer_buffer.data() + offset, layer_buffer.size() - offset);
+    while (layer_msg.next())
+    {
+        switch (layer_msg.tag())
+        {
+            case Layer_Encoding::VERSION:
+                version = layer_msg.get_uint32();
+                break;
+            case Layer_Encoding::NAME:
+                name = layer_msg.get_string();
+                break;
+            case Layer_Encoding::EXTENT:
+                extent = layer_msg.get_uint32();
+                break;
+            case Layer_Encoding::KEYS:
+                keys.push_back(layer_msg.get_view());
+                break;
+            case Layer_Encoding::VALUES:
+                {
+                    std::string value = detail::compact_tile_value(layer_msg.get_view());
+                    auto result = value_index.emplace(value, static_cast<std::uint32_t>(values.size()));
+                    if (result.second)
+                    {
+                        values.push_back(std::move(value));
+                    }
+                    value_dedup.push_back(result.first->second);
+                }
+                break;
+            case Layer_Encoding::FEATURES:
+                features.push_back(layer_msg.get_view());
+                break;
+            default:
+                layer_msg.skip();
+                break;
+        }
+    }
+    if (features.empty())
+    {
+        return;
+    }
+
+    // First pass, count the features referencing each key and value
+    std::vector<std::size_t> key_counts(keys.size(), 0);
+    std::vector<std::size_t> value_counts(values.size(), 0);
+    for (auto const& feature : features)
+    {
+        protozero::pbf_reader feature_msg(feature.data(), feature.size());
+        while (feature_msg.next())
+        {
+            if (feature_msg.tag() != Feature_Encoding::TAGS)
+            {
+                feature_msg.skip();
+                continue;
+            }
+            bool is_key = true;
+            for (auto tag : feature_msg.get_packed_uint32())
+            {
+                if (is_key)
+                {
+                    ++key_counts.at(tag);
+                }
+                else
+                {
+                    ++value_counts.at(value_dedup.at(tag));
+                }
+                is_key = !is_key;
+            }
+        }
+    }
+
+    // Second pass, write the most referenced keys and values first so that
+    // their indices take the fewest bytes in the tags of the features
+    std::string result(layer_buffer, 0, offset);
+    protozero::pbf_writer layer_writer(result);
+    layer_writer.add_uint32(Layer_Encoding::VERSION, version);
+    layer_writer.add_string(Layer_Encoding::NAME, name);
+    layer_writer.add_uint32(Layer_Encoding::EXTENT, extent);
+
+    std::vector<std::uint32_t> key_map(keys.size(), 0);
+    std::uint32_t next_key = 0;
+    for (std::size_t i : detail::order_by_count(key_counts))
+    {
+        layer_writer.add_bytes(Layer_Encoding::KEYS, keys[i].data(), keys[i].size());
+        key_map[i] = next_key++;
+    }
+    std::vector<std::uint32_t> unique_map(values.size(), 0);
+    std::uint32_t next_value = 0;
+    for (std::size_t i : detail::order_by_count(value_counts))
+    {
+        layer_writer.add_message(Layer_Encoding::VALUES, values[i]);
+        unique_map[i] = next_value++;
+    }
+    std::vector<std::uint32_t> value_map(value_dedup.size(), 0);
+    for (std::size_t i = 0; i < value_dedup.size(); ++i)
+    {
+        value_map[i] = unique_map[value_dedup[i]];
+    }
+    for (auto const& feature : features)
+    {
+        protozero::pbf_writer feature_writer(layer_writer, Layer_Encoding::FEATURES);
+        detail::copy_feature_pbf(protozero::pbf_reader(feature.data(), feature.size()),
+                                 key_map, value_map, feature_writer);
+    }
+
+    layer_buffer.swap(result);
+}
+
+MAPNIK_VECTOR_INLINE void hilbert_order_layer(std::string & layer_buffer, std::size_t offset)
+{
+    struct feature_entry
+    {
+        protozero::data_view data;
+        std::uint32_t index;
+    };
+
+    std::uint32_t version = 2;
+    std::string name;
+    std::uint32_t extent = 4096;
+    std::vector<protozero::data_view> keys;
+    std::vector<protozero::data_view> values;
+    std::vector<protozero::data_view> features;
+
+    protozero::pbf_reader layer_msg(layer_buffer.data() + offset, layer_buffer.size() - offset);
+    while (layer_msg.next())
+    {
+        switch (layer_msg.tag())
+        {
+            case Layer_Encoding::VERSION:
+                version = layer_msg.get_uint32();
+                break;
+            case Layer_Encoding::NAME:
+                name = layer_msg.get_string();
+                break;
+            case Layer_Encoding::EXTENT:
+                extent = layer_msg.get_uint32();
+                break;
+            case Layer_Encoding::KEYS:
+                keys.push_back(layer_msg.get_view());
+                break;
+            case Layer_Encoding::VALUES:
+                values.push_back(layer_msg.get_view());
+                break;
+            case Layer_Encoding::FEATURES:
+                features.push_back(layer_msg.get_view());
+                break;
+            default:
+                layer_msg.skip();
+                break;
+        }
+    }
+    if (features.size() < 2)
+    {
+        return;
+    }
+
+    // The curve covers the tile with a buffer of one extent on every side,
+    // centers further out are clamped to its border
+    const double size = 3.0 * static_cast<double>(extent);
+    const double cells = 65535.0;
+    std::vector<feature_entry> entries;
+    entries.reserve(features.size());
+    for (auto const& feature : features)
+    {
+        feature_entry entry { feature, 0 };
+        protozero::pbf_reader feature_msg(feature.data(), feature.size());
+        while (feature_msg.next())
+        {
+            if (feature_msg.tag() != Feature_Encoding::GEOMETRY)
+            {
+                feature_msg.skip();
+                continue;
+            }
+            double x = 0.0;
+            double y = 0.0;
+            if (detail::encoded_center(feature_msg.get_packed_uint32(), x, y))
+            {
+                x = std::min(std::max((x + extent) / size * cells, 0.0), cells);
+                y = std::min(std::max((y + extent) / size * cells, 0.0), cells);
+                entry.index = detail::hilbert_index(static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y));
+            }
+        }
+        entries.push_back(entry);
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](feature_entry const& lhs, feature_entry const& rhs)
+    {
+        return lhs.index < rhs.index;
+    });
+
+    std::string result(layer_buffer, 0, offset);
+    protozero::pbf_writer layer_writer(result);
+    layer_writer.add_uint32(Layer_Encoding::VERSION, version);
+    layer_writer.add_string(Layer_Encoding::NAME, name);
+    layer_writer.add_uint32(Layer_Encoding::EXTENT, extent);
+    for (auto const& key : keys)
+    {
+        layer_writer.add_bytes(Layer_Encoding::KEYS, key.data(), key.size());
+    }
+    for (auto const& value : values)
+    {
+        layer_writer.add_message(Layer_Encoding::VALUES, value.data(), value.size());
+    }
+    for (auto const& entry : entries)
+    {
+        layer_writer.add_message(Layer_Encoding::FEATURES, entry.data.data(), entry.data.size());
+    }
+
+    layer_buffer.swap(result);
+}
+
+MAPNIK_VECTOR_INLINE void layer_builder_pbf::merge(std::string const& buffer)
+{
+    protozero::pbf_reader layer_msg(buffer);
+    protozero::pbf_writer layer_writer(layer_buffer);
+    mapnik::transcoder tr("utf-8");
+    std::vector<std::uint32_t> key_map;
+    std::vector<std::uint32_t> value_map;
+
+    // Keys and values are always written before the first feature
+    // referencing them, so a single pass is enough.
+    while (layer_msg.next())
+    {
+        switch (layer_msg.tag())
+        {
+            case Layer_Encoding::KEYS:
+                {
+                    std::string name = layer_msg.get_string();
+                    keys_container::const_iterator key_itr = keys.find(name);
+                    if (key_itr == keys.end())
+                    {
+                        layer_writer.add_string(Layer_Encoding::KEYS, name);
+                        std::uint32_t index = keys.size();
+                        keys.emplace(std::move(name), index);
+                        key_map.push_back(index);
+                    }
+                    else
+                    {
+                        key_map.push_back(key_itr->second);
+                    }
+                }
+                break;
+            case Layer_Encoding::VALUES:
+                {
+                    const auto value_view = layer_msg.get_view();
+                    mapnik::value val = detail::decode_tile_value(
+                        protozero::pbf_reader(value_view.data(), value_view.size()), tr);
+                    values_container::const_iterator val_itr = values.find(val);
+                    if (val_itr == values.end())
+                    {
+                        layer_writer.add_message(Layer_Encoding::VALUES, value_view.data(), value_view.size());
+                        std::uint32_t index = values.size();
+                        values.emplace(std::move(val), index);
+                        value_map.push_back(index);
+                    }
+                    else
+                    {
+                        value_map.push_back(val_itr->second);
+                    }
+                }
+                break;
+            case Layer_Encoding::FEATURES:
+                {
+                    protozero::pbf_writer feature_writer(layer_writer, Layer_Encoding::FEATURES);
+                    detail::copy_feature_pbf(layer_msg.get_message(), key_map, value_map, feature_writer);
+                }
+                break;
+            default:
+                // Name, version and extent are those of this layer
+                layer_msg.skip();
+                break;
+        }
+    }
+}
+
+MAPNIK_VECTOR_INLINE unsigned layer_builder_pbf::key_index(protozero::pbf_writer & layer_writer,
+                                                            std::string const& name)
+{
+    keys_container::const_iterator key_itr = keys.find(name);
+    if (key_itr != keys.end())
+    {
+        return key_itr->second;
+    }
+    // The key doesn't exist yet in the dictionary.
+    layer_writer.add_string(Layer_Encoding::KEYS, name);
+    unsigned index = keys.size();
+    keys.emplace(name, index);
+    return index;
+}
+
+MAPNIK_VECTOR_INLINE void layer_builder_pbf::add_value(protozero::pbf_writer & layer_writer,
+                                                       mapnik::value const& val)
+{
+    if (!values_cache)
+    {
+        protozero::pbf_writer value_writer(layer_writer, Layer_Encoding::VALUES);
+        detail::to_tile_value_pbf visitor(value_writer);
+        mapnik::util::apply_visitor(visitor, val);
+        return;
+    }
+    if (values_cache->add_value(layer_writer, Layer_Encoding::VALUES, val))
+    {
+        return;
+    }
+    std::string message;
+    {
+        protozero::pbf_writer value_writer(message);
+        detail::to_tile_value_pbf visitor(value_writer);
+        mapnik::util::apply_visitor(visitor, val);
+    }
+    layer_writer.add_message(Layer_Encoding::VALUES, message);
+    values_cache->insert(val, std::move(message));
+}
+
 MAPNIK_VECTOR_INLINE protozero::pbf_writer layer_builder_pbf::add_feature(mapnik::feature_impl const& mapnik_feature,
                                                                           std::vector<std::uint32_t> & feature_tags)
 
@@ -76,44 +861,54 @@ MAPNIK_VECTOR_INLINE protozero::pbf_writer layer_builder_pbf::add_feature(mapnik
     // "the value of the (feature) id SHOULD be unique among the features of the parent layer."
 
     // note that feature.id is signed int64_t so we are casting.
-    
+
+    mapnik::context_ptr context = const_cast<mapnik::feature_impl &>(mapnik_feature).context();
+    if (context != slots_context)
+    {
+        slots_context = context;
+        key_slots.assign(context->size(), unassigned_key_slot);
+    }
+
     // Mapnik features can not have more then one value for
     // a single key. Therefore, we do not have to check if
     // key already exists in the feature as we insert each
-    // key value pair into the feature. 
-    feature_kv_iterator itr = mapnik_feature.begin();
-    feature_kv_iterator end = mapnik_feature.end();
-    for (; itr!=end; ++itr)
+    // key value pair into the feature. Attributes are visited in the
+    // order of the context like feature_kv_iterator does.
+    for (auto const& attribute : *context)
     {
-        std::string const& name = std::get<0>(*itr);
-        mapnik::value const& val = std::get<1>(*itr);
+        std::string const& name = attribute.first;
+        std::size_t slot = attribute.second;
+        mapnik::value const& val = mapnik_feature.get(slot);
         if (!val.is_null())
         {
             // Insert the key index
-            keys_container::const_iterator key_itr = keys.find(name);
-            if (key_itr == keys.end())
+            if (slot >= key_slots.size())
             {
-                // The key doesn't exist yet in the dictionary.
-                layer_writer.add_string(Layer_Encoding::KEYS, name);
-                size_t index = keys.size();
-                keys.emplace(name, index);
-                feature_tags.push_back(index);
+                key_slots.resize(slot + 1, unassigned_key_slot);
             }
-            else
+            if (key_slots[slot] == unassigned_key_slot)
             {
-                feature_tags.push_back(key_itr->second);
+                if (attributes && !attributes->accepts(name))
+                {
+                    key_slots[slot] = excluded_key_slot;
+                }
+                else
+                {
+                    key_slots[slot] = key_index(layer_writer, name);
+                }
             }
+            if (key_slots[slot] == excluded_key_slot)
+            {
+                continue;
+            }
+            feature_tags.push_back(key_slots[slot]);
 
             // Insert the value index
             values_container::const_iterator val_itr = values.find(val);
             if (val_itr == values.end())
             {
                 // The value doesn't exist yet in the dictionary.
-                {
-                    protozero::pbf_writer value_writer(layer_writer, Layer_Encoding::VALUES);
-                    detail::to_tile_value_pbf visitor(value_writer);
-                    mapnik::util::apply_visitor(visitor, val);
-                }
+                add_value(layer_writer, val);
                 size_t index = values.size();
                 values.emplace(val, index);
                 feature_tags.push_back(index);
@@ -0,0 +1,239 @@
+#ifndef __MAPNIK_VECTOR_TILE_POINT_THINNER_H__
+#define __MAPNIK_VECTOR_TILE_POINT_THINNER_H__
+
+// mapnik-vector-tile
+#include "vector_tile_config.hpp"
+#include "geometry_indexer.hpp"
+
+// mapnik
+#include <mapnik/feature.hpp>
+#include <mapnik/feature_factory.hpp>
+#include <mapnik/value.hpp>
+
+// mapbox
+#include <mapbox/geometry/geometry.hpp>
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+// Thinning of the points of a layer, read from the mvt_thin_grid,
+// mvt_thin_priority and mvt_thin_count datasource parameters
+struct point_thinning
+{
+    // Size of the cells in tile units, zero disables thinning
+    double grid;
+    // The point of a cell with the highest value is kept, the first one
+    // when empty
+    std::string priority;
+    // Attribute added to the points kept with the number of points
+    // of their cell, none when empty
+    std::string count;
+
+    point_thinning()
+        : grid(0.0),
+          priority(),
+          count() {}
+
+    bool enabled() const
+    {
+        return grid > 0.0;
+    }
+};
+
+/*
+  Keeps one point per cell of a grid over the tile until the whole layer
+  was read, the points kept are then encoded in the order their cells
+  were first reached.
+*/
+
+class point_grid
+{
+public:
+    using point_type = mapbox::geometry::point<std::int64_t>;
+
+private:
+    struct cell
+    {
+        mapnik::feature_ptr feature;
+        point_type point;
+        mapnik::value priority;
+        std::size_t count;
+        std::size_t order;
+    };
+
+    using cell_key = std::pair<std::int64_t, std::int64_t>;
+
+    point_thinning const& params_;
+    std::map<cell_key, cell> cells_;
+    std::size_t points_;
+    // Context of the last counted feature and the same with the count
+    mapnik::context_ptr source_context_;
+    std::size_t source_size_;
+    mapnik::context_ptr count_context_;
+
+    std::int64_t cell_index(std::int64_t coord) const
+    {
+        return static_cast<std::int64_t>(std::floor(static_cast<double>(coord) / params_.grid));
+    }
+
+    mapnik::feature_ptr counted(cell const& c)
+    {
+        mapnik::context_ptr ctx = c.feature->context();
+        if (ctx != source_context_ || ctx->size() != source_size_)
+        {
+            source_context_ = ctx;
+            source_size_ = ctx->size();
+            count_context_ = std::make_shared<mapnik::context_type>();
+            bool has_count = false;
+            for (auto const& entry : *ctx)
+            {
+                count_context_->push(entry.first);
+                has_count = has_count || entry.first == params_.count;
+            }
+            if (!has_count)
+            {
+                count_context_->push(params_.count);
+            }
+        }
+        mapnik::feature_ptr result(mapnik::feature_factory::create(count_context_, c.feature->id()));
+        for (auto const& entry : *ctx)
+        {
+            result->put(entry.first, c.feature->get(entry.second));
+        }
+        result->put(params_.count, static_cast<mapnik::value_integer>(c.count));
+        return result;
+    }
+
+public:
+    explicit point_grid(point_thinning const& params)
+        : params_(params),
+          cells_(),
+          points_(0),
+          source_context_(),
+          source_size_(0),
+          count_context_() {}
+
+    void add(mapnik::feature_ptr const& feature, point_type const& pt)
+    {
+        mapnik::value priority;
+        if (!params_.priority.empty())
+        {
+            priority = feature->get(params_.priority);
+        }
+        auto result = cells_.emplace(cell_key(cell_index(pt.y), cell_index(pt.x)), cell());
+        cell & c = result.first->second;
+        if (result.second)
+        {
+            c.feature = feature;
+            c.point = pt;
+            c.priority = std::move(priority);
+            c.count = 1;
+            c.order = points_;
+        }
+        else
+        {
+            ++c.count;
+            if ((c.priority.is_null() && !priority.is_null()) || priority > c.priority)
+            {
+                c.feature = feature;
+                c.point = pt;
+                c.priority = std::move(priority);
+            }
+        }
+        ++points_;
+    }
+
+    // Number of points added since the last clear
+    std::size_t points() const
+    {
+        return points_;
+    }
+
+    std::size_t size() const
+    {
+        return cells_.size();
+    }
+
+    // Calls visitor with the feature and the point kept for every cell
+    template <typename Visitor>
+    void for_each(Visitor && visitor)
+    {
+        std::vector<cell const*> ordered;
+        ordered.reserve(cells_.size());
+        for (auto const& entry : cells_)
+        {
+            ordered.push_back(&entry.second);
+        }
+        std::sort(ordered.begin(), ordered.end(), [](cell const* lhs, cell const* rhs)
+        {
+            return lhs->order < rhs->order;
+        });
+        for (cell const* c : ordered)
+        {
+            if (params_.count.empty())
+            {
+                visitor(c->feature, c->point);
+            }
+            else
+            {
+                visitor(counted(*c), c->point);
+            }
+        }
+    }
+
+    void clear()
+    {
+        cells_.clear();
+        points_ = 0;
+    }
+};
+
+// Pipeline stage adding single points to a grid instead of passing them
+// on, every other geometry is passed on. Does nothing without a grid.
+template <typename NextProcessor>
+struct point_thinner
+{
+    point_grid * grid_;
+    mapnik::feature_ptr const& feature_;
+    NextProcessor & next_;
+
+    point_thinner(point_grid * grid, mapnik::feature_ptr const& feature, NextProcessor & next)
+        : grid_(grid),
+          feature_(feature),
+          next_(next) {}
+
+    void operator() (indexed_point & geom)
+    {
+        if (grid_)
+        {
+            grid_->add(feature_, geom.geom);
+        }
+        else
+        {
+            next_(geom);
+        }
+    }
+
+    template <typename T>
+    void operator() (T & geom)
+    {
+        next_(geom);
+    }
+};
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
+
+#endif // __MAPNIK_VECTOR_TILE_POINT_THINNER_H__
@@ -12,12 +12,24 @@
 
 // mapnik-vector-tile
 #include "vector_tile_config.hpp"
+#include "vector_tile_buffer_pool.hpp"
+#include "vector_tile_cancellation.hpp"
 #include "vector_tile_tile.hpp"
 #include "vector_tile_merc_tile.hpp"
 #include "vector_tile_wafer.hpp"
+#include "vector_tile_projection_cache.hpp"
+#include "vector_tile_pyramid.hpp"
+#include "vector_tile_stats.hpp"
+#include "vector_tile_style_filter.hpp"
+#include "vector_tile_thread_pool.hpp"
+#include "vector_tile_value_cache.hpp"
 
 // std
+#include <chrono>
+#include <functional>
 #include <future>
+#include <memory>
+#include <vector>
 
 namespace mapnik
 {
@@ -25,6 +37,10 @@ namespace mapnik
 namespace vector_tile_impl
 {
 
+// Receives every tile of a pyramid once it is complete, the tile may be
+// moved from
+using tile_callback = std::function<void(merc_tile &)>;
+
 /*
   This processor combines concepts from mapnik's
   feature_style_processor and agg_renderer. It
@@ -47,7 +63,20 @@ private:
     bool strictly_simple_;
     bool multi_polygon_union_;
     bool process_all_rings_;
+    bool compact_layers_;
+    bool hilbert_order_;
+    bool wafer_quadtree_clipping_;
     std::launch threading_mode_;
+    std::shared_ptr<thread_pool> thread_pool_;
+    std::size_t layer_chunk_size_;
+    tile_stats * stats_;
+    slow_feature_detector slow_features_;
+    std::shared_ptr<projection_cache> projection_cache_;
+    byte_budget byte_budget_;
+    std::shared_ptr<cancellation_token> cancellation_;
+    std::shared_ptr<value_cache> value_cache_;
+    std::shared_ptr<style_filter_cache> style_filter_cache_;
+    std::shared_ptr<buffer_pool> buffer_pool_;
     mapnik::attributes vars_;
 
     std::int32_t get_buffer_size(std::uint32_t tile_size,
@@ -69,6 +98,29 @@ private:
                           int offset_y,
                           bool style_level_filter) const;
 
+    template <typename Tile, typename Layer>
+    void process_layers(Tile & t,
+                        std::vector<Layer *> const& layers,
+                        std::vector<layer_stats *> const& stats,
+                        bool style_level_filter);
+
+    // Queries and encodes the layers of a tile without adding them to it
+    template <typename Tile, typename Layer>
+    void encode_tile_layers(Tile & t,
+                            std::vector<Layer> & tile_layers,
+                            double scale_denom,
+                            int offset_x,
+                            int offset_y,
+                            bool style_level_filter);
+
+    // Returns false when the tile or a tile below it was cut short
+    MAPNIK_VECTOR_INLINE bool update_pyramid_tile(merc_tile & t,
+                                                  std::uint64_t max_zoom,
+                                                  bool style_level_filter,
+                                                  pyramid_cache const& cache,
+                                                  pyramid_candidates const& candidates,
+                                                  tile_callback const& callback);
+
 public:
     processor(mapnik::Map const& map, mapnik::attributes const& vars = mapnik::attributes())
         : m_(map),
@@ -81,7 +133,20 @@ public:
           strictly_simple_(true),
           multi_polygon_union_(false),
           process_all_rings_(false),
+          compact_layers_(false),
+          hilbert_order_(false),
+          wafer_quadtree_clipping_(false),
           threading_mode_(std::launch::deferred),
+          thread_pool_(),
+          layer_chunk_size_(0),
+          stats_(nullptr),
+          slow_features_(),
+          projection_cache_(),
+          byte_budget_(),
+          cancellation_(),
+          value_cache_(),
+          style_filter_cache_(),
+          buffer_pool_(),
           vars_(vars) {}
 
     template <typename Tile>
@@ -118,10 +183,27 @@ public:
                             bool style_level_filter = false)
     {
         merc_wafer wafer(x, y, z, span, tile_size, get_buffer_size(tile_size, buffer_size));
+        wafer.set_quadtree_clipping(wafer_quadtree_clipping_);
         update_tile(wafer, scale_denom, offset_x, offset_y, style_level_filter);
         return wafer;
     }
     
+    // Creates the wafer (x, y, z) like create_wafer but hands its sub-tiles
+    // one at a time to callback, in the order of merc_wafer::tiles(). The
+    // buffers of a sub-tile are released once the callback returns, so a
+    // wafer is never held in memory as both layers and tiles.
+    MAPNIK_VECTOR_INLINE void stream_wafer(std::uint64_t x,
+                                           std::uint64_t y,
+                                           std::uint64_t z,
+                                           unsigned span,
+                                           tile_callback const& callback,
+                                           std::uint32_t tile_size = 4096,
+                                           boost::optional<std::int32_t> buffer_size = boost::none,
+                                           double scale_denom = 0.0,
+                                           int offset_x = 0,
+                                           int offset_y = 0,
+                                           bool style_level_filter = false);
+
     tile create_tile(mapnik::box2d<double> const & extent,
                      std::uint32_t tile_size = 4096,
                      boost::optional<std::int32_t> buffer_size = boost::none,
@@ -135,6 +217,23 @@ public:
         return t;
     }
 
+    // Creates the tile (x, y, z) and all the tiles below it down to zoom
+    // z + levels, parents before their children. Every vector layer is
+    // queried once for the root tile, the tiles below encode the features
+    // of their parent that reach them. Datasources returning different
+    // features by resolution give all the tiles those of the root tile.
+    // Returns false when the pyramid is incomplete because the processing
+    // was cancelled: tiles not handed to the callback yet are not created
+    // and the tiles handed over last may be partial.
+    MAPNIK_VECTOR_INLINE bool create_pyramid(std::uint64_t x,
+                                             std::uint64_t y,
+                                             std::uint64_t z,
+                                             unsigned levels,
+                                             tile_callback const& callback,
+                                             std::uint32_t tile_size = 4096,
+                                             boost::optional<std::int32_t> buffer_size = boost::none,
+                                             bool style_level_filter = false);
+
     void set_simplify_distance(double dist)
     {
         simplify_distance_ = dist;
@@ -175,6 +274,45 @@ public:
         return process_all_rings_;
     }
 
+    // Encodes every layer in two passes, the keys and values of a layer
+    // are ordered by the number of features referencing them once all its
+    // features are encoded and integers take their smallest encoding.
+    // Shrinks layers with many attributes at some encoding cost.
+    void set_compact_layers(bool value)
+    {
+        compact_layers_ = value;
+    }
+
+    bool get_compact_layers() const
+    {
+        return compact_layers_;
+    }
+
+    // Orders the features of every layer along a Hilbert curve over the
+    // tile instead of the order of the datasource, features close to each
+    // other are then encoded next to each other which compresses better.
+    void set_hilbert_order(bool value)
+    {
+        hilbert_order_ = value;
+    }
+
+    bool get_hilbert_order() const
+    {
+        return hilbert_order_;
+    }
+
+    // Wafers created by the processor clip large geometries quadrant by
+    // quadrant, see merc_wafer::set_quadtree_clipping
+    void set_wafer_quadtree_clipping(bool value)
+    {
+        wafer_quadtree_clipping_ = value;
+    }
+
+    bool get_wafer_quadtree_clipping() const
+    {
+        return wafer_quadtree_clipping_;
+    }
+
     void set_multi_polygon_union(bool value)
     {
         multi_polygon_union_ = value;
@@ -240,6 +378,165 @@ public:
         return threading_mode_;
     }
 
+    // When a thread pool is set, layers are processed as tasks of the pool
+    // and the threading mode is ignored. The sub-tiles of the vector layers
+    // of a wafer are also encoded as tasks of the pool. The pool can be
+    // shared by many processors.
+    void set_thread_pool(std::shared_ptr<thread_pool> const& pool)
+    {
+        thread_pool_ = pool;
+    }
+
+    std::shared_ptr<thread_pool> const& get_thread_pool() const
+    {
+        return thread_pool_;
+    }
+
+    // Number of features of a layer encoded by a single task of the
+    // thread pool, zero disables splitting of layers. Only used for
+    // single tiles when a thread pool is set. Layers reprojected through
+    // proj4 are never split.
+    void set_layer_chunk_size(std::size_t value)
+    {
+        layer_chunk_size_ = value;
+    }
+
+    std::size_t get_layer_chunk_size() const
+    {
+        return layer_chunk_size_;
+    }
+
+    // When set, every call to update_tile replaces the content of stats
+    // with the time spent in each stage of the pipeline and the number of
+    // features and vertices seen by them. The stats are not owned by the
+    // processor and must outlive it or be reset with nullptr.
+    void set_stats(tile_stats * stats)
+    {
+        stats_ = stats;
+    }
+
+    tile_stats * get_stats() const
+    {
+        return stats_;
+    }
+
+    // Reports every feature whose way through the pipeline, from the
+    // transformation to the encoding, takes at least threshold. An empty
+    // callback disables the detection. With a thread pool or an async
+    // threading mode the callback is invoked from several threads at once.
+    void set_slow_feature_callback(slow_feature_callback const& callback,
+                                   std::chrono::nanoseconds threshold)
+    {
+        slow_features_.callback = callback;
+        slow_features_.threshold = threshold;
+    }
+
+    slow_feature_detector const& get_slow_feature_detector() const
+    {
+        return slow_features_;
+    }
+
+    // Projections of the layers are looked up in this cache when set.
+    // Sharing one cache among processors avoids parsing the same
+    // projections again for every processor. Only projections that do not
+    // rely on proj4 are cached, other layers always get their own. There
+    // is no cache by default, the projections are then parsed for every
+    // tile.
+    void set_projection_cache(std::shared_ptr<projection_cache> const& cache)
+    {
+        projection_cache_ = cache;
+    }
+
+    std::shared_ptr<projection_cache> const& get_projection_cache() const
+    {
+        return projection_cache_;
+    }
+
+    // Bounds the size of the tiles and of their layers. With a feature
+    // order priority the encoding of a layer stops as soon as its budget
+    // is used up. Both budgets are applied before the layers are ordered
+    // along the Hilbert curve and compacted.
+    void set_byte_budget(byte_budget const& budget)
+    {
+        byte_budget_ = budget;
+    }
+
+    byte_budget const& get_byte_budget() const
+    {
+        return byte_budget_;
+    }
+
+    // Checked between features while tiles are generated. Once the token
+    // is cancelled or its deadline passed, update_tile returns promptly with
+    // the features encoded so far and marks the tile as partial.
+    void set_cancellation_token(std::shared_ptr<cancellation_token> const& token)
+    {
+        cancellation_ = token;
+    }
+
+    std::shared_ptr<cancellation_token> const& get_cancellation_token() const
+    {
+        return cancellation_;
+    }
+
+    // Attribute values are encoded through this cache when set, so that
+    // values recurring across tiles are converted and encoded once. The
+    // output is the same with or without a cache.
+    void set_value_cache(std::shared_ptr<value_cache> const& cache)
+    {
+        value_cache_ = cache;
+    }
+
+    std::shared_ptr<value_cache> const& get_value_cache() const
+    {
+        return value_cache_;
+    }
+
+    // The style filters of the layers are compiled once per scale
+    // denominator and kept in this cache when set. Filters are found by
+    // the name and the styles of their layer, so the cache must be
+    // cleared when the styles of the map change and must not be shared
+    // with processors of other maps. There is no cache by default, the
+    // filters are then compiled for every tile.
+    void set_style_filter_cache(std::shared_ptr<style_filter_cache> const& cache)
+    {
+        style_filter_cache_ = cache;
+    }
+
+    std::shared_ptr<style_filter_cache> const& get_style_filter_cache() const
+    {
+        return style_filter_cache_;
+    }
+
+    // Layer buffers are taken from this pool and reserved for the size of
+    // the same layer in the previous tiles, the buffers of tiles go back
+    // to the pool through release_tile. There is no pool
+    // by default, new buffers are then allocated for every tile. The pool
+    // can be shared by many processors.
+    void set_buffer_pool(std::shared_ptr<buffer_pool> const& pool)
+    {
+        buffer_pool_ = pool;
+    }
+
+    std::shared_ptr<buffer_pool> const& get_buffer_pool() const
+    {
+        return buffer_pool_;
+    }
+
+    // Hands the buffer of a tile no longer needed back to the buffer pool,
+    // the tile is cleared
+    void release_tile(tile & t)
+    {
+        if (buffer_pool_)
+        {
+            t.release(*buffer_pool_);
+        }
+        else
+        {
+            t.clear();
+        }
+    }
+
 };
 
 } // end ns vector_tile_impl
@@ -1,13 +1,18 @@
 // mapnik-vector-tile
+#include "vector_tile_cancellation.hpp"
 #include "vector_tile_geometry_clipper.hpp"
 #include "vector_tile_geometry_feature.hpp"
 #include "vector_tile_geometry_simplifier.hpp"
 #include "vector_tile_geometry_translate.hpp"
+#include "vector_tile_point_thinner.hpp"
+#include "vector_tile_pyramid.hpp"
 #include "vector_tile_raster_clipper.hpp"
+#include "vector_tile_stats.hpp"
 #include "vector_tile_strategy.hpp"
 #include "vector_tile_tile.hpp"
 #include "vector_tile_wafer.hpp"
 #include "vector_tile_layer.hpp"
+#include "vector_tile_thread_pool.hpp"
 #include "tiler.hpp"
 #include "unique_points.hpp"
 
@@ -26,7 +31,13 @@
 #include <boost/optional.hpp>
 
 // std
+#include <deque>
+#include <atomic>
+#include <exception>
 #include <future>
+#include <memory>
+#include <type_traits>
+#include <vector>
 
 namespace mapnik
 {
@@ -37,19 +48,550 @@ namespace vector_tile_impl
 namespace detail
 {
 
-template <typename Tile>
-inline void create_geom_layer(Tile & tile,
+template <typename Tiler, typename Layer, typename Recorder>
+class geom_layer_encoder
+{
+    using tiler_proc = typename Tiler::visitor;
+    using clip_probe = stage_probe<Recorder, tiler_proc>;
+    using thinner_proc = point_thinner<clip_probe>;
+    using indexer_proc = geometry_indexer<thinner_proc>;
+    using index_probe = stage_probe<Recorder, indexer_proc>;
+    using uniquer_proc = unique_points<index_probe>;
+    using unique_probe = stage_probe<Recorder, uniquer_proc>;
+    using simplifier_proc = geometry_simplifier<unique_probe>;
+    using simplify_probe = stage_probe<Recorder, simplifier_proc>;
+
+    Tiler & tiler_;
+    Layer const& layer_;
+    clipper_params const& clip_params_;
+    style_filter const& filter_;
+    style_filter_evaluator evaluator_;
+    Recorder & recorder_;
+    const bool style_level_filter_;
+    const double simplify_distance_;
+    const bool proj_equal_;
+    vector_tile_strategy vs_;
+    vector_tile_strategy_proj vs_proj_;
+    // Set when the points of the layer are thinned
+    std::unique_ptr<point_grid> grid_;
+
+    template <typename Transformer>
+    void transform(Transformer & transformer,
+                   mapnik::feature_impl const& feature,
+                   mapnik::geometry::geometry<double> const& geom)
+    {
+        recorder_.begin_feature(feature.id());
+        std::size_t thinned_points = grid_ ? grid_->points() : 0;
+        auto start = recorder_.now();
+        recorder_.enter(STAGE_TRANSFORM, geom);
+        mapnik::util::apply_visitor(transformer, geom);
+        recorder_.record(STAGE_TRANSFORM, start);
+        if (grid_ && grid_->points() != thinned_points)
+        {
+            recorder_.feature_deferred();
+        }
+        recorder_.end_feature();
+    }
+
+    template <typename Strategy>
+    void encode(mapnik::feature_ptr const& feature,
+                mapnik::geometry::geometry<double> const& geom,
+                Strategy const& strategy,
+                mapnik::box2d<double> const& buffered_extent)
+    {
+        tiler_proc tiler_visitor(tiler_.get_visitor(*feature, clip_params_));
+        clip_probe clip(recorder_, STAGE_CLIP, tiler_visitor);
+        thinner_proc thinner(grid_.get(), feature, clip);
+        indexer_proc indexer(thinner);
+        index_probe index(recorder_, STAGE_INDEX, indexer);
+        uniquer_proc uniquer(index);
+        unique_probe unique(recorder_, STAGE_UNIQUE, uniquer);
+        if (simplify_distance_ > 0)
+        {
+            simplifier_proc simplifier(simplify_distance_, unique);
+            simplify_probe simplify(recorder_, STAGE_SIMPLIFY, simplifier);
+            transform_visitor<Strategy, simplify_probe> transformer(strategy, buffered_extent, simplify);
+            transform(transformer, *feature, geom);
+        }
+        else
+        {
+            transform_visitor<Strategy, unique_probe> transformer(strategy, buffered_extent, unique);
+            transform(transformer, *feature, geom);
+        }
+    }
+
+public:
+    geom_layer_encoder(Tiler & tiler,
+                       Layer const& layer,
+                       clipper_params const& clip_params,
+                       style_filter const& filter,
+                       Recorder & recorder,
+                       bool style_level_filter)
+        : tiler_(tiler),
+          layer_(layer),
+          clip_params_(clip_params),
+          filter_(filter),
+          evaluator_(filter),
+          recorder_(recorder),
+          style_level_filter_(style_level_filter),
+          simplify_distance_(layer.simplify_distance()),
+          proj_equal_(layer.get_proj_transform().equal()),
+          vs_(layer.get_view_transform()),
+          vs_proj_(layer.get_proj_transform(), layer.get_view_transform()),
+          grid_()
+    {
+        tiler_.set_recorder(recorder_.encode_recorder());
+        if (layer.get_point_thinning().enabled())
+        {
+            grid_.reset(new point_grid(layer.get_point_thinning()));
+        }
+    }
+
+    // The byte budget of the layer is used up
+    bool exhausted() const
+    {
+        return tiler_.exhausted();
+    }
+
+    bool accepts(mapnik::feature_impl const& feature)
+    {
+        if (!style_level_filter_ || filter_.accepts_all())
+        {
+            return true;
+        }
+        auto start = recorder_.now();
+        bool result = evaluator_(feature);
+        recorder_.record(STAGE_FILTER, start);
+        if (!result)
+        {
+            recorder_.feature_filtered();
+        }
+        return result;
+    }
+
+    void operator() (mapnik::feature_ptr const& feature)
+    {
+        if (proj_equal_)
+        {
+            encode(feature, feature->get_geometry(), vs_, layer_.get_target_buffered_extent());
+        }
+        else
+        {
+            encode(feature, feature->get_geometry(), vs_proj_, layer_.get_source_buffered_extent());
+        }
+    }
+
+    // Encodes the points kept by the thinning, must be called once all
+    // the features of the layer were encoded
+    void finish()
+    {
+        if (!grid_)
+        {
+            return;
+        }
+        grid_->for_each([this](mapnik::feature_ptr const& feature, point_grid::point_type const& pt)
+        {
+            recorder_.begin_feature(feature->id());
+            tiler_proc tiler_visitor(tiler_.get_visitor(*feature, clip_params_));
+            clip_probe clip(recorder_, STAGE_CLIP, tiler_visitor);
+            point_grid::point_type point(pt);
+            indexed_point indexed(point);
+            clip(indexed);
+            recorder_.end_feature();
+        });
+        recorder_.features_thinned(grid_->points() - grid_->size());
+        grid_->clear();
+    }
+};
+
+template <typename Recorder>
+inline mapnik::feature_ptr next_feature(mapnik::featureset_ptr const& features, Recorder & recorder)
+{
+    auto start = recorder.now();
+    mapnik::feature_ptr feature = features->next();
+    recorder.record(STAGE_READ, start);
+    if (feature)
+    {
+        recorder.feature_read();
+    }
+    return feature;
+}
+
+inline double recorder_area_threshold(clipper_params const& clip_params)
+{
+    return clip_params.process_all_rings ? 0.0 : clip_params.area_threshold;
+}
+
+// Splits the features of a layer into chunks of chunk_size features, every
+// chunk is encoded by a pool task into its own buffer and the chunks are
+// then merged in order into the layer buffer. Layers whose points are
+// thinned or whose features are merged need all their features in one
+// builder and are not split. Neither are layers reprojected through proj4,
+// its projections must not be used by several threads at once.
+template <typename Recorder, typename Tile>
+inline bool create_geom_layer_chunked(Tile & tile,
+                                      tile_layer & layer,
+                                      clipper_params const& clip_params,
+                                      style_filter const& filter,
+                                      bool style_level_filter,
+                                      thread_pool & pool,
+                                      std::size_t chunk_size,
+                                      layer_stats * stats,
+                                      slow_feature_detector const& slow_features,
+                                      cancellation_token const* cancel)
+{
+    using Tiler = simple_tiler<Tile>;
+    using chunk_type = std::vector<mapnik::feature_ptr>;
+
+    if (chunk_size == 0 ||
+        layer.get_point_thinning().enabled() ||
+        layer.get_feature_merging().enabled ||
+        !layer.thread_safe_projections())
+    {
+        return false;
+    }
+
+    layer_builder_pbf builder(layer.name(), layer.layer_extent(), layer.get_data());
+    builder.budget = layer.get_byte_budget();
+    builder.compact = layer.get_compact();
+    builder.hilbert_order = layer.get_hilbert_order();
+    std::deque<std::string> buffers;
+    std::deque<Recorder> recorders;
+    std::vector<std::future<void> > futures;
+    std::exception_ptr error;
+    std::atomic<bool> interrupted(false);
+    const double area_threshold = recorder_area_threshold(clip_params);
+    Recorder read_recorder(area_threshold);
+
+    try
+    {
+        mapnik::featureset_ptr features = layer.get_features();
+        mapnik::feature_ptr feature = features ? next_feature(features, read_recorder) : mapnik::feature_ptr();
+        chunk_type chunk;
+        while (feature)
+        {
+            if (is_cancelled(cancel))
+            {
+                interrupted = true;
+                break;
+            }
+            chunk.push_back(feature);
+            feature = next_feature(features, read_recorder);
+            if (chunk.size() < chunk_size && feature)
+            {
+                continue;
+            }
+            buffers.emplace_back();
+            std::string & buffer = buffers.back();
+            recorders.emplace_back(area_threshold);
+            Recorder & recorder = recorders.back();
+            recorder.detect_slow_features(layer.name(), slow_features);
+            auto chunk_features = std::make_shared<chunk_type>(std::move(chunk));
+            chunk.clear();
+            futures.push_back(pool.submit([&tile, &layer, &clip_params, &filter, &buffer,
+                                           &recorder, &interrupted, chunk_features,
+                                           style_level_filter, cancel]()
+            {
+                Tiler tiler(tile, layer, buffer);
+                geom_layer_encoder<Tiler, tile_layer, Recorder> encoder(tiler, layer, clip_params,
+                                                                        filter, recorder,
+                                                                        style_level_filter);
+                for (auto const& f : *chunk_features)
+                {
+                    if (is_cancelled(cancel))
+                    {
+                        interrupted = true;
+                        break;
+                    }
+                    if (encoder.accepts(*f))
+                    {
+                        encoder(f);
+                    }
+                }
+            }));
+        }
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    // All tasks have to finish before returning, they reference the buffers
+    for (std::size_t i = 0; i < futures.size(); ++i)
+    {
+        try
+        {
+            pool.wait(futures[i]);
+            if (!error)
+            {
+                builder.merge(buffers[i]);
+            }
+        }
+        catch (...)
+        {
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+        std::string().swap(buffers[i]);
+        recorders[i].finish(stats);
+    }
+    read_recorder.finish(stats);
+    if (interrupted)
+    {
+        layer.set_partial();
+    }
+
+    builder.finalize();
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    return true;
+}
+
+// A geometry of a feature transformed into the coordinates of a wafer
+struct wafer_geometry
+{
+    mapnik::feature_ptr feature;
+    mapbox::geometry::geometry<std::int64_t> geom;
+};
+
+// Last stage of the transformation of the features of a wafer, keeps the
+// geometries so that they can be clipped to the sub-tiles later on
+struct wafer_geometry_collector
+{
+    std::deque<wafer_geometry> & geometries_;
+    mapnik::feature_ptr const& feature_;
+
+    wafer_geometry_collector(std::deque<wafer_geometry> & geometries,
+                             mapnik::feature_ptr const& feature)
+        : geometries_(geometries),
+          feature_(feature) {}
+
+    template <typename T>
+    void operator() (T & geom)
+    {
+        geometries_.push_back(wafer_geometry { feature_, std::move(geom) });
+    }
+};
+
+template <typename Strategy>
+inline void collect_wafer_geometries(std::deque<wafer_geometry> & geometries,
+                                     mapnik::feature_ptr const& feature,
+                                     Strategy const& strategy,
+                                     mapnik::box2d<double> const& buffered_extent,
+                                     double simplify_distance)
+{
+    using uniquer_proc = unique_points<wafer_geometry_collector>;
+    wafer_geometry_collector collector(geometries, feature);
+    uniquer_proc uniquer(collector);
+    if (simplify_distance > 0)
+    {
+        geometry_simplifier<uniquer_proc> simplifier(simplify_distance, uniquer);
+        transform_visitor<Strategy, geometry_simplifier<uniquer_proc>> transformer(strategy, buffered_extent,
+                                                                                    simplifier);
+        mapnik::util::apply_visitor(transformer, feature->get_geometry());
+    }
+    else
+    {
+        transform_visitor<Strategy, uniquer_proc> transformer(strategy, buffered_extent, uniquer);
+        mapnik::util::apply_visitor(transformer, feature->get_geometry());
+    }
+}
+
+// Encodes the sub-tiles of a wafer in parallel. The features are read,
+// filtered and transformed once on the calling thread and their geometries
+// are bucketed by the sub-tiles they cover, then every bucket is clipped and
+// encoded by a pool task into the builder of its sub-tile. Statistics need
+// the whole pipeline of a feature on one thread and thinned points need all
+// the features of the layer, such layers are encoded sequentially.
+template <typename Recorder>
+inline bool create_geom_layer_chunked(merc_wafer & wafer,
+                                      wafer_layer & layer,
+                                      clipper_params const& clip_params,
+                                      style_filter const& filter,
+                                      bool style_level_filter,
+                                      thread_pool & pool,
+                                      std::size_t,
+                                      layer_stats *,
+                                      slow_feature_detector const&,
+                                      cancellation_token const* cancel)
+{
+    using Encoder = geometry_to_feature_pbf_visitor;
+    using Translator = geometry_translate<Encoder>;
+    using Clipper = geometry_clipper<Translator>;
+    using Indexer = geometry_indexer<Clipper>;
+
+    if (!std::is_same<Recorder, null_stats_recorder>::value ||
+        layer.get_point_thinning().enabled())
+    {
+        return false;
+    }
+
+    std::deque<wafer_geometry> geometries;
+    std::exception_ptr error;
+    std::atomic<bool> interrupted(false);
+    std::vector<std::future<void> > futures;
+    // The builders are finalized when the tiler goes out of scope, after
+    // all the tasks are done
+    wafer_tiler tiler(wafer, layer);
+    const std::int64_t cells = tiler.cells();
+    std::vector<std::vector<std::size_t> > buckets(static_cast<std::size_t>(cells * cells));
+
+    try
+    {
+        mapnik::featureset_ptr features = layer.get_features();
+        if (!features)
+        {
+            return true;
+        }
+        const bool proj_equal = layer.get_proj_transform().equal();
+        const double simplify_distance = layer.simplify_distance();
+        vector_tile_strategy vs(layer.get_view_transform());
+        vector_tile_strategy_proj vs_proj(layer.get_proj_transform(), layer.get_view_transform());
+        style_filter_evaluator evaluator(filter);
+        const bool evaluate = style_level_filter && !filter.accepts_all();
+
+        for (mapnik::feature_ptr feature = features->next(); feature; feature = features->next())
+        {
+            if (is_cancelled(cancel))
+            {
+                interrupted = true;
+                break;
+            }
+            if (evaluate && !evaluator(*feature))
+            {
+                continue;
+            }
+            std::size_t first = geometries.size();
+            if (proj_equal)
+            {
+                collect_wafer_geometries(geometries, feature, vs, layer.get_target_buffered_extent(),
+                                         simplify_distance);
+            }
+            else
+            {
+                collect_wafer_geometries(geometries, feature, vs_proj, layer.get_source_buffered_extent(),
+                                         simplify_distance);
+            }
+            for (std::size_t index = first; index < geometries.size(); ++index)
+            {
+                const mapbox::geometry::box<std::int64_t> envelope(
+                    mapbox::geometry::envelope(geometries[index].geom));
+                if (envelope.min.x > envelope.max.x)
+                {
+                    continue;
+                }
+                std::int64_t first_x, last_x, first_y, last_y;
+                tiler.cell_range(envelope.min.x, envelope.max.x, first_x, last_x);
+                tiler.cell_range(envelope.min.y, envelope.max.y, first_y, last_y);
+                for (std::int64_t j = first_y; j <= last_y; ++j)
+                {
+                    for (std::int64_t i = first_x; i <= last_x; ++i)
+                    {
+                        buckets[static_cast<std::size_t>(j * cells + i)].push_back(index);
+                    }
+                }
+            }
+        }
+
+        const std::int64_t tile_size = tiler.tile_size_;
+        for (std::int64_t j = 0; j < cells; ++j)
+        {
+            for (std::int64_t i = 0; i < cells; ++i)
+            {
+                std::vector<std::size_t> const& bucket = buckets[static_cast<std::size_t>(j * cells + i)];
+                if (bucket.empty())
+                {
+                    continue;
+                }
+                layer_builder_pbf & builder = tiler.builders_[static_cast<std::size_t>(j * cells + i)];
+                futures.push_back(pool.submit([&geometries, &bucket, &builder, &clip_params, &interrupted,
+                                               &tiler, i, j, tile_size, cancel]()
+                {
+                    mapnik::box2d<std::int64_t> tile_box(tiler.cells_box(i, i, j, j));
+                    for (std::size_t index : bucket)
+                    {
+                        if (is_cancelled(cancel))
+                        {
+                            interrupted = true;
+                            break;
+                        }
+                        if (builder.exhausted())
+                        {
+                            break;
+                        }
+                        wafer_geometry const& geometry = geometries[index];
+                        Encoder encoder(*geometry.feature, builder);
+                        Translator translate(-i * tile_size, -j * tile_size, encoder);
+                        Clipper clipper(tile_box, clip_params, translate);
+                        Indexer indexer(clipper);
+                        mapbox::util::apply_visitor(indexer, geometry.geom);
+                    }
+                }));
+            }
+        }
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    // All tasks have to finish before returning, they reference the
+    // geometries and the builders
+    for (auto & future : futures)
+    {
+        try
+        {
+            pool.wait(future);
+        }
+        catch (...)
+        {
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (interrupted)
+    {
+        layer.set_partial();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    return true;
+}
+
+template <typename Recorder, typename Tile>
+inline void encode_geom_layer(Tile & tile,
                               typename tile_traits<Tile>::Layer & layer,
-                              double area_threshold,
-                              polygon_fill_type fill_type,
-                              bool strictly_simple,
-                              bool multi_polygon_union,
-                              bool process_all_rings,
-                              bool style_level_filter)
+                              clipper_params const& clip_params,
+                              style_filter const& filter,
+                              bool style_level_filter,
+                              thread_pool * pool,
+                              std::size_t chunk_size,
+                              layer_stats * stats,
+                              slow_feature_detector const& slow_features,
+                              cancellation_token const* cancel)
 {
+    using Layer = typename tile_traits<Tile>::Layer;
     using Tiler = typename tile_traits<Tile>::Tiler;
+
+    if (pool &&
+        create_geom_layer_chunked<Recorder>(tile, layer, clip_params, filter,
+                                            style_level_filter, *pool, chunk_size, stats,
+                                            slow_features, cancel))
+    {
+        return;
+    }
+
+    Recorder recorder(recorder_area_threshold(clip_params));
+    recorder.detect_slow_features(layer.name(), slow_features);
     Tiler tiler(tile, layer);
-    std::vector<mapnik::rule_cache> active_rules(layer.get_active_rules());
 
     // query for the features
     mapnik::featureset_ptr features = layer.get_features();
@@ -59,118 +601,386 @@ inline void create_geom_layer(Tile & tile,
         return;
     }
 
-    mapnik::feature_ptr feature = features->next();
+    mapnik::feature_ptr feature = next_feature(features, recorder);
 
     if (!feature)
     {
+        recorder.finish(stats);
         return;
     }
 
-    using tiler_proc = typename Tiler::visitor;
-    using indexer_proc = geometry_indexer<tiler_proc>;
-    using uniquer_proc = unique_points<indexer_proc>;
+    geom_layer_encoder<Tiler, Layer, Recorder> encoder(tiler, layer, clip_params, filter,
+                                                       recorder, style_level_filter);
+
+    while (feature && !encoder.exhausted())
+    {
+        if (is_cancelled(cancel))
+        {
+            layer.set_partial();
+            break;
+        }
+        if (encoder.accepts(*feature))
+        {
+            encoder(feature);
+        }
+        feature = next_feature(features, recorder);
+    }
+    encoder.finish();
+    recorder.finish(stats);
+}
 
-    mapnik::vector_tile_impl::vector_tile_strategy vs(layer.get_view_transform());
-    mapnik::box2d<double> const& buffered_extent = layer.get_target_buffered_extent();
+template <typename Tile>
+inline void create_geom_layer(Tile & tile,
+                              typename tile_traits<Tile>::Layer & layer,
+                              double area_threshold,
+                              polygon_fill_type fill_type,
+                              bool strictly_simple,
+                              bool multi_polygon_union,
+                              bool process_all_rings,
+                              bool style_level_filter,
+                              thread_pool * pool,
+                              std::size_t chunk_size,
+                              layer_stats * stats,
+                              slow_feature_detector const& slow_features,
+                              cancellation_token const* cancel)
+{
     const clipper_params clip_params {
         area_threshold, strictly_simple, multi_polygon_union,
         fill_type, process_all_rings };
-    const double simplify_distance = layer.simplify_distance();
+    const style_filter_ptr filter(layer.get_style_filter());
 
-    if (simplify_distance > 0)
+    // Statistics are only collected when requested, otherwise the
+    // pipeline is instantiated without any probes.
+    if (stats || slow_features)
+    {
+        encode_geom_layer<stats_recorder>(tile, layer, clip_params, *filter,
+                                          style_level_filter, pool, chunk_size, stats,
+                                          slow_features, cancel);
+    }
+    else
     {
-        using simplifier_process = mapnik::vector_tile_impl::geometry_simplifier<uniquer_proc>;
-        if (layer.get_proj_transform().equal())
+        encode_geom_layer<null_stats_recorder>(tile, layer, clip_params, *filter,
+                                               style_level_filter, pool, chunk_size, stats,
+                                               slow_features, cancel);
+    }
+}
+
+// Encodes layers that read the same datasource with an equivalent query
+// from a single featureset, every feature is handed to the pipeline of
+// each layer which applies its own filter.
+template <typename Recorder, typename Tile>
+inline void encode_geom_layers(Tile & tile,
+                               std::vector<typename tile_traits<Tile>::Layer *> const& layers,
+                               clipper_params const& clip_params,
+                               bool style_level_filter,
+                               std::vector<layer_stats *> const& stats,
+                               slow_feature_detector const& slow_features,
+                               cancellation_token const* cancel)
+{
+    using Layer = typename tile_traits<Tile>::Layer;
+    using Tiler = typename tile_traits<Tile>::Tiler;
+    using Encoder = geom_layer_encoder<Tiler, Layer, Recorder>;
+
+    const double area_threshold = recorder_area_threshold(clip_params);
+    std::deque<style_filter_ptr> filters;
+    std::deque<Recorder> recorders;
+    std::deque<Tiler> tilers;
+    std::deque<Encoder> encoders;
+    for (Layer * layer : layers)
+    {
+        filters.push_back(layer->get_style_filter());
+        recorders.emplace_back(area_threshold);
+        recorders.back().detect_slow_features(layer->name(), slow_features);
+        tilers.emplace_back(tile, *layer);
+        encoders.emplace_back(tilers.back(), *layer, clip_params, *filters.back(),
+                              recorders.back(), style_level_filter);
+    }
+
+    // query for the features once, the time spent reading them is
+    // accounted to the first layer
+    mapnik::featureset_ptr features = layers.front()->get_features();
+    mapnik::feature_ptr feature = features ? next_feature(features, recorders.front()) : mapnik::feature_ptr();
+    while (feature)
+    {
+        if (is_cancelled(cancel))
         {
-            using strategy_type = mapnik::vector_tile_impl::vector_tile_strategy;
-            using transform_type = mapnik::vector_tile_impl::transform_visitor<strategy_type, simplifier_process>;
-            while (feature)
+            for (Layer * layer : layers)
             {
-                if (!style_level_filter || layer.evaluate_feature(*feature, active_rules))
-                {
-                    mapnik::geometry::geometry<double> const& geom = feature->get_geometry();
-                    tiler_proc tiler_visitor(tiler.get_visitor(*feature, clip_params));
-                    indexer_proc indexer(tiler_visitor);
-                    uniquer_proc uniquer(indexer);
-                    simplifier_process simplifier(simplify_distance, uniquer);
-                    transform_type transformer(vs, buffered_extent, simplifier);
-                    mapnik::util::apply_visitor(transformer, geom);
-                }
-                feature = features->next();
+                layer->set_partial();
             }
+            break;
         }
-        else
+        for (std::size_t i = 0; i < encoders.size(); ++i)
         {
-            using strategy_type = mapnik::vector_tile_impl::vector_tile_strategy_proj;
-            using transform_type = mapnik::vector_tile_impl::transform_visitor<strategy_type, simplifier_process>;
-            strategy_type vs2(layer.get_proj_transform(), layer.get_view_transform());
-            mapnik::box2d<double> const& trans_buffered_extent = layer.get_source_buffered_extent();
-            while (feature)
+            if (i > 0)
             {
-                if (!style_level_filter || layer.evaluate_feature(*feature, active_rules))
-                {
-                    mapnik::geometry::geometry<double> const& geom = feature->get_geometry();
-                    tiler_proc tiler_visitor(tiler.get_visitor(*feature, clip_params));
-                    indexer_proc indexer(tiler_visitor);
-                    uniquer_proc uniquer(indexer);
-                    simplifier_process simplifier(simplify_distance, uniquer);
-                    transform_type transformer(vs2, trans_buffered_extent, simplifier);
-                    mapnik::util::apply_visitor(transformer, geom);
-                }
-                feature = features->next();
+                recorders[i].feature_read();
             }
+            if (!encoders[i].exhausted() && encoders[i].accepts(*feature))
+            {
+                encoders[i](feature);
+            }
+        }
+        feature = next_feature(features, recorders.front());
+    }
+
+    for (std::size_t i = 0; i < recorders.size(); ++i)
+    {
+        encoders[i].finish();
+        recorders[i].finish(stats[i]);
+    }
+}
+
+template <typename Tile>
+inline void create_geom_layers(Tile & tile,
+                               std::vector<typename tile_traits<Tile>::Layer *> const& layers,
+                               double area_threshold,
+                               polygon_fill_type fill_type,
+                               bool strictly_simple,
+                               bool multi_polygon_union,
+                               bool process_all_rings,
+                               bool style_level_filter,
+                               std::vector<layer_stats *> const& stats,
+                               slow_feature_detector const& slow_features,
+                               cancellation_token const* cancel)
+{
+    const clipper_params clip_params {
+        area_threshold, strictly_simple, multi_polygon_union,
+        fill_type, process_all_rings };
+
+    bool has_stats = false;
+    for (layer_stats * s : stats)
+    {
+        has_stats = has_stats || s;
+    }
+
+    if (has_stats || slow_features)
+    {
+        encode_geom_layers<stats_recorder>(tile, layers, clip_params, style_level_filter,
+                                           stats, slow_features, cancel);
+    }
+    else
+    {
+        encode_geom_layers<null_stats_recorder>(tile, layers, clip_params, style_level_filter,
+                                                stats, slow_features, cancel);
+    }
+}
+
+// Encodes a layer of a tile of a pyramid from the features kept for the
+// root tile. The candidates reaching the tile are appended to matches,
+// they are the candidates of the tiles below.
+template <typename Recorder>
+inline void encode_pyramid_layer(merc_tile & tile,
+                                 tile_layer & layer,
+                                 clipper_params const& clip_params,
+                                 style_filter const& filter,
+                                 bool style_level_filter,
+                                 pyramid_features const& features,
+                                 std::vector<std::size_t> const& candidates,
+                                 std::vector<std::size_t> & matches,
+                                 slow_feature_detector const& slow_features,
+                                 cancellation_token const* cancel)
+{
+    using Tiler = simple_tiler<merc_tile>;
+
+    Recorder recorder(recorder_area_threshold(clip_params));
+    recorder.detect_slow_features(layer.name(), slow_features);
+    Tiler tiler(tile, layer);
+    geom_layer_encoder<Tiler, tile_layer, Recorder> encoder(tiler, layer, clip_params, filter,
+                                                            recorder, style_level_filter);
+    // Same extent as the one transform_visitor checks the features against
+    mapnik::box2d<double> const& extent = layer.get_proj_transform().equal() ?
+                                          layer.get_target_buffered_extent() :
+                                          layer.get_source_buffered_extent();
+    for (std::size_t index : candidates)
+    {
+        pyramid_feature const& feature = features[index];
+        if (!feature.envelope.intersects(extent))
+        {
+            continue;
         }
+        if (is_cancelled(cancel))
+        {
+            layer.set_partial();
+            break;
+        }
+        matches.push_back(index);
+        if (!encoder.exhausted() && encoder.accepts(*feature.feature))
+        {
+            encoder(feature.feature);
+        }
+    }
+    encoder.finish();
+    recorder.finish(nullptr);
+}
+
+inline void create_pyramid_layer(merc_tile & tile,
+                                 tile_layer & layer,
+                                 double area_threshold,
+                                 polygon_fill_type fill_type,
+                                 bool strictly_simple,
+                                 bool multi_polygon_union,
+                                 bool process_all_rings,
+                                 bool style_level_filter,
+                                 pyramid_features const& features,
+                                 std::vector<std::size_t> const& candidates,
+                                 std::vector<std::size_t> & matches,
+                                 slow_feature_detector const& slow_features,
+                                 cancellation_token const* cancel)
+{
+    const clipper_params clip_params {
+        area_threshold, strictly_simple, multi_polygon_union,
+        fill_type, process_all_rings };
+    const style_filter_ptr filter(layer.get_style_filter());
+
+    if (slow_features)
+    {
+        encode_pyramid_layer<stats_recorder>(tile, layer, clip_params, *filter,
+                                             style_level_filter, features, candidates,
+                                             matches, slow_features, cancel);
     }
     else
     {
-        if (layer.get_proj_transform().equal())
+        encode_pyramid_layer<null_stats_recorder>(tile, layer, clip_params, *filter,
+                                                  style_level_filter, features, candidates,
+                                                  matches, slow_features, cancel);
+    }
+}
+
+// Shrinks the layers of a tile, each in proportion to its size, until the
+// tile fits into its budget.
+inline void apply_tile_byte_budget(std::vector<std::string *> const& buffers,
+                                   byte_budget const& budget)
+{
+    std::size_t total = 0;
+    std::size_t framing = 0;
+    std::size_t payload = 0;
+    for (std::string const* buffer : buffers)
+    {
+        if (!buffer->empty())
         {
-            using strategy_type = mapnik::vector_tile_impl::vector_tile_strategy;
-            using transform_type = mapnik::vector_tile_impl::transform_visitor<strategy_type, uniquer_proc>;
-            while (feature)
+            std::size_t size = buffer->size();
+            total += detail::framed_size(size);
+            framing += detail::framed_size(size) - size;
+            payload += size;
+        }
+    }
+    if (total <= budget.tile_bytes)
+    {
+        return;
+    }
+    const std::size_t available = budget.tile_bytes > framing ? budget.tile_bytes - framing : 0;
+    for (std::string * buffer : buffers)
+    {
+        if (!buffer->empty())
+        {
+            std::size_t size = buffer->size();
+            std::size_t share = static_cast<std::size_t>(static_cast<double>(size) * available / payload);
+            if (size > share)
             {
-                if (!style_level_filter || layer.evaluate_feature(*feature, active_rules))
-                {
-                    mapnik::geometry::geometry<double> const& geom = feature->get_geometry();
-                    tiler_proc tiler_visitor(tiler.get_visitor(*feature, clip_params));
-                    indexer_proc indexer(tiler_visitor);
-                    uniquer_proc uniquer(indexer);
-                    transform_type transformer(vs, buffered_extent, uniquer);
-                    mapnik::util::apply_visitor(transformer, geom);
-                }
-                feature = features->next();
+                apply_byte_budget(*buffer, 0, share, budget);
             }
         }
-        else
+    }
+}
+
+// Orders and compacts vector layers whose builders left it to be done
+// once the tile budget was applied, so that the budget sees the features
+// in the order they were read
+inline void order_tile_layers(std::vector<std::string *> const& buffers,
+                              bool hilbert_order,
+                              bool compact)
+{
+    for (std::string * buffer : buffers)
+    {
+        if (buffer->empty())
+        {
+            continue;
+        }
+        if (hilbert_order)
+        {
+            hilbert_order_layer(*buffer, 0);
+        }
+        if (compact)
+        {
+            compact_layer(*buffer, 0);
+        }
+    }
+}
+
+inline void apply_tile_byte_budget(std::vector<tile_layer> & layers,
+                                   byte_budget const& budget,
+                                   bool hilbert_order,
+                                   bool compact)
+{
+    std::vector<std::string *> buffers;
+    std::vector<std::string *> vector_buffers;
+    for (auto & layer : layers)
+    {
+        buffers.push_back(&layer.get_data());
+        if (layer.get_ds()->type() == datasource::Vector)
         {
-            using strategy_type = mapnik::vector_tile_impl::vector_tile_strategy_proj;
-            using transform_type = mapnik::vector_tile_impl::transform_visitor<strategy_type, uniquer_proc>;
-            strategy_type vs2(layer.get_proj_transform(), layer.get_view_transform());
-            mapnik::box2d<double> const& trans_buffered_extent = layer.get_source_buffered_extent();
-            while (feature)
+            vector_buffers.push_back(&layer.get_data());
+        }
+    }
+    apply_tile_byte_budget(buffers, budget);
+    order_tile_layers(vector_buffers, hilbert_order, compact);
+}
+
+// Every tile of the wafer has its own budget
+inline void apply_tile_byte_budget(std::vector<wafer_layer> & layers,
+                                   byte_budget const& budget,
+                                   bool hilbert_order,
+                                   bool compact)
+{
+    if (layers.empty())
+    {
+        return;
+    }
+    for (std::size_t i = 0; i < layers.front().buffers().size(); ++i)
+    {
+        std::vector<std::string *> buffers;
+        std::vector<std::string *> vector_buffers;
+        for (auto & layer : layers)
+        {
+            buffers.push_back(&layer.buffers()[i]);
+            if (layer.get_ds()->type() == datasource::Vector)
             {
-                if (!style_level_filter || layer.evaluate_feature(*feature, active_rules))
-                {
-                    mapnik::geometry::geometry<double> const& geom = feature->get_geometry();
-                    tiler_proc tiler_visitor(tiler.get_visitor(*feature, clip_params));
-                    indexer_proc indexer(tiler_visitor);
-                    uniquer_proc uniquer(indexer);
-                    transform_type transformer(vs2, trans_buffered_extent, uniquer);
-                    mapnik::util::apply_visitor(transformer, geom);
-                }
-                feature = features->next();
+                vector_buffers.push_back(&layer.buffers()[i]);
             }
         }
+        apply_tile_byte_budget(buffers, budget);
+        order_tile_layers(vector_buffers, hilbert_order, compact);
     }
 }
 
+// Builder of the raster layer of a tile
+inline void add_raster_builders(tile_layer & layer, std::deque<layer_builder_pbf> & builders)
+{
+    builders.emplace_back(layer.name(), layer.layer_extent(), layer.get_data());
+}
+
+// Builders of the raster layer of every sub-tile of a wafer
+inline void add_raster_builders(wafer_layer & layer, std::deque<layer_builder_pbf> & builders)
+{
+    for (auto & buffer : layer.buffers())
+    {
+        builders.emplace_back(layer.name(), layer.layer_extent() / layer.span(), buffer);
+    }
+}
+
+// The raster is read and warped once for the extent of the layer. The
+// image of a wafer is then cut into the images of its sub-tiles, which
+// are encoded by the pool when there is one.
 template <typename Layer>
-inline void create_raster_layer(Layer & layer,
+inline void encode_raster_layer(Layer & layer,
+                                std::deque<layer_builder_pbf> & builders,
                                 std::string const& image_format,
-                                scaling_method_e scaling_method)
+                                scaling_method_e scaling_method,
+                                thread_pool * pool,
+                                stats_recorder & recorder,
+                                cancellation_token const* cancel)
 {
-    layer_builder_pbf builder(layer.name(), layer.layer_extent(), layer.get_data());
-
     // query for the features
     mapnik::featureset_ptr features = layer.get_features();
 
@@ -179,7 +989,7 @@ inline void create_raster_layer(Layer & layer,
         return;
     }
 
-    mapnik::feature_ptr feature = features->next();
+    mapnik::feature_ptr feature = next_feature(features, recorder);
 
     if (!feature)
     {
@@ -192,6 +1002,13 @@ inline void create_raster_layer(Layer & layer,
         return;
     }
 
+    // Clipping and encoding the image is the expensive part
+    if (is_cancelled(cancel))
+    {
+        layer.set_partial();
+        return;
+    }
+
     mapnik::box2d<double> target_ext = box2d<double>(source->ext_);
 
     layer.get_proj_transform().backward(target_ext, PROJ_ENVELOPE_POINTS);
@@ -203,8 +1020,10 @@ inline void create_raster_layer(Layer & layer,
     int end_y = static_cast<int>(std::floor(ext.maxy()+.5));
     int raster_width = end_x - start_x;
     int raster_height = end_y - start_y;
+    recorder.begin_feature(feature->id());
     if (raster_width > 0 && raster_height > 0)
     {
+        auto start = recorder.now();
         //builder.make_painted();
         raster_clipper visit(*source,
                              target_ext,
@@ -217,10 +1036,39 @@ inline void create_raster_layer(Layer & layer,
                              raster_width,
                              raster_height,
                              start_x,
-                             start_y);
-        std::string buffer = mapnik::util::apply_visitor(visit, source->data_);
-        raster_to_feature(buffer, *feature, builder);
+                             start_y,
+                             layer.span(),
+                             pool);
+        std::vector<std::string> images = mapnik::util::apply_visitor(visit, source->data_);
+        for (std::size_t i = 0; i < images.size() && i < builders.size(); ++i)
+        {
+            if (!images[i].empty())
+            {
+                raster_to_feature(images[i], *feature, builders[i]);
+            }
+        }
+        recorder.encoded(*source, start, true);
     }
+    recorder.end_feature();
+}
+
+// The statistics of the layer are reported whether it got encoded or not
+template <typename Layer>
+inline void create_raster_layer(Layer & layer,
+                                std::string const& image_format,
+                                scaling_method_e scaling_method,
+                                thread_pool * pool,
+                                layer_stats * stats,
+                                slow_feature_detector const& slow_features,
+                                cancellation_token const* cancel)
+{
+    std::deque<layer_builder_pbf> builders;
+    add_raster_builders(layer, builders);
+    // Raster layers hold a single feature, timing it costs nothing noticeable
+    stats_recorder recorder(0.0);
+    recorder.detect_slow_features(layer.name(), slow_features);
+    encode_raster_layer(layer, builders, image_format, scaling_method, pool, recorder, cancel);
+    recorder.finish(stats);
 }
 
 } // end ns detail
@@ -247,90 +1095,205 @@ void processor::append_sublayers(Parent const& parent,
                              offset_y,
                              style_level_filter,
                              simplify_distance_,
-                             vars_);
+                             vars_,
+                             projection_cache_.get(),
+                             style_filter_cache_.get());
         if (!tile_layers.back().is_valid())
         {
             t.add_empty_layer(lay.name());
             tile_layers.pop_back();
             continue;
         }
+        tile_layers.back().set_value_cache(value_cache_.get());
+        // With a tile budget layers are ordered and compacted once the
+        // budget was applied to all of them
+        const bool deferred = byte_budget_.tile_bytes > 0;
+        tile_layers.back().set_compact(compact_layers_ && !deferred);
+        tile_layers.back().set_hilbert_order(hilbert_order_ && !deferred);
+        if (buffer_pool_)
+        {
+            tile_layers.back().acquire_buffers(*buffer_pool_);
+        }
 
         append_sublayers(lay, tile_layers, t, scale_denom, offset_x, offset_y,
                          style_level_filter);
     }
 }
 
-template <typename Tile>
-MAPNIK_VECTOR_INLINE void processor::update_tile(Tile & t,
-                                                 double scale_denom,
-                                                 int offset_x,
-                                                 int offset_y,
-                                                 bool style_level_filter)
+template <typename Tile, typename Layer>
+void processor::process_layers(Tile & t,
+                               std::vector<Layer *> const& layers,
+                               std::vector<layer_stats *> const& stats,
+                               bool style_level_filter)
 {
-    // Futures
-    using Layer = typename tile_traits<Tile>::Layer;
-    std::vector<Layer> tile_layers;
+    // Layers not started yet are left empty once cancelled
+    if (detail::is_cancelled(cancellation_.get()))
+    {
+        for (Layer * layer : layers)
+        {
+            layer->set_partial();
+        }
+        return;
+    }
 
+    if (layers.size() > 1)
+    {
+        detail::create_geom_layers(t, layers,
+                                   area_threshold_,
+                                   fill_type_,
+                                   strictly_simple_,
+                                   multi_polygon_union_,
+                                   process_all_rings_,
+                                   style_level_filter,
+                                   stats,
+                                   slow_features_,
+                                   cancellation_.get());
+    }
+    else if (layers.front()->get_ds()->type() == datasource::Vector)
+    {
+        // Only split layers into chunks when layers are processed by the pool
+        detail::create_geom_layer(t, *layers.front(),
+                                  area_threshold_,
+                                  fill_type_,
+                                  strictly_simple_,
+                                  multi_polygon_union_,
+                                  process_all_rings_,
+                                  style_level_filter,
+                                  thread_pool_.get(),
+                                  thread_pool_ ? layer_chunk_size_ : 0,
+                                  stats.front(),
+                                  slow_features_,
+                                  cancellation_.get());
+    }
+    else // Raster
+    {
+        detail::create_raster_layer(*layers.front(),
+                                    image_format_,
+                                    scaling_method_,
+                                    thread_pool_.get(),
+                                    stats.front(),
+                                    slow_features_,
+                                    cancellation_.get());
+    }
+}
+
+template <typename Tile, typename Layer>
+void processor::encode_tile_layers(Tile & t,
+                                   std::vector<Layer> & tile_layers,
+                                   double scale_denom,
+                                   int offset_x,
+                                   int offset_y,
+                                   bool style_level_filter)
+{
     append_sublayers(m_, tile_layers, t, scale_denom, offset_x, offset_y,
                      style_level_filter);
 
-    if (threading_mode_ == std::launch::deferred)
+    if (byte_budget_.enabled())
     {
         for (auto & layer : tile_layers)
         {
-            if (layer.get_ds()->type() == datasource::Vector)
-            {
-                detail::create_geom_layer(t, layer,
-                                          area_threshold_,
-                                          fill_type_,
-                                          strictly_simple_,
-                                          multi_polygon_union_,
-                                          process_all_rings_,
-                                          style_level_filter
-                                         );
-            }
-            else // Raster
+            layer.set_byte_budget(&byte_budget_);
+        }
+    }
+
+    std::vector<layer_stats *> tile_layer_stats(tile_layers.size(), nullptr);
+    if (stats_)
+    {
+        stats_->clear();
+        for (std::size_t i = 0; i < tile_layers.size(); ++i)
+        {
+            tile_layer_stats[i] = &stats_->add_layer(tile_layers[i].name());
+        }
+    }
+
+    // Vector layers sharing a datasource and an equivalent query are
+    // grouped so that the datasource is queried only once for all of them
+    std::vector<std::vector<Layer *> > layer_groups;
+    std::vector<std::vector<layer_stats *> > stats_groups;
+    for (std::size_t i = 0; i < tile_layers.size(); ++i)
+    {
+        Layer & layer = tile_layers[i];
+        bool grouped = false;
+        if (layer.get_ds()->type() == datasource::Vector)
+        {
+            for (std::size_t j = 0; j < layer_groups.size(); ++j)
             {
-                detail::create_raster_layer(layer,
-                                            image_format_,
-                                            scaling_method_
-                                           );
+                if (layer_groups[j].front()->shares_query(layer))
+                {
+                    layer_groups[j].push_back(&layer);
+                    stats_groups[j].push_back(tile_layer_stats[i]);
+                    grouped = true;
+                    break;
+                }
             }
         }
+        if (!grouped)
+        {
+            layer_groups.emplace_back(1, &layer);
+            stats_groups.emplace_back(1, tile_layer_stats[i]);
+        }
     }
-    else
+
+    if (thread_pool_)
     {
         std::vector<std::future<void> > future_layers;
-        future_layers.reserve(tile_layers.size());
+        future_layers.reserve(layer_groups.size());
+
+        for (std::size_t i = 0; i < layer_groups.size(); ++i)
+        {
+            std::vector<Layer *> const& layers = layer_groups[i];
+            std::vector<layer_stats *> const& stats = stats_groups[i];
+            future_layers.push_back(thread_pool_->submit([this, &t, &layers, &stats, style_level_filter]()
+            {
+                process_layers(t, layers, stats, style_level_filter);
+            }));
+        }
 
-        for (auto & layer_ref : tile_layers)
+        // Unlike std::async futures these do not block on destruction,
+        // so every task has to finish before an error is propagated
+        std::exception_ptr error;
+        for (auto & lay_future : future_layers)
         {
-            if (layer_ref.get_ds()->type() == datasource::Vector)
+            try
             {
-                future_layers.push_back(std::async(
-                                        threading_mode_,
-                                        detail::create_geom_layer<Tile>,
-                                        std::ref(t),
-                                        std::ref(layer_ref),
-                                        area_threshold_,
-                                        fill_type_,
-                                        strictly_simple_,
-                                        multi_polygon_union_,
-                                        process_all_rings_,
-                                        style_level_filter
-                            ));
+                thread_pool_->wait(lay_future);
             }
-            else // Raster
+            catch (...)
             {
-                future_layers.push_back(std::async(
-                                        threading_mode_,
-                                        detail::create_raster_layer<Layer>,
-                                        std::ref(layer_ref),
-                                        image_format_,
-                                        scaling_method_
-                ));
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
             }
         }
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+    else if (threading_mode_ == std::launch::deferred)
+    {
+        for (std::size_t i = 0; i < layer_groups.size(); ++i)
+        {
+            process_layers(t, layer_groups[i], stats_groups[i], style_level_filter);
+        }
+    }
+    else
+    {
+        std::vector<std::future<void> > future_layers;
+        future_layers.reserve(layer_groups.size());
+
+        for (std::size_t i = 0; i < layer_groups.size(); ++i)
+        {
+            std::vector<Layer *> const& layers = layer_groups[i];
+            std::vector<layer_stats *> const& stats = stats_groups[i];
+            future_layers.push_back(std::async(
+                                    threading_mode_,
+                                    [this, &t, &layers, &stats, style_level_filter]()
+                                    {
+                                        process_layers(t, layers, stats, style_level_filter);
+                                    }));
+        }
 
         for (auto && lay_future : future_layers)
         {
@@ -342,10 +1305,249 @@ MAPNIK_VECTOR_INLINE void processor::update_tile(Tile & t,
         }
     }
 
+    if (byte_budget_.tile_bytes > 0)
+    {
+        detail::apply_tile_byte_budget(tile_layers, byte_budget_, hilbert_order_, compact_layers_);
+    }
+}
+
+template <typename Tile>
+MAPNIK_VECTOR_INLINE void processor::update_tile(Tile & t,
+                                                 double scale_denom,
+                                                 int offset_x,
+                                                 int offset_y,
+                                                 bool style_level_filter)
+{
+    using Layer = typename tile_traits<Tile>::Layer;
+    std::vector<Layer> tile_layers;
+
+    encode_tile_layers(t, tile_layers, scale_denom, offset_x, offset_y, style_level_filter);
+
+    for (auto & layer_ref : tile_layers)
+    {
+        if (layer_ref.is_partial())
+        {
+            t.set_partial();
+        }
+        if (buffer_pool_)
+        {
+            layer_ref.record_buffers(*buffer_pool_);
+        }
+        t.add_layer(std::move(layer_ref));
+    }
+}
+
+MAPNIK_VECTOR_INLINE void processor::stream_wafer(std::uint64_t x,
+                                                  std::uint64_t y,
+                                                  std::uint64_t z,
+                                                  unsigned span,
+                                                  tile_callback const& callback,
+                                                  std::uint32_t tile_size,
+                                                  boost::optional<std::int32_t> buffer_size,
+                                                  double scale_denom,
+                                                  int offset_x,
+                                                  int offset_y,
+                                                  bool style_level_filter)
+{
+    merc_wafer wafer(x, y, z, span, tile_size, get_buffer_size(tile_size, buffer_size));
+    wafer.set_quadtree_clipping(wafer_quadtree_clipping_);
+    std::vector<wafer_layer> wafer_layers;
+
+    encode_tile_layers(wafer, wafer_layers, scale_denom, offset_x, offset_y, style_level_filter);
+
+    bool partial = false;
+    for (auto const& layer : wafer_layers)
+    {
+        partial = partial || layer.is_partial();
+    }
+
+    // The sub-tiles of the wafer only hold their coordinates, every one is
+    // assembled from the buffers of the layers, handed to the callback and
+    // dropped before the next one so that the buffers of the wafer are
+    // never held twice
+    for (std::size_t i = 0; i < wafer.tiles().size(); ++i)
+    {
+        merc_tile t(wafer.tiles()[i]);
+        if (partial)
+        {
+            t.set_partial();
+        }
+        for (auto & layer : wafer_layers)
+        {
+            std::string & buffer = layer.buffers()[i];
+            if (buffer_pool_)
+            {
+                buffer_pool_->record(layer.name(), buffer.size());
+            }
+            t.splice_layer(layer.name(), std::move(buffer));
+            std::string().swap(buffer);
+        }
+        callback(t);
+        if (buffer_pool_)
+        {
+            t.release(*buffer_pool_);
+        }
+    }
+}
+
+MAPNIK_VECTOR_INLINE bool processor::update_pyramid_tile(merc_tile & t,
+                                                         std::uint64_t max_zoom,
+                                                         bool style_level_filter,
+                                                         pyramid_cache const& cache,
+                                                         pyramid_candidates const& candidates,
+                                                         tile_callback const& callback)
+{
+    if (detail::is_cancelled(cancellation_.get()))
+    {
+        return false;
+    }
+
+    std::vector<tile_layer> tile_layers;
+    append_sublayers(m_, tile_layers, t, 0.0, 0, 0, style_level_filter);
+
+    if (byte_budget_.enabled())
+    {
+        for (auto & layer : tile_layers)
+        {
+            layer.set_byte_budget(&byte_budget_);
+        }
+    }
+
+    // Layers missing from this tile hand the candidates of the tile above
+    // down to the tiles below
+    pyramid_candidates matches(candidates);
+    for (auto & layer : tile_layers)
+    {
+        auto cached = cache.find(layer.name());
+        if (cached == cache.end())
+        {
+            process_layers(t, std::vector<tile_layer *>(1, &layer),
+                           std::vector<layer_stats *>(1, nullptr), style_level_filter);
+            continue;
+        }
+        std::vector<std::size_t> layer_matches;
+        detail::create_pyramid_layer(t, layer,
+                                     area_threshold_,
+                                     fill_type_,
+                                     strictly_simple_,
+                                     multi_polygon_union_,
+                                     process_all_rings_,
+                                     style_level_filter,
+                                     *cached->second,
+                                     candidates.at(layer.name()),
+                                     layer_matches,
+                                     slow_features_,
+                                     cancellation_.get());
+        matches[layer.name()].swap(layer_matches);
+    }
+
+    if (byte_budget_.tile_bytes > 0)
+    {
+        detail::apply_tile_byte_budget(tile_layers, byte_budget_, hilbert_order_, compact_layers_);
+    }
+
     for (auto & layer_ref : tile_layers)
     {
-        t.add_layer(layer_ref);
+        if (layer_ref.is_partial())
+        {
+            t.set_partial();
+        }
+        if (buffer_pool_)
+        {
+            layer_ref.record_buffers(*buffer_pool_);
+        }
+        t.add_layer(std::move(layer_ref));
+    }
+
+    const std::uint64_t x = t.x();
+    const std::uint64_t y = t.y();
+    const std::uint64_t z = t.z();
+    const std::uint32_t tile_size = t.tile_size();
+    const std::int32_t buffer_size = t.buffer_size();
+    const bool partial = t.is_partial();
+    callback(t);
+    // The tile is done with once handed to the callback
+    release_tile(t);
+
+    if (partial)
+    {
+        return false;
+    }
+    if (z >= max_zoom)
+    {
+        return true;
+    }
+    bool complete = true;
+    for (std::uint64_t j = 0; j < 2; ++j)
+    {
+        for (std::uint64_t i = 0; i < 2; ++i)
+        {
+            merc_tile child(x * 2 + i, y * 2 + j, z + 1, tile_size, buffer_size);
+            complete = update_pyramid_tile(child, max_zoom, style_level_filter, cache, matches, callback) && complete;
+        }
+    }
+    return complete;
+}
+
+MAPNIK_VECTOR_INLINE bool processor::create_pyramid(std::uint64_t x,
+                                                    std::uint64_t y,
+                                                    std::uint64_t z,
+                                                    unsigned levels,
+                                                    tile_callback const& callback,
+                                                    std::uint32_t tile_size,
+                                                    boost::optional<std::int32_t> buffer_size,
+                                                    bool style_level_filter)
+{
+    merc_tile root(x, y, z, tile_size, get_buffer_size(tile_size, buffer_size));
+    std::vector<tile_layer> root_layers;
+    // The features of the root tile are encoded by tiles of other zoom
+    // levels, whose rules differ, so no style filter is pushed down into
+    // the queries
+    append_sublayers(m_, root_layers, root, 0.0, 0, 0, false);
+
+    // Query every vector layer once, for the buffered extent of the root
+    // tile which holds the buffered extents of all the tiles below it
+    pyramid_cache cache;
+    pyramid_candidates candidates;
+    for (std::size_t i = 0; i < root_layers.size(); ++i)
+    {
+        tile_layer const& layer = root_layers[i];
+        if (layer.get_ds()->type() != datasource::Vector)
+        {
+            continue;
+        }
+        std::shared_ptr<pyramid_features const> features;
+        for (std::size_t j = 0; j < i && !features; ++j)
+        {
+            auto shared = cache.find(root_layers[j].name());
+            if (shared != cache.end() && root_layers[j].shares_query(layer))
+            {
+                features = shared->second;
+            }
+        }
+        if (!features)
+        {
+            features = detail::read_pyramid_features(layer, cancellation_.get());
+        }
+        std::vector<std::size_t> & all = candidates[layer.name()];
+        all.resize(features->size());
+        for (std::size_t k = 0; k < all.size(); ++k)
+        {
+            all[k] = k;
+        }
+        cache.emplace(layer.name(), features);
+    }
+
+    bool complete = update_pyramid_tile(root, z + levels, style_level_filter, cache, candidates, callback);
+
+    if (buffer_pool_)
+    {
+        for (auto & layer : root_layers)
+        {
+            layer.release_buffers(*buffer_pool_);
+        }
     }
+    return complete;
 }
 
 template
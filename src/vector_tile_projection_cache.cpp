@@ -0,0 +1,2 @@
+#include "vector_tile_projection_cache.hpp"
+#include "vector_tile_projection_cache.ipp"
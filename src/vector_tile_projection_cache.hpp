@@ -0,0 +1,81 @@
+#ifndef __MAPNIK_VECTOR_TILE_PROJECTION_CACHE_H__
+#define __MAPNIK_VECTOR_TILE_PROJECTION_CACHE_H__
+
+// mapnik-vector-tile
+#include "vector_tile_config.hpp"
+
+// mapnik
+#include <mapnik/projection.hpp>
+#include <mapnik/proj_transform.hpp>
+#include <mapnik/util/noncopyable.hpp>
+
+// std
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+// The projections of a map and of one of its layers together with the
+// transformation between them.
+struct layer_projections : private mapnik::util::noncopyable
+{
+    mapnik::projection target;
+    mapnik::projection source;
+    mapnik::proj_transform transform;
+
+    MAPNIK_VECTOR_INLINE layer_projections(std::string const& target_srs,
+                                           std::string const& source_srs);
+
+    // Transformations between well known projections do not use proj4
+    // and can be used by several threads at once.
+    MAPNIK_VECTOR_INLINE bool thread_safe() const;
+};
+
+using layer_projections_ptr = std::shared_ptr<layer_projections const>;
+
+/*
+  Interns the projections of (map srs, layer srs) pairs so that they are
+  parsed once instead of once per layer of every tile. The cache can be
+  shared by any number of processors and threads.
+
+  Transformations relying on proj4 keep a proj4 context that must not be
+  used concurrently, those are not cached and every call returns new
+  projections.
+*/
+
+class projection_cache : private mapnik::util::noncopyable
+{
+    using key_type = std::tuple<std::string, std::string>;
+
+    std::mutex mutex_;
+    std::map<key_type, layer_projections_ptr> entries_;
+
+public:
+    projection_cache()
+        : mutex_(),
+          entries_() {}
+
+    MAPNIK_VECTOR_INLINE layer_projections_ptr get(std::string const& target_srs,
+                                                   std::string const& source_srs);
+
+    MAPNIK_VECTOR_INLINE std::size_t size();
+
+    MAPNIK_VECTOR_INLINE void clear();
+};
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
+
+#if !defined(MAPNIK_VECTOR_TILE_LIBRARY)
+#include "vector_tile_projection_cache.ipp"
+#endif
+
+#endif // __MAPNIK_VECTOR_TILE_PROJECTION_CACHE_H__
@@ -0,0 +1,62 @@
+// mapnik
+#include <mapnik/well_known_srs.hpp>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+MAPNIK_VECTOR_INLINE layer_projections::layer_projections(std::string const& target_srs,
+                                                          std::string const& source_srs)
+    : target(target_srs, true),
+      source(source_srs, true),
+      transform(target, source)
+{
+}
+
+MAPNIK_VECTOR_INLINE bool layer_projections::thread_safe() const
+{
+    return transform.equal() || (target.well_known() && source.well_known());
+}
+
+MAPNIK_VECTOR_INLINE layer_projections_ptr projection_cache::get(std::string const& target_srs,
+                                                                 std::string const& source_srs)
+{
+    key_type key(target_srs, source_srs);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto itr = entries_.find(key);
+        if (itr != entries_.end())
+        {
+            return itr->second;
+        }
+    }
+
+    // Parsing the projections is the expensive part, do it unlocked
+    layer_projections_ptr projections = std::make_shared<layer_projections>(target_srs, source_srs);
+    if (!projections->thread_safe())
+    {
+        return projections;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto result = entries_.emplace(key, projections);
+    return result.first->second;
+}
+
+MAPNIK_VECTOR_INLINE std::size_t projection_cache::size()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+MAPNIK_VECTOR_INLINE void projection_cache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+}
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
@@ -0,0 +1,78 @@
+#ifndef __MAPNIK_VECTOR_TILE_PYRAMID_H__
+#define __MAPNIK_VECTOR_TILE_PYRAMID_H__
+
+// mapnik-vector-tile
+#include "vector_tile_cancellation.hpp"
+#include "vector_tile_config.hpp"
+#include "vector_tile_layer.hpp"
+
+// mapnik
+#include <mapnik/box2d.hpp>
+#include <mapnik/feature.hpp>
+#include <mapnik/geometry_envelope.hpp>
+
+// std
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+/*
+  Features of a layer read once for a root tile and kept to encode every
+  tile below it. Features are kept in the srs of the layer and encoded
+  like create_tile encodes them, reprojected for every tile.
+*/
+
+struct pyramid_feature
+{
+    mapnik::feature_ptr feature;
+    // Envelope in the srs of the layer
+    mapnik::box2d<double> envelope;
+};
+
+using pyramid_features = std::vector<pyramid_feature>;
+
+// Features by layer name, layers sharing a query share their features
+using pyramid_cache = std::map<std::string, std::shared_ptr<pyramid_features const> >;
+
+// Indices of the features of each layer that reach a tile
+using pyramid_candidates = std::map<std::string, std::vector<std::size_t> >;
+
+namespace detail
+{
+
+// Reads all the features of a layer, stops early once cancelled
+inline std::shared_ptr<pyramid_features> read_pyramid_features(tile_layer const& layer,
+                                                               cancellation_token const* cancel)
+{
+    auto result = std::make_shared<pyramid_features>();
+    mapnik::featureset_ptr features = layer.get_features();
+    if (!features)
+    {
+        return result;
+    }
+    mapnik::feature_ptr feature = features->next();
+    while (feature && !is_cancelled(cancel))
+    {
+        pyramid_feature entry;
+        entry.feature = feature;
+        entry.envelope = mapnik::geometry::envelope(feature->get_geometry());
+        result->push_back(std::move(entry));
+        feature = features->next();
+    }
+    return result;
+}
+
+} // end ns detail
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
+
+#endif // __MAPNIK_VECTOR_TILE_PYRAMID_H__
@@ -3,6 +3,7 @@
 
 // mapnik-vector-tile
 #include "vector_tile_config.hpp"
+#include "vector_tile_thread_pool.hpp"
 
 // mapnik
 #include <mapnik/box2d.hpp>
@@ -12,6 +13,8 @@
 
 // std
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace mapnik
 {
@@ -34,7 +37,34 @@ private:
     unsigned raster_height_;
     int start_x_;
     int start_y_;
+    unsigned span_;
+    thread_pool * pool_;
+
+    // The source image is encoded as it is when it needs no scaling, the
+    // image of a wafer only when it covers the whole wafer
+    template <typename Image>
+    bool passes_through(Image const& source_data) const
+    {
+        return raster_width_ == source_data.width() &&
+               raster_height_ == source_data.height() &&
+               (span_ <= 1 ||
+                (raster_width_ == width_ && raster_height_ == height_ &&
+                 start_x_ == 0 && start_y_ == 0));
+    }
+
+    MAPNIK_VECTOR_INLINE std::vector<std::string> encode(mapnik::image_rgba8 const& image) const;
+
+    MAPNIK_VECTOR_INLINE std::vector<std::string> encode(mapnik::image_any const& image) const;
+
+    // Cuts an image of width x height into span x span tiles and encodes
+    // every tile the raster reaches, as tasks of the pool if there is one
+    template <typename Encoder>
+    std::vector<std::string> encode_tiles(Encoder const& encoder) const;
+
 public:
+    // Every visit returns the encoded images of the span x span tiles of
+    // the width x height target, row by row. Images of tiles the raster
+    // does not reach are empty.
     raster_clipper(mapnik::raster const& source,
                    box2d<double> const& target_ext,
                    box2d<double> const& ext,
@@ -46,7 +76,9 @@ public:
                    unsigned raster_width,
                    unsigned raster_height,
                    int start_x,
-                   int start_y)
+                   int start_y,
+                   unsigned span = 1,
+                   thread_pool * pool = nullptr)
         : source_(source),
           target_ext_(target_ext),
           ext_(ext),
@@ -58,33 +90,35 @@ public:
           raster_width_(raster_width),
           raster_height_(raster_height),
           start_x_(start_x),
-          start_y_(start_y) 
+          start_y_(start_y),
+          span_(span),
+          pool_(pool)
     {
     }
     
-    MAPNIK_VECTOR_INLINE std::string operator() (mapnik::image_rgba8 & source_data);
+    MAPNIK_VECTOR_INLINE std::vector<std::string> operator() (mapnik::image_rgba8 & source_data);
     
-    MAPNIK_VECTOR_INLINE std::string operator() (mapnik::image_gray8 & source_data);
+    MAPNIK_VECTOR_INLINE std::vector<std::string> operator() (mapnik::image_gray8 & source_data);
 
-    MAPNIK_VECTOR_INLINE std::string operator() (mapnik::image_gray8s & source_data);
+    MAPNIK_VECTOR_INLINE std::vector<std::string> operator() (mapnik::image_gray8s & source_data);
 
-    MAPNIK_VECTOR_INLINE std::string operator() (mapnik::image_gray16 & source_data);
+    MAPNIK_VECTOR_INLINE std::vector<std::string> operator() (mapnik::image_gray16 & source_data);
 
-    MAPNIK_VECTOR_INLINE std::string operator() (mapnik::image_gray16s & source_data);
+    MAPNIK_VECTOR_INLINE std::vector<std::string> operator() (mapnik::image_gray16s & source_data);
 
-    MAPNIK_VECTOR_INLINE std::string operator() (mapnik::image_gray32 & source_data);
+    MAPNIK_VECTOR_INLINE std::vector<std::string> operator() (mapnik::image_gray32 & source_data);
 
-    MAPNIK_VECTOR_INLINE std::string operator() (mapnik::image_gray32s & source_data);
+    MAPNIK_VECTOR_INLINE std::vector<std::string> operator() (mapnik::image_gray32s & source_data);
 
-    MAPNIK_VECTOR_INLINE std::string operator() (mapnik::image_gray32f & source_data);
+    MAPNIK_VECTOR_INLINE std::vector<std::string> operator() (mapnik::image_gray32f & source_data);
     
-    MAPNIK_VECTOR_INLINE std::string operator() (mapnik::image_gray64 & source_data);
+    MAPNIK_VECTOR_INLINE std::vector<std::string> operator() (mapnik::image_gray64 & source_data);
    
-    MAPNIK_VECTOR_INLINE std::string operator() (mapnik::image_gray64s & source_data);
+    MAPNIK_VECTOR_INLINE std::vector<std::string> operator() (mapnik::image_gray64s & source_data);
 
-    MAPNIK_VECTOR_INLINE std::string operator() (mapnik::image_gray64f & source_data);
+    MAPNIK_VECTOR_INLINE std::vector<std::string> operator() (mapnik::image_gray64f & source_data);
 
-    std::string operator() (image_null &) const
+    std::vector<std::string> operator() (image_null &) const
     {
         throw std::runtime_error("Null data passed to visitor");
     }
@@ -4,10 +4,16 @@
 #include <mapnik/image_any.hpp>
 #include <mapnik/image_scaling.hpp>
 #include <mapnik/image_util.hpp>
+#include <mapnik/image_view.hpp>
+#include <mapnik/image_view_any.hpp>
 #include <mapnik/proj_transform.hpp>
 #include <mapnik/raster.hpp>
 #include <mapnik/warp.hpp>
 
+// std
+#include <exception>
+#include <future>
+
 // agg
 #include "agg_rendering_buffer.h"
 #include "agg_pixfmt_rgba.h"
@@ -20,7 +26,93 @@ namespace mapnik
 namespace vector_tile_impl
 {
 
-MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_rgba8 & source_data)
+template <typename Encoder>
+std::vector<std::string> raster_clipper::encode_tiles(Encoder const& encoder) const
+{
+    std::vector<std::string> images(span_ * span_);
+    std::vector<std::future<void> > futures;
+    const unsigned tile_width = width_ / span_;
+    const unsigned tile_height = height_ / span_;
+    const std::int64_t raster_min_x = start_x_;
+    const std::int64_t raster_min_y = start_y_;
+    const std::int64_t raster_max_x = raster_min_x + raster_width_;
+    const std::int64_t raster_max_y = raster_min_y + raster_height_;
+    for (unsigned j = 0; j < span_; ++j)
+    {
+        for (unsigned i = 0; i < span_; ++i)
+        {
+            const unsigned x = i * tile_width;
+            const unsigned y = j * tile_height;
+            // Tiles the raster does not reach are left without an image
+            if (raster_max_x <= x || raster_min_x >= x + tile_width ||
+                raster_max_y <= y || raster_min_y >= y + tile_height)
+            {
+                continue;
+            }
+            std::string & image = images[j * span_ + i];
+            if (pool_)
+            {
+                futures.push_back(pool_->submit([&image, &encoder, x, y, tile_width, tile_height]()
+                {
+                    image = encoder(x, y, tile_width, tile_height);
+                }));
+            }
+            else
+            {
+                image = encoder(x, y, tile_width, tile_height);
+            }
+        }
+    }
+    // All tasks have to finish before returning, they reference the images
+    std::exception_ptr error;
+    for (auto & future : futures)
+    {
+        try
+        {
+            pool_->wait(future);
+        }
+        catch (...)
+        {
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    return images;
+}
+
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::encode(mapnik::image_rgba8 const& image) const
+{
+    if (span_ <= 1)
+    {
+        return std::vector<std::string>(1, mapnik::save_to_string(image, image_format_));
+    }
+    return encode_tiles([this, &image](unsigned x, unsigned y, unsigned width, unsigned height)
+    {
+        mapnik::image_view_rgba8 view(x, y, width, height, image);
+        return mapnik::save_to_string(view, image_format_);
+    });
+}
+
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::encode(mapnik::image_any const& image) const
+{
+    if (span_ <= 1)
+    {
+        return std::vector<std::string>(1, mapnik::save_to_string(image, image_format_));
+    }
+    return encode_tiles([this, &image](unsigned x, unsigned y, unsigned width, unsigned height)
+    {
+        mapnik::image_view_any view(mapnik::create_view(image, x, y, width, height));
+        return mapnik::save_to_string(view, image_format_);
+    });
+}
+
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::operator() (mapnik::image_rgba8 & source_data)
 {
     mapnik::image_rgba8 data(raster_width_, raster_height_, true, true);
     mapnik::raster target(target_ext_, std::move(data), source_.get_filter_factor());
@@ -34,10 +126,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_rgba8
                                    width_,
                                    scaling_method_);
     }
-    else if ((raster_width_ == source_data.width()) && (raster_height_ == source_data.height()))
+    else if (passes_through(source_data))
     {
         mapnik::demultiply_alpha(source_data);
-        return mapnik::save_to_string(source_data, image_format_);    
+        return encode(source_data);
     }
     else
     {
@@ -65,10 +157,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_rgba8
     renderer_type ren(dst_pixf);
     ren.copy_from(src_pixf,0,start_x_, start_y_);
     mapnik::demultiply_alpha(im_tile);
-    return mapnik::save_to_string(im_tile, image_format_);    
+    return encode(im_tile);
 }
 
-MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray8 & source_data)
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::operator() (mapnik::image_gray8 & source_data)
 {
     mapnik::image_gray8 data(raster_width_, raster_height_);
     mapnik::raster target(target_ext_, data, source_.get_filter_factor());
@@ -81,10 +173,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray8
                                    width_,
                                    scaling_method_);
     }
-    else if ((raster_width_ == source_data.width()) && (raster_height_ == source_data.height()))
+    else if (passes_through(source_data))
     {
         mapnik::image_any any(source_data);
-        return mapnik::save_to_string(any, image_format_);    
+        return encode(any);
     }
     else
     {
@@ -110,10 +202,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray8
     pixfmt_type dst_pixf(dst_buffer);
     renderer_type ren(dst_pixf);
     ren.copy_from(src_pixf,0,start_x_, start_y_);
-    return mapnik::save_to_string(im_tile, image_format_);    
+    return encode(im_tile);
 }
 
-MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray8s & source_data)
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::operator() (mapnik::image_gray8s & source_data)
 {
     mapnik::image_gray8s data(raster_width_, raster_height_);
     mapnik::raster target(target_ext_, data, source_.get_filter_factor());
@@ -126,10 +218,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray8
                                    width_,
                                    scaling_method_);
     }
-    else if ((raster_width_ == source_data.width()) && (raster_height_ == source_data.height()))
+    else if (passes_through(source_data))
     {
         mapnik::image_any any(source_data);
-        return mapnik::save_to_string(any, image_format_);    
+        return encode(any);
     }
     else
     {
@@ -155,10 +247,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray8
     pixfmt_type dst_pixf(dst_buffer);
     renderer_type ren(dst_pixf);
     ren.copy_from(src_pixf,0,start_x_, start_y_);
-    return mapnik::save_to_string(im_tile, image_format_);    
+    return encode(im_tile);
 }
 
-MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray16 & source_data)
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::operator() (mapnik::image_gray16 & source_data)
 {
     mapnik::image_gray16 data(raster_width_, raster_height_);
     mapnik::raster target(target_ext_, data, source_.get_filter_factor());
@@ -171,10 +263,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray1
                                    width_,
                                    scaling_method_);
     }
-    else if ((raster_width_ == source_data.width()) && (raster_height_ == source_data.height()))
+    else if (passes_through(source_data))
     {
         mapnik::image_any any(source_data);
-        return mapnik::save_to_string(any, image_format_);    
+        return encode(any);
     }
     else
     {
@@ -200,10 +292,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray1
     pixfmt_type dst_pixf(dst_buffer);
     renderer_type ren(dst_pixf);
     ren.copy_from(src_pixf,0,start_x_, start_y_);
-    return mapnik::save_to_string(im_tile, image_format_);    
+    return encode(im_tile);
 }
 
-MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray16s & source_data)
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::operator() (mapnik::image_gray16s & source_data)
 {
     mapnik::image_gray16s data(raster_width_, raster_height_);
     mapnik::raster target(target_ext_, data, source_.get_filter_factor());
@@ -216,10 +308,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray1
                                    width_,
                                    scaling_method_);
     }
-    else if ((raster_width_ == source_data.width()) && (raster_height_ == source_data.height()))
+    else if (passes_through(source_data))
     {
         mapnik::image_any any(source_data);
-        return mapnik::save_to_string(any, image_format_);    
+        return encode(any);
     }
     else
     {
@@ -245,10 +337,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray1
     pixfmt_type dst_pixf(dst_buffer);
     renderer_type ren(dst_pixf);
     ren.copy_from(src_pixf,0,start_x_, start_y_);
-    return mapnik::save_to_string(im_tile, image_format_);    
+    return encode(im_tile);
 }
 
-MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray32 & source_data)
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::operator() (mapnik::image_gray32 & source_data)
 {
     mapnik::image_gray32 data(raster_width_, raster_height_);
     mapnik::raster target(target_ext_, data, source_.get_filter_factor());
@@ -261,10 +353,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray3
                                    width_,
                                    scaling_method_);
     }
-    else if ((raster_width_ == source_data.width()) && (raster_height_ == source_data.height()))
+    else if (passes_through(source_data))
     {
         mapnik::image_any any(source_data);
-        return mapnik::save_to_string(any, image_format_);    
+        return encode(any);
     }
     else
     {
@@ -290,10 +382,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray3
     pixfmt_type dst_pixf(dst_buffer);
     renderer_type ren(dst_pixf);
     ren.copy_from(src_pixf,0,start_x_, start_y_);
-    return mapnik::save_to_string(im_tile, image_format_);    
+    return encode(im_tile);
 }
 
-MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray32s & source_data)
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::operator() (mapnik::image_gray32s & source_data)
 {
     mapnik::image_gray32s data(raster_width_, raster_height_);
     mapnik::raster target(target_ext_, data, source_.get_filter_factor());
@@ -306,10 +398,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray3
                                    width_,
                                    scaling_method_);
     }
-    else if ((raster_width_ == source_data.width()) && (raster_height_ == source_data.height()))
+    else if (passes_through(source_data))
     {
         mapnik::image_any any(source_data);
-        return mapnik::save_to_string(any, image_format_);    
+        return encode(any);
     }
     else
     {
@@ -335,10 +427,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray3
     pixfmt_type dst_pixf(dst_buffer);
     renderer_type ren(dst_pixf);
     ren.copy_from(src_pixf,0,start_x_, start_y_);
-    return mapnik::save_to_string(im_tile, image_format_);    
+    return encode(im_tile);
 }
 
-MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray32f & source_data)
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::operator() (mapnik::image_gray32f & source_data)
 {
     mapnik::image_gray32f data(raster_width_, raster_height_);
     mapnik::raster target(target_ext_, data, source_.get_filter_factor());
@@ -351,10 +443,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray3
                                    width_,
                                    scaling_method_);
     }
-    else if ((raster_width_ == source_data.width()) && (raster_height_ == source_data.height()))
+    else if (passes_through(source_data))
     {
         mapnik::image_any any(source_data);
-        return mapnik::save_to_string(any, image_format_);    
+        return encode(any);
     }
     else
     {
@@ -380,10 +472,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray3
     pixfmt_type dst_pixf(dst_buffer);
     renderer_type ren(dst_pixf);
     ren.copy_from(src_pixf,0,start_x_, start_y_);
-    return mapnik::save_to_string(im_tile, image_format_);    
+    return encode(im_tile);
 }
 
-MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray64 & source_data)
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::operator() (mapnik::image_gray64 & source_data)
 {
     mapnik::image_gray64 data(raster_width_, raster_height_);
     mapnik::raster target(target_ext_, data, source_.get_filter_factor());
@@ -396,10 +488,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray6
                                    width_,
                                    scaling_method_);
     }
-    else if ((raster_width_ == source_data.width()) && (raster_height_ == source_data.height()))
+    else if (passes_through(source_data))
     {
         mapnik::image_any any(source_data);
-        return mapnik::save_to_string(any, image_format_);    
+        return encode(any);
     }
     else
     {
@@ -425,10 +517,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray6
     pixfmt_type dst_pixf(dst_buffer);
     renderer_type ren(dst_pixf);
     ren.copy_from(src_pixf,0,start_x_, start_y_);
-    return mapnik::save_to_string(im_tile, image_format_);    
+    return encode(im_tile);
 }
 
-MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray64s & source_data)
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::operator() (mapnik::image_gray64s & source_data)
 {
     mapnik::image_gray64s data(raster_width_, raster_height_);
     mapnik::raster target(target_ext_, data, source_.get_filter_factor());
@@ -441,10 +533,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray6
                                    width_,
                                    scaling_method_);
     }
-    else if ((raster_width_ == source_data.width()) && (raster_height_ == source_data.height()))
+    else if (passes_through(source_data))
     {
         mapnik::image_any any(source_data);
-        return mapnik::save_to_string(any, image_format_);    
+        return encode(any);
     }
     else
     {
@@ -470,10 +562,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray6
     pixfmt_type dst_pixf(dst_buffer);
     renderer_type ren(dst_pixf);
     ren.copy_from(src_pixf,0,start_x_, start_y_);
-    return mapnik::save_to_string(im_tile, image_format_);    
+    return encode(im_tile);
 }
 
-MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray64f & source_data)
+MAPNIK_VECTOR_INLINE std::vector<std::string> raster_clipper::operator() (mapnik::image_gray64f & source_data)
 {
     mapnik::image_gray64f data(raster_width_, raster_height_);
     mapnik::raster target(target_ext_, data, source_.get_filter_factor());
@@ -486,10 +578,10 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray6
                                    width_,
                                    scaling_method_);
     }
-    else if ((raster_width_ == source_data.width()) && (raster_height_ == source_data.height()))
+    else if (passes_through(source_data))
     {
         mapnik::image_any any(source_data);
-        return mapnik::save_to_string(any, image_format_);    
+        return encode(any);
     }
     else
     {
@@ -515,7 +607,7 @@ MAPNIK_VECTOR_INLINE std::string raster_clipper::operator() (mapnik::image_gray6
     pixfmt_type dst_pixf(dst_buffer);
     renderer_type ren(dst_pixf);
     ren.copy_from(src_pixf,0,start_x_, start_y_);
-    return mapnik::save_to_string(im_tile, image_format_);    
+    return encode(im_tile);
 }
 
 } // end ns vector_tile_impl
@@ -0,0 +1,753 @@
+#ifndef __MAPNIK_VECTOR_TILE_STATS_H__
+#define __MAPNIK_VECTOR_TILE_STATS_H__
+
+// mapnik-vector-tile
+#include "vector_tile_config.hpp"
+#include "geometry_indexer.hpp"
+
+// mapnik
+#include <mapnik/geometry.hpp>
+#include <mapnik/util/variant.hpp>
+
+// mapbox
+#include <mapbox/geometry/geometry.hpp>
+
+// std
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+enum pipeline_stage : std::uint8_t
+{
+    STAGE_READ = 0,     // datasource featureset iteration
+    STAGE_FILTER,       // style level filter
+    STAGE_TRANSFORM,    // transform_visitor
+    STAGE_SIMPLIFY,     // geometry_simplifier
+    STAGE_UNIQUE,       // unique_points
+    STAGE_INDEX,        // geometry_indexer
+    STAGE_CLIP,         // geometry_clipper
+    STAGE_ENCODE,       // geometry_to_feature_pbf_visitor
+    STAGE_MAX
+};
+
+inline char const* stage_name(pipeline_stage stage)
+{
+    switch (stage)
+    {
+    case STAGE_READ:
+        return "read";
+    case STAGE_FILTER:
+        return "filter";
+    case STAGE_TRANSFORM:
+        return "transform";
+    case STAGE_SIMPLIFY:
+        return "simplify";
+    case STAGE_UNIQUE:
+        return "unique";
+    case STAGE_INDEX:
+        return "index";
+    case STAGE_CLIP:
+        return "clip";
+    case STAGE_ENCODE:
+        return "encode";
+    default:
+        return "unknown";
+    }
+}
+
+struct stage_stats
+{
+    std::chrono::nanoseconds time;
+    std::uint64_t vertices_in;
+    std::uint64_t vertices_out;
+
+    stage_stats()
+        : time(0),
+          vertices_in(0),
+          vertices_out(0) {}
+
+    stage_stats & operator+=(stage_stats const& rhs)
+    {
+        time += rhs.time;
+        vertices_in += rhs.vertices_in;
+        vertices_out += rhs.vertices_out;
+        return *this;
+    }
+};
+
+struct layer_stats
+{
+    std::string name;
+    std::array<stage_stats, STAGE_MAX> stages;
+    std::uint64_t features_read;
+    std::uint64_t features_filtered;
+    std::uint64_t features_below_area_threshold;
+    std::uint64_t features_clipped;
+    std::uint64_t features_encoded;
+    // Points dropped by point thinning, the points kept are counted once
+    // the layer was read
+    std::uint64_t features_thinned;
+
+    explicit layer_stats(std::string const& layer_name = std::string())
+        : name(layer_name),
+          stages(),
+          features_read(0),
+          features_filtered(0),
+          features_below_area_threshold(0),
+          features_clipped(0),
+          features_encoded(0),
+          features_thinned(0) {}
+
+    stage_stats const& stage(pipeline_stage s) const
+    {
+        return stages[s];
+    }
+
+    std::chrono::nanoseconds total_time() const
+    {
+        std::chrono::nanoseconds total(0);
+        for (auto const& s : stages)
+        {
+            total += s.time;
+        }
+        return total;
+    }
+
+    layer_stats & operator+=(layer_stats const& rhs)
+    {
+        for (std::size_t i = 0; i < stages.size(); ++i)
+        {
+            stages[i] += rhs.stages[i];
+        }
+        features_read += rhs.features_read;
+        features_filtered += rhs.features_filtered;
+        features_below_area_threshold += rhs.features_below_area_threshold;
+        features_clipped += rhs.features_clipped;
+        features_encoded += rhs.features_encoded;
+        features_thinned += rhs.features_thinned;
+        return *this;
+    }
+};
+
+/*
+  Statistics of the last tile processed by a processor, one entry
+  per processed layer in the order of the layers of the tile.
+*/
+
+class tile_stats
+{
+    std::deque<layer_stats> layers_;
+
+public:
+    tile_stats()
+        : layers_() {}
+
+    std::deque<layer_stats> const& layers() const
+    {
+        return layers_;
+    }
+
+    layer_stats const* find(std::string const& name) const
+    {
+        for (auto const& lay : layers_)
+        {
+            if (lay.name == name)
+            {
+                return &lay;
+            }
+        }
+        return nullptr;
+    }
+
+    // References to returned layers stay valid while adding more layers
+    layer_stats & add_layer(std::string const& name)
+    {
+        layers_.emplace_back(name);
+        return layers_.back();
+    }
+
+    void clear()
+    {
+        layers_.clear();
+    }
+};
+
+/*
+  Report of a single feature that took longer than the threshold of
+  the slow_feature_detector to go through the pipeline.
+*/
+
+struct slow_feature
+{
+    std::string layer_name;
+    std::int64_t id;
+    std::uint64_t vertices_in;
+    std::uint64_t vertices_out;
+    pipeline_stage slow_stage;
+    std::chrono::nanoseconds slow_stage_time;
+    std::chrono::nanoseconds total_time;
+};
+
+using slow_feature_callback = std::function<void(slow_feature const&)>;
+
+// The callback can be invoked concurrently when layers are processed
+// by several threads.
+struct slow_feature_detector
+{
+    slow_feature_callback callback;
+    std::chrono::nanoseconds threshold;
+
+    slow_feature_detector()
+        : callback(),
+          threshold(0) {}
+
+    explicit operator bool() const
+    {
+        return static_cast<bool>(callback);
+    }
+};
+
+namespace detail
+{
+
+struct vertex_counter
+{
+    template <typename T>
+    std::size_t operator() (mapnik::geometry::point<T> const&) const
+    {
+        return 1;
+    }
+
+    template <typename T>
+    std::size_t operator() (mapnik::geometry::multi_point<T> const& geom) const
+    {
+        return geom.size();
+    }
+
+    template <typename T>
+    std::size_t operator() (mapnik::geometry::line_string<T> const& geom) const
+    {
+        return geom.size();
+    }
+
+    template <typename T>
+    std::size_t operator() (mapnik::geometry::multi_line_string<T> const& geom) const
+    {
+        std::size_t count = 0;
+        for (auto const& line : geom)
+        {
+            count += line.size();
+        }
+        return count;
+    }
+
+    template <typename T>
+    std::size_t operator() (mapnik::geometry::polygon<T> const& geom) const
+    {
+        std::size_t count = geom.exterior_ring.size();
+        for (auto const& ring : geom.interior_rings)
+        {
+            count += ring.size();
+        }
+        return count;
+    }
+
+    template <typename T>
+    std::size_t operator() (mapnik::geometry::multi_polygon<T> const& geom) const
+    {
+        std::size_t count = 0;
+        for (auto const& poly : geom)
+        {
+            count += (*this)(poly);
+        }
+        return count;
+    }
+
+    template <typename T>
+    std::size_t operator() (mapnik::geometry::geometry_collection<T> const& geom) const
+    {
+        std::size_t count = 0;
+        for (auto const& g : geom)
+        {
+            count += mapnik::util::apply_visitor(*this, g);
+        }
+        return count;
+    }
+
+    std::size_t operator() (mapnik::geometry::geometry_empty const&) const
+    {
+        return 0;
+    }
+
+    // Any other geometry type carries no vertices
+    template <typename T>
+    std::size_t operator() (T const&) const
+    {
+        return 0;
+    }
+
+    template <typename T>
+    std::size_t operator() (mapbox::geometry::point<T> const&) const
+    {
+        return 1;
+    }
+
+    template <typename T>
+    std::size_t operator() (mapbox::geometry::multi_point<T> const& geom) const
+    {
+        return geom.size();
+    }
+
+    template <typename T>
+    std::size_t operator() (mapbox::geometry::line_string<T> const& geom) const
+    {
+        return geom.size();
+    }
+
+    template <typename T>
+    std::size_t operator() (mapbox::geometry::multi_line_string<T> const& geom) const
+    {
+        std::size_t count = 0;
+        for (auto const& line : geom)
+        {
+            count += line.size();
+        }
+        return count;
+    }
+
+    template <typename T>
+    std::size_t operator() (mapbox::geometry::polygon<T> const& geom) const
+    {
+        std::size_t count = 0;
+        for (auto const& ring : geom)
+        {
+            count += ring.size();
+        }
+        return count;
+    }
+
+    template <typename T>
+    std::size_t operator() (mapbox::geometry::multi_polygon<T> const& geom) const
+    {
+        std::size_t count = 0;
+        for (auto const& poly : geom)
+        {
+            count += (*this)(poly);
+        }
+        return count;
+    }
+
+    template <typename T>
+    std::size_t operator() (mapbox::geometry::geometry_collection<T> const& geom) const
+    {
+        std::size_t count = 0;
+        for (auto const& g : geom)
+        {
+            count += mapbox::util::apply_visitor(*this, g);
+        }
+        return count;
+    }
+
+    template <typename Geom>
+    std::size_t operator() (indexed_geom<Geom> const& geom) const
+    {
+        return (*this)(geom.geom);
+    }
+
+    template <typename Geom>
+    std::size_t operator() (indexed_multi_geom<Geom> const& geom) const
+    {
+        std::size_t count = 0;
+        for (auto const& g : geom.geoms)
+        {
+            count += (*this)(g.geom);
+        }
+        return count;
+    }
+};
+
+template <typename Geom>
+std::size_t vertex_count(Geom const& geom)
+{
+    return vertex_counter()(geom);
+}
+
+inline std::size_t vertex_count(mapnik::geometry::geometry<double> const& geom)
+{
+    return mapnik::util::apply_visitor(vertex_counter(), geom);
+}
+
+template <typename Ring>
+double ring_area(Ring const& ring)
+{
+    std::size_t size = ring.size();
+    if (size < 3)
+    {
+        return 0.0;
+    }
+    double a = 0.0;
+    for (std::size_t i = 0, j = size - 1; i < size; j = i++)
+    {
+        a += static_cast<double>(ring[j].x + ring[i].x) * static_cast<double>(ring[j].y - ring[i].y);
+    }
+    return std::abs(a * 0.5);
+}
+
+// Whether geometry_clipper would drop the whole geometry because
+// of the area of its exterior rings.
+template <typename T>
+bool below_area_threshold(T const&, double)
+{
+    return false;
+}
+
+inline bool below_area_threshold(indexed_polygon const& geom, double area_threshold)
+{
+    return !geom.geom.empty() && ring_area(geom.geom.front()) < area_threshold;
+}
+
+inline bool below_area_threshold(indexed_multi_polygon const& geom, double area_threshold)
+{
+    for (auto const& poly : geom.geoms)
+    {
+        if (!below_area_threshold(poly, area_threshold))
+        {
+            return false;
+        }
+    }
+    return !geom.geoms.empty();
+}
+
+/*
+  Collects the statistics of one layer while it is encoded. Stage times
+  are measured inclusive of all following stages by the stage probes and
+  converted to exclusive times by finish().
+*/
+
+class stats_recorder
+{
+public:
+    using clock = std::chrono::steady_clock;
+    using time_point = clock::time_point;
+
+private:
+    using stage_times = std::array<std::chrono::nanoseconds, STAGE_MAX>;
+    using stage_vertices = std::array<std::uint64_t, STAGE_MAX>;
+
+    stage_times inclusive_;
+    stage_vertices vertices_;
+    std::array<bool, STAGE_MAX> present_;
+    layer_stats counts_;
+    double area_threshold_;
+    bool feature_encoded_;
+    bool feature_below_threshold_;
+    bool feature_deferred_;
+    // Only used when slow features are reported
+    slow_feature_detector const* slow_features_;
+    std::string layer_name_;
+    std::int64_t feature_id_;
+    stage_times feature_inclusive_;
+    stage_vertices feature_vertices_;
+
+    std::size_t next_stage(std::size_t stage) const
+    {
+        std::size_t next = stage + 1;
+        while (next < STAGE_MAX && !present_[next])
+        {
+            ++next;
+        }
+        return next;
+    }
+
+    void report_slow_feature() const
+    {
+        slow_feature report;
+        report.total_time = std::chrono::nanoseconds(0);
+        report.slow_stage = STAGE_TRANSFORM;
+        report.slow_stage_time = std::chrono::nanoseconds(0);
+        for (std::size_t i = STAGE_TRANSFORM; i < STAGE_MAX; ++i)
+        {
+            if (!present_[i])
+            {
+                continue;
+            }
+            std::size_t next = next_stage(i);
+            std::chrono::nanoseconds time = inclusive_[i] - feature_inclusive_[i];
+            if (next < STAGE_MAX)
+            {
+                time -= inclusive_[next] - feature_inclusive_[next];
+            }
+            report.total_time += time;
+            if (time > report.slow_stage_time)
+            {
+                report.slow_stage = static_cast<pipeline_stage>(i);
+                report.slow_stage_time = time;
+            }
+        }
+        if (report.total_time < slow_features_->threshold)
+        {
+            return;
+        }
+        report.layer_name = layer_name_;
+        report.id = feature_id_;
+        report.vertices_in = vertices_[STAGE_TRANSFORM] - feature_vertices_[STAGE_TRANSFORM];
+        report.vertices_out = vertices_[STAGE_ENCODE] - feature_vertices_[STAGE_ENCODE];
+        slow_features_->callback(report);
+    }
+
+public:
+    explicit stats_recorder(double area_threshold)
+        : inclusive_(),
+          vertices_(),
+          present_(),
+          counts_(),
+          area_threshold_(area_threshold),
+          feature_encoded_(false),
+          feature_below_threshold_(false),
+          feature_deferred_(false),
+          slow_features_(nullptr),
+          layer_name_(),
+          feature_id_(0),
+          feature_inclusive_(),
+          feature_vertices_()
+    {
+        inclusive_.fill(std::chrono::nanoseconds(0));
+        vertices_.fill(0);
+        present_.fill(false);
+    }
+
+    void detect_slow_features(std::string const& layer_name,
+                              slow_feature_detector const& detector)
+    {
+        if (detector)
+        {
+            slow_features_ = &detector;
+            layer_name_ = layer_name;
+        }
+    }
+
+    time_point now() const
+    {
+        return clock::now();
+    }
+
+    void record(pipeline_stage stage, time_point start)
+    {
+        inclusive_[stage] += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        present_[stage] = true;
+    }
+
+    template <typename Geom>
+    void enter(pipeline_stage stage, Geom const& geom)
+    {
+        vertices_[stage] += vertex_count(geom);
+        if (stage == STAGE_CLIP && below_area_threshold(geom, area_threshold_))
+        {
+            feature_below_threshold_ = true;
+        }
+    }
+
+    void feature_read()
+    {
+        ++counts_.features_read;
+    }
+
+    void feature_filtered()
+    {
+        ++counts_.features_filtered;
+    }
+
+    void begin_feature(std::int64_t id)
+    {
+        feature_encoded_ = false;
+        feature_below_threshold_ = false;
+        feature_deferred_ = false;
+        if (slow_features_)
+        {
+            feature_id_ = id;
+            feature_inclusive_ = inclusive_;
+            feature_vertices_ = vertices_;
+        }
+    }
+
+    // The feature was handed over to the point thinning and is counted
+    // when the points kept are encoded
+    void feature_deferred()
+    {
+        feature_deferred_ = true;
+    }
+
+    void features_thinned(std::size_t count)
+    {
+        counts_.features_thinned += count;
+    }
+
+    void end_feature()
+    {
+        if (feature_deferred_)
+        {
+            // Counted with the points kept by the thinning
+        }
+        else if (feature_encoded_)
+        {
+            ++counts_.features_encoded;
+        }
+        else if (feature_below_threshold_)
+        {
+            ++counts_.features_below_area_threshold;
+        }
+        else
+        {
+            ++counts_.features_clipped;
+        }
+        if (slow_features_)
+        {
+            report_slow_feature();
+        }
+    }
+
+    template <typename Geom>
+    void encoded(Geom const& geom, time_point start, bool success)
+    {
+        record(STAGE_ENCODE, start);
+        if (success)
+        {
+            vertices_[STAGE_ENCODE] += vertex_count(geom);
+            feature_encoded_ = true;
+        }
+    }
+
+    stats_recorder * encode_recorder()
+    {
+        return this;
+    }
+
+    void finish(layer_stats * stats) const
+    {
+        if (!stats)
+        {
+            return;
+        }
+        layer_stats result(counts_);
+        result.stages[STAGE_READ].time = inclusive_[STAGE_READ];
+        result.stages[STAGE_FILTER].time = inclusive_[STAGE_FILTER];
+        for (std::size_t i = STAGE_TRANSFORM; i < STAGE_MAX; ++i)
+        {
+            if (!present_[i])
+            {
+                continue;
+            }
+            std::size_t next = next_stage(i);
+            stage_stats & s = result.stages[i];
+            s.vertices_in = vertices_[i];
+            if (next < STAGE_MAX)
+            {
+                s.time = inclusive_[i] - inclusive_[next];
+                s.vertices_out = vertices_[next];
+            }
+            else
+            {
+                s.time = inclusive_[i];
+                s.vertices_out = i == STAGE_ENCODE ? vertices_[i] : 0;
+            }
+        }
+        *stats += result;
+    }
+};
+
+// Used when no statistics are requested, everything compiles away.
+class null_stats_recorder
+{
+public:
+    struct time_point {};
+
+    explicit null_stats_recorder(double) {}
+
+    void detect_slow_features(std::string const&, slow_feature_detector const&) {}
+
+    time_point now() const
+    {
+        return time_point();
+    }
+
+    void record(pipeline_stage, time_point) {}
+
+    template <typename Geom>
+    void enter(pipeline_stage, Geom const&) {}
+
+    void feature_read() {}
+
+    void feature_filtered() {}
+
+    void begin_feature(std::int64_t) {}
+
+    void feature_deferred() {}
+
+    void features_thinned(std::size_t) {}
+
+    void end_feature() {}
+
+    stats_recorder * encode_recorder()
+    {
+        return nullptr;
+    }
+
+    void finish(layer_stats *) const {}
+};
+
+// Inserted between two processors of the pipeline, measures the time
+// spent in all the following stages.
+template <typename Recorder, typename NextProcessor>
+struct stage_probe
+{
+    Recorder & recorder_;
+    pipeline_stage stage_;
+    NextProcessor & next_;
+
+    stage_probe(Recorder & recorder, pipeline_stage stage, NextProcessor & next)
+        : recorder_(recorder),
+          stage_(stage),
+          next_(next) {}
+
+    template <typename T>
+    void operator() (T & geom)
+    {
+        auto start = recorder_.now();
+        recorder_.enter(stage_, geom);
+        next_(geom);
+        recorder_.record(stage_, start);
+    }
+};
+
+template <typename NextProcessor>
+struct stage_probe<null_stats_recorder, NextProcessor>
+{
+    NextProcessor & next_;
+
+    stage_probe(null_stats_recorder &, pipeline_stage, NextProcessor & next)
+        : next_(next) {}
+
+    template <typename T>
+    void operator() (T & geom)
+    {
+        next_(geom);
+    }
+};
+
+} // end ns detail
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
+
+#endif // __MAPNIK_VECTOR_TILE_STATS_H__
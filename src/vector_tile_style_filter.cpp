@@ -0,0 +1,2 @@
+#include "vector_tile_style_filter.hpp"
+#include "vector_tile_style_filter.ipp"
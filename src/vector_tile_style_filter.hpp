@@ -0,0 +1,221 @@
+#ifndef __MAPNIK_VECTOR_TILE_STYLE_FILTER_H__
+#define __MAPNIK_VECTOR_TILE_STYLE_FILTER_H__
+
+// mapnik-vector-tile
+#include "vector_tile_config.hpp"
+
+// mapnik
+#include <mapnik/attribute.hpp>
+#include <mapnik/attribute_descriptor.hpp>
+#include <mapnik/expression_node.hpp>
+#include <mapnik/expression_node_types.hpp>
+#include <mapnik/feature.hpp>
+#include <mapnik/layer.hpp>
+#include <mapnik/layer_descriptor.hpp>
+#include <mapnik/rule_cache.hpp>
+#include <mapnik/util/noncopyable.hpp>
+#include <mapnik/value.hpp>
+
+// std
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+enum style_filter_op : std::uint8_t
+{
+    FILTER_LITERAL = 0,
+    FILTER_ATTRIBUTE,
+    FILTER_AND,
+    FILTER_OR,
+    FILTER_NOT,
+    FILTER_EQUAL,
+    FILTER_NOT_EQUAL,
+    FILTER_LESS,
+    FILTER_LESS_EQUAL,
+    FILTER_GREATER,
+    FILTER_GREATER_EQUAL,
+    // Any other expression, evaluated by mapnik
+    FILTER_EXPRESSION
+};
+
+// Operands are indices of other nodes, attribute nodes hold the index
+// of their attribute in left
+struct style_filter_node
+{
+    style_filter_op op;
+    std::size_t left;
+    std::size_t right;
+    mapnik::value literal;
+    mapnik::expr_node const* expr;
+};
+
+/*
+  The filters of the active rules of a layer at a scale denominator,
+  flattened into an array of nodes. A feature is accepted as soon as the
+  filter of one rule is true, or always when a style has an else rule or
+  a rule without a filter. Attributes are looked up by their index in
+  the feature context by style_filter_evaluator.
+*/
+
+class style_filter : private mapnik::util::noncopyable
+{
+    friend class style_filter_evaluator;
+    struct compiler;
+
+    std::vector<style_filter_node> nodes_;
+    std::vector<std::size_t> rules_;
+    std::map<std::string, std::size_t> attributes_;
+    // Keeps the nodes evaluated by mapnik alive
+    std::vector<mapnik::expression_ptr> expressions_;
+    bool accepts_all_;
+
+    MAPNIK_VECTOR_INLINE std::size_t add_node(style_filter_op op,
+                                              std::size_t left = 0,
+                                              std::size_t right = 0);
+
+    MAPNIK_VECTOR_INLINE std::size_t add_literal(mapnik::value const& literal);
+
+    MAPNIK_VECTOR_INLINE std::size_t add_attribute(std::string const& name);
+
+    MAPNIK_VECTOR_INLINE std::size_t add_expression(mapnik::expr_node const& expr);
+
+    // Adds the nodes of an expression and returns the index of its root
+    MAPNIK_VECTOR_INLINE std::size_t compile(mapnik::expr_node const& expr);
+
+    MAPNIK_VECTOR_INLINE bool sql_operand(std::size_t index,
+                                          std::vector<std::string const*> const& names,
+                                          std::string & out) const;
+
+    // Type of an operand in SQL, Object when it is unknown
+    MAPNIK_VECTOR_INLINE mapnik::eAttributeType sql_type(std::size_t index,
+                                                         std::vector<mapnik::eAttributeType> const& types) const;
+
+    MAPNIK_VECTOR_INLINE bool sql_condition(std::size_t index,
+                                            std::vector<std::string const*> const& names,
+                                            std::vector<mapnik::eAttributeType> const& types,
+                                            std::string & out) const;
+
+public:
+    MAPNIK_VECTOR_INLINE explicit style_filter(std::vector<mapnik::rule_cache> const& active_rules);
+
+    bool accepts_all() const
+    {
+        return accepts_all_;
+    }
+
+    bool rejects_all() const
+    {
+        return !accepts_all_ && rules_.empty();
+    }
+
+    std::size_t attribute_count() const
+    {
+        return attributes_.size();
+    }
+
+    // A SQL condition true for at least all the features accepted by the
+    // filter. Comparisons and logical operators on attributes are
+    // translated, a rule with any other expression makes it TRUE. The
+    // descriptor gives the column types: only numbers are compared with
+    // numbers and strings with strings.
+    MAPNIK_VECTOR_INLINE std::string predicate(mapnik::layer_descriptor const& desc) const;
+};
+
+using style_filter_ptr = std::shared_ptr<style_filter const>;
+
+// Index of the attributes missing from the context of a feature
+constexpr std::size_t missing_attribute = std::numeric_limits<std::size_t>::max();
+
+// Evaluates a style filter, one per thread
+class style_filter_evaluator : private mapnik::util::noncopyable
+{
+    style_filter const& filter_;
+    mapnik::context_ptr context_;
+    std::size_t context_size_;
+    // Index in the feature context of every attribute of the filter
+    std::vector<std::size_t> indices_;
+    const mapnik::value null_;
+    const mapnik::attributes vars_;
+
+    MAPNIK_VECTOR_INLINE void resolve(mapnik::feature_impl const& feature);
+
+    MAPNIK_VECTOR_INLINE mapnik::value const& operand(std::size_t index,
+                                                      mapnik::feature_impl const& feature,
+                                                      mapnik::value & tmp) const;
+
+    MAPNIK_VECTOR_INLINE mapnik::value evaluate(std::size_t index,
+                                                mapnik::feature_impl const& feature) const;
+
+    MAPNIK_VECTOR_INLINE bool truth(std::size_t index,
+                                    mapnik::feature_impl const& feature) const;
+
+public:
+    explicit style_filter_evaluator(style_filter const& filter)
+        : filter_(filter),
+          context_(),
+          context_size_(0),
+          indices_(),
+          null_(),
+          vars_() {}
+
+    MAPNIK_VECTOR_INLINE bool operator() (mapnik::feature_impl const& feature);
+};
+
+/*
+  Style filters by layer and scale denominator, so that tiles of the same
+  zoom level compile their filters once. The layers must outlive the
+  cache. The cache can be used by several threads at once.
+*/
+
+// Compiled filters keyed by the name and the styles of a layer and by
+// scale denominator. Once full the cache is emptied before new filters
+// are added.
+class style_filter_cache : private mapnik::util::noncopyable
+{
+    using key_type = std::tuple<std::string, std::vector<std::string>, double>;
+
+    std::mutex mutex_;
+    std::map<key_type, style_filter_ptr> entries_;
+    std::size_t max_entries_;
+
+public:
+    explicit style_filter_cache(std::size_t max_entries = 1024)
+        : mutex_(),
+          entries_(),
+          max_entries_(max_entries) {}
+
+    // Returns a null pointer when the filter is not cached yet
+    MAPNIK_VECTOR_INLINE style_filter_ptr find(mapnik::layer const& layer,
+                                               double scale_denom);
+
+    // Returns the filter cached first when several threads insert
+    // the same one
+    MAPNIK_VECTOR_INLINE style_filter_ptr insert(mapnik::layer const& layer,
+                                                 double scale_denom,
+                                                 style_filter_ptr const& filter);
+
+    MAPNIK_VECTOR_INLINE std::size_t size();
+
+    MAPNIK_VECTOR_INLINE void clear();
+};
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
+
+#if !defined(MAPNIK_VECTOR_TILE_LIBRARY)
+#include "vector_tile_style_filter.ipp"
+#endif
+
+#endif // __MAPNIK_VECTOR_TILE_STYLE_FILTER_H__
@@ -0,0 +1,610 @@
+// mapnik
+#include <mapnik/expression_evaluator.hpp>
+#include <mapnik/rule.hpp>
+
+// std
+#include <functional>
+#include <iomanip>
+#include <sstream>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+// Flattens the operators evaluated the most by style filters, any other
+// expression is kept as a single node evaluated by mapnik
+struct style_filter::compiler
+{
+    using result_type = std::size_t;
+
+    style_filter & filter_;
+    mapnik::expr_node const& expr_;
+
+    compiler(style_filter & filter, mapnik::expr_node const& expr)
+        : filter_(filter),
+          expr_(expr) {}
+
+    template <typename T>
+    std::size_t operator() (T const&) const
+    {
+        return filter_.add_expression(expr_);
+    }
+
+    std::size_t operator() (mapnik::value_null const& val) const
+    {
+        return filter_.add_literal(mapnik::value(val));
+    }
+
+    std::size_t operator() (mapnik::value_bool val) const
+    {
+        return filter_.add_literal(mapnik::value(val));
+    }
+
+    std::size_t operator() (mapnik::value_integer val) const
+    {
+        return filter_.add_literal(mapnik::value(val));
+    }
+
+    std::size_t operator() (mapnik::value_double val) const
+    {
+        return filter_.add_literal(mapnik::value(val));
+    }
+
+    std::size_t operator() (mapnik::value_unicode_string const& val) const
+    {
+        return filter_.add_literal(mapnik::value(val));
+    }
+
+    std::size_t operator() (mapnik::attribute const& attr) const
+    {
+        return filter_.add_attribute(attr.name());
+    }
+
+    std::size_t operator() (mapnik::unary_node<mapnik::tags::logical_not> const& x) const
+    {
+        return filter_.add_node(FILTER_NOT, filter_.compile(x.expr));
+    }
+
+    template <typename Tag>
+    std::size_t binary(style_filter_op op, mapnik::binary_node<Tag> const& x) const
+    {
+        std::size_t left = filter_.compile(x.left);
+        std::size_t right = filter_.compile(x.right);
+        return filter_.add_node(op, left, right);
+    }
+
+    std::size_t operator() (mapnik::binary_node<mapnik::tags::logical_and> const& x) const
+    {
+        return binary(FILTER_AND, x);
+    }
+
+    std::size_t operator() (mapnik::binary_node<mapnik::tags::logical_or> const& x) const
+    {
+        return binary(FILTER_OR, x);
+    }
+
+    std::size_t operator() (mapnik::binary_node<mapnik::tags::equal_to> const& x) const
+    {
+        return binary(FILTER_EQUAL, x);
+    }
+
+    std::size_t operator() (mapnik::binary_node<mapnik::tags::not_equal_to> const& x) const
+    {
+        return binary(FILTER_NOT_EQUAL, x);
+    }
+
+    std::size_t operator() (mapnik::binary_node<mapnik::tags::less> const& x) const
+    {
+        return binary(FILTER_LESS, x);
+    }
+
+    std::size_t operator() (mapnik::binary_node<mapnik::tags::less_equal> const& x) const
+    {
+        return binary(FILTER_LESS_EQUAL, x);
+    }
+
+    std::size_t operator() (mapnik::binary_node<mapnik::tags::greater> const& x) const
+    {
+        return binary(FILTER_GREATER, x);
+    }
+
+    std::size_t operator() (mapnik::binary_node<mapnik::tags::greater_equal> const& x) const
+    {
+        return binary(FILTER_GREATER_EQUAL, x);
+    }
+};
+
+MAPNIK_VECTOR_INLINE style_filter::style_filter(std::vector<mapnik::rule_cache> const& active_rules)
+    : nodes_(),
+      rules_(),
+      attributes_(),
+      expressions_(),
+      accepts_all_(false)
+{
+    for (auto const& rc : active_rules)
+    {
+        // A style with an else rule accepts every feature
+        if (!rc.get_else_rules().empty())
+        {
+            accepts_all_ = true;
+            break;
+        }
+        for (mapnik::rule const* r : rc.get_if_rules())
+        {
+            expression_ptr const& expr = r->get_filter();
+            if (!expr)
+            {
+                continue;
+            }
+            expressions_.push_back(expr);
+            std::size_t root = compile(*expr);
+            style_filter_node const& node = nodes_[root];
+            if (node.op == FILTER_LITERAL)
+            {
+                // Rules without a filter have a literal true filter
+                if (node.literal.to_bool())
+                {
+                    accepts_all_ = true;
+                    break;
+                }
+                continue;
+            }
+            rules_.push_back(root);
+        }
+        if (accepts_all_)
+        {
+            break;
+        }
+    }
+    if (accepts_all_)
+    {
+        nodes_.clear();
+        rules_.clear();
+        attributes_.clear();
+        expressions_.clear();
+    }
+}
+
+MAPNIK_VECTOR_INLINE std::size_t style_filter::add_node(style_filter_op op,
+                                                        std::size_t left,
+                                                        std::size_t right)
+{
+    style_filter_node node;
+    node.op = op;
+    node.left = left;
+    node.right = right;
+    node.expr = nullptr;
+    nodes_.push_back(std::move(node));
+    return nodes_.size() - 1;
+}
+
+MAPNIK_VECTOR_INLINE std::size_t style_filter::add_literal(mapnik::value const& literal)
+{
+    std::size_t index = add_node(FILTER_LITERAL);
+    nodes_[index].literal = literal;
+    return index;
+}
+
+MAPNIK_VECTOR_INLINE std::size_t style_filter::add_attribute(std::string const& name)
+{
+    auto result = attributes_.emplace(name, attributes_.size());
+    return add_node(FILTER_ATTRIBUTE, result.first->second);
+}
+
+MAPNIK_VECTOR_INLINE std::size_t style_filter::add_expression(mapnik::expr_node const& expr)
+{
+    std::size_t index = add_node(FILTER_EXPRESSION);
+    nodes_[index].expr = &expr;
+    return index;
+}
+
+MAPNIK_VECTOR_INLINE std::size_t style_filter::compile(mapnik::expr_node const& expr)
+{
+    return mapnik::util::apply_visitor(compiler(*this, expr), expr);
+}
+
+MAPNIK_VECTOR_INLINE bool style_filter::sql_operand(std::size_t index,
+                                                    std::vector<std::string const*> const& names,
+                                                    std::string & out) const
+{
+    style_filter_node const& node = nodes_[index];
+    if (node.op == FILTER_ATTRIBUTE)
+    {
+        out += '"';
+        for (char c : *names[node.left])
+        {
+            out += c;
+            if (c == '"')
+            {
+                out += '"';
+            }
+        }
+        out += '"';
+        return true;
+    }
+    if (node.op != FILTER_LITERAL)
+    {
+        return false;
+    }
+    mapnik::value const& literal = node.literal;
+    if (literal.is<mapnik::value_integer>())
+    {
+        out += std::to_string(literal.get<mapnik::value_integer>());
+    }
+    else if (literal.is<mapnik::value_double>())
+    {
+        std::ostringstream s;
+        s << std::setprecision(std::numeric_limits<double>::max_digits10)
+          << literal.get<mapnik::value_double>();
+        out += s.str();
+    }
+    else if (literal.is<mapnik::value_unicode_string>())
+    {
+        out += '\'';
+        for (char c : literal.to_string())
+        {
+            out += c;
+            if (c == '\'')
+            {
+                out += '\'';
+            }
+        }
+        out += '\'';
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+MAPNIK_VECTOR_INLINE mapnik::eAttributeType style_filter::sql_type(std::size_t index,
+                                                                    std::vector<mapnik::eAttributeType> const& types) const
+{
+    style_filter_node const& node = nodes_[index];
+    if (node.op == FILTER_ATTRIBUTE)
+    {
+        return types[node.left];
+    }
+    if (node.op == FILTER_LITERAL)
+    {
+        if (node.literal.is<mapnik::value_integer>())
+        {
+            return mapnik::Integer;
+        }
+        if (node.literal.is<mapnik::value_double>())
+        {
+            return mapnik::Double;
+        }
+        if (node.literal.is<mapnik::value_unicode_string>())
+        {
+            return mapnik::String;
+        }
+    }
+    return mapnik::Object;
+}
+
+MAPNIK_VECTOR_INLINE bool style_filter::sql_condition(std::size_t index,
+                                                      std::vector<std::string const*> const& names,
+                                                      std::vector<mapnik::eAttributeType> const& types,
+                                                      std::string & out) const
+{
+    style_filter_node const& node = nodes_[index];
+    switch (node.op)
+    {
+    case FILTER_LITERAL:
+        out += node.literal.to_bool() ? "TRUE" : "FALSE";
+        return true;
+    case FILTER_AND:
+    case FILTER_OR:
+        out += '(';
+        if (!sql_condition(node.left, names, types, out))
+        {
+            return false;
+        }
+        out += node.op == FILTER_AND ? " AND " : " OR ";
+        if (!sql_condition(node.right, names, types, out))
+        {
+            return false;
+        }
+        out += ')';
+        return true;
+    case FILTER_NOT:
+        out += "(NOT ";
+        if (!sql_condition(node.left, names, types, out))
+        {
+            return false;
+        }
+        out += ')';
+        return true;
+    case FILTER_EQUAL:
+    case FILTER_NOT_EQUAL:
+    case FILTER_LESS:
+    case FILTER_LESS_EQUAL:
+    case FILTER_GREATER:
+    case FILTER_GREATER_EQUAL:
+    {
+        style_filter_node const& left = nodes_[node.left];
+        style_filter_node const& right = nodes_[node.right];
+        if (left.op != FILTER_ATTRIBUTE && right.op != FILTER_ATTRIBUTE)
+        {
+            return false;
+        }
+        style_filter_node const& other = left.op == FILTER_ATTRIBUTE ? right : left;
+        const bool equality = node.op == FILTER_EQUAL || node.op == FILTER_NOT_EQUAL;
+        if (other.op == FILTER_LITERAL && other.literal.is_null())
+        {
+            // Attributes compared with null
+            if (!equality || left.op != FILTER_ATTRIBUTE || right.op != FILTER_LITERAL)
+            {
+                return false;
+            }
+            out += '(';
+            sql_operand(node.left, names, out);
+            out += node.op == FILTER_EQUAL ? " IS NULL)" : " IS NOT NULL)";
+            return true;
+        }
+        // Databases reject comparisons of values of different types, like
+        // a text column with a number, and do not order strings the same
+        // as mapnik
+        auto numeric = [](mapnik::eAttributeType type)
+        {
+            return type == mapnik::Integer || type == mapnik::Float || type == mapnik::Double;
+        };
+        mapnik::eAttributeType left_type = sql_type(node.left, types);
+        mapnik::eAttributeType right_type = sql_type(node.right, types);
+        if (!(numeric(left_type) && numeric(right_type)) &&
+            !(equality && left_type == mapnik::String && right_type == mapnik::String))
+        {
+            return false;
+        }
+        // Null attributes are different from any value for mapnik
+        out += "COALESCE(";
+        if (!sql_operand(node.left, names, out))
+        {
+            return false;
+        }
+        switch (node.op)
+        {
+        case FILTER_EQUAL:
+            out += " = ";
+            break;
+        case FILTER_NOT_EQUAL:
+            out += " <> ";
+            break;
+        case FILTER_LESS:
+            out += " < ";
+            break;
+        case FILTER_LESS_EQUAL:
+            out += " <= ";
+            break;
+        case FILTER_GREATER:
+            out += " > ";
+            break;
+        default:
+            out += " >= ";
+            break;
+        }
+        if (!sql_operand(node.right, names, out))
+        {
+            return false;
+        }
+        out += node.op == FILTER_NOT_EQUAL ? ", TRUE)" : ", FALSE)";
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+MAPNIK_VECTOR_INLINE std::string style_filter::predicate(mapnik::layer_descriptor const& desc) const
+{
+    if (accepts_all_)
+    {
+        return "TRUE";
+    }
+    if (rules_.empty())
+    {
+        return "FALSE";
+    }
+    std::vector<std::string const*> names(attributes_.size());
+    for (auto const& attribute : attributes_)
+    {
+        names[attribute.second] = &attribute.first;
+    }
+    std::vector<mapnik::eAttributeType> types(attributes_.size(), mapnik::Object);
+    for (mapnik::attribute_descriptor const& column : desc.get_descriptors())
+    {
+        auto itr = attributes_.find(column.get_name());
+        if (itr != attributes_.end())
+        {
+            types[itr->second] = static_cast<mapnik::eAttributeType>(column.get_type());
+        }
+    }
+    std::string result;
+    for (std::size_t root : rules_)
+    {
+        std::string condition;
+        if (!sql_condition(root, names, types, condition))
+        {
+            return "TRUE";
+        }
+        if (!result.empty())
+        {
+            result += " OR ";
+        }
+        result += condition;
+    }
+    return rules_.size() > 1 ? "(" + result + ")" : result;
+}
+
+MAPNIK_VECTOR_INLINE void style_filter_evaluator::resolve(mapnik::feature_impl const& feature)
+{
+    context_ = const_cast<mapnik::feature_impl &>(feature).context();
+    context_size_ = context_ ? context_->size() : 0;
+    indices_.assign(filter_.attributes_.size(), missing_attribute);
+    if (!context_)
+    {
+        return;
+    }
+    for (auto const& entry : *context_)
+    {
+        auto itr = filter_.attributes_.find(entry.first);
+        if (itr != filter_.attributes_.end())
+        {
+            indices_[itr->second] = entry.second;
+        }
+    }
+}
+
+MAPNIK_VECTOR_INLINE mapnik::value const& style_filter_evaluator::operand(std::size_t index,
+                                                                          mapnik::feature_impl const& feature,
+                                                                          mapnik::value & tmp) const
+{
+    style_filter_node const& node = filter_.nodes_[index];
+    if (node.op == FILTER_LITERAL)
+    {
+        return node.literal;
+    }
+    if (node.op == FILTER_ATTRIBUTE)
+    {
+        std::size_t attribute = indices_[node.left];
+        return attribute == missing_attribute ? null_ : feature.get(attribute);
+    }
+    tmp = evaluate(index, feature);
+    return tmp;
+}
+
+MAPNIK_VECTOR_INLINE mapnik::value style_filter_evaluator::evaluate(std::size_t index,
+                                                                    mapnik::feature_impl const& feature) const
+{
+    style_filter_node const& node = filter_.nodes_[index];
+    switch (node.op)
+    {
+    case FILTER_LITERAL:
+    case FILTER_ATTRIBUTE:
+    {
+        mapnik::value tmp;
+        return operand(index, feature, tmp);
+    }
+    case FILTER_EXPRESSION:
+        return mapnik::util::apply_visitor(
+            mapnik::evaluate<mapnik::feature_impl, mapnik::value, mapnik::attributes>(feature, vars_), *node.expr);
+    default:
+        return mapnik::value(truth(index, feature));
+    }
+}
+
+MAPNIK_VECTOR_INLINE bool style_filter_evaluator::truth(std::size_t index,
+                                                        mapnik::feature_impl const& feature) const
+{
+    style_filter_node const& node = filter_.nodes_[index];
+    switch (node.op)
+    {
+    case FILTER_AND:
+        return truth(node.left, feature) && truth(node.right, feature);
+    case FILTER_OR:
+        return truth(node.left, feature) || truth(node.right, feature);
+    case FILTER_NOT:
+        return !truth(node.left, feature);
+    case FILTER_EQUAL:
+    case FILTER_NOT_EQUAL:
+    case FILTER_LESS:
+    case FILTER_LESS_EQUAL:
+    case FILTER_GREATER:
+    case FILTER_GREATER_EQUAL:
+    {
+        // Same operators as mapnik::evaluate
+        mapnik::value left_tmp;
+        mapnik::value right_tmp;
+        mapnik::value const& left = operand(node.left, feature, left_tmp);
+        mapnik::value const& right = operand(node.right, feature, right_tmp);
+        switch (node.op)
+        {
+        case FILTER_EQUAL:
+            return std::equal_to<mapnik::value>()(left, right);
+        case FILTER_NOT_EQUAL:
+            return std::not_equal_to<mapnik::value>()(left, right);
+        case FILTER_LESS:
+            return std::less<mapnik::value>()(left, right);
+        case FILTER_LESS_EQUAL:
+            return std::less_equal<mapnik::value>()(left, right);
+        case FILTER_GREATER:
+            return std::greater<mapnik::value>()(left, right);
+        default:
+            return std::greater_equal<mapnik::value>()(left, right);
+        }
+    }
+    default:
+        return evaluate(index, feature).to_bool();
+    }
+}
+
+MAPNIK_VECTOR_INLINE bool style_filter_evaluator::operator() (mapnik::feature_impl const& feature)
+{
+    if (filter_.accepts_all_)
+    {
+        return true;
+    }
+    if (!filter_.attributes_.empty())
+    {
+        mapnik::context_ptr const& context = const_cast<mapnik::feature_impl &>(feature).context();
+        // Contexts grow when features add attributes
+        if (context != context_ || !context_ || context_->size() != context_size_)
+        {
+            resolve(feature);
+        }
+    }
+    for (std::size_t root : filter_.rules_)
+    {
+        if (truth(root, feature))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+MAPNIK_VECTOR_INLINE style_filter_ptr style_filter_cache::find(mapnik::layer const& layer,
+                                                               double scale_denom)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto itr = entries_.find(key_type(layer.name(), layer.styles(), scale_denom));
+    if (itr == entries_.end())
+    {
+        return style_filter_ptr();
+    }
+    return itr->second;
+}
+
+MAPNIK_VECTOR_INLINE style_filter_ptr style_filter_cache::insert(mapnik::layer const& layer,
+                                                                 double scale_denom,
+                                                                 style_filter_ptr const& filter)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    key_type key(layer.name(), layer.styles(), scale_denom);
+    if (entries_.size() >= max_entries_ && entries_.find(key) == entries_.end())
+    {
+        entries_.clear();
+    }
+    auto result = entries_.emplace(std::move(key), filter);
+    return result.first->second;
+}
+
+MAPNIK_VECTOR_INLINE std::size_t style_filter_cache::size()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+MAPNIK_VECTOR_INLINE void style_filter_cache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+}
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
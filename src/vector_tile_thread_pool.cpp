@@ -0,0 +1,2 @@
+#include "vector_tile_thread_pool.hpp"
+#include "vector_tile_thread_pool.ipp"
@@ -0,0 +1,178 @@
+#ifndef __MAPNIK_VECTOR_TILE_THREAD_POOL_H__
+#define __MAPNIK_VECTOR_TILE_THREAD_POOL_H__
+
+// mapnik-vector-tile
+#include "vector_tile_config.hpp"
+
+// mapnik
+#include <mapnik/util/noncopyable.hpp>
+
+// std
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+/*
+  A fixed size pool of worker threads meant to live for the whole
+  lifetime of a tile server and to be shared by any number of processors.
+
+  Every worker owns a task queue. Tasks submitted from a worker go to the
+  back of its own queue and are popped from there (LIFO, cache friendly),
+  idle workers steal from the front of the other queues. Tasks submitted
+  from outside of the pool are distributed round robin.
+
+  Every task belongs to the wait group of the task or of the outside
+  thread that submitted it. Waiting for a task with `wait` executes the
+  pending tasks of the wait group of the caller in the meantime, so a task
+  can safely submit subtasks and wait for them without picking up
+  unrelated work, and sleeps until a task finishes otherwise.
+*/
+
+class thread_pool : private mapnik::util::noncopyable
+{
+public:
+    using task_type = std::function<void()>;
+
+private:
+    struct task_entry
+    {
+        task_type run;
+        std::uint64_t group;
+    };
+
+    struct worker_queue
+    {
+        std::mutex mutex;
+        std::deque<task_entry> tasks;
+    };
+
+    struct worker_id
+    {
+        thread_pool const* pool;
+        std::size_t index;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    // Notified when a task finishes, waiters sleep on it
+    std::condition_variable done_;
+    std::atomic<std::size_t> pending_;
+    std::atomic<std::size_t> next_queue_;
+    bool stop_;
+
+    static worker_id & current_worker()
+    {
+        static thread_local worker_id id { nullptr, 0 };
+        return id;
+    }
+
+    // Wait group of the tasks submitted from the calling thread, the task
+    // running on a thread has a group of its own
+    static std::uint64_t & current_group()
+    {
+        static thread_local std::uint64_t group = 0;
+        return group;
+    }
+
+    static std::uint64_t new_group()
+    {
+        static std::atomic<std::uint64_t> next_group(1);
+        return next_group++;
+    }
+
+    static std::uint64_t calling_group()
+    {
+        std::uint64_t & group = current_group();
+        if (group == 0)
+        {
+            group = new_group();
+        }
+        return group;
+    }
+
+    MAPNIK_VECTOR_INLINE void push(task_type && task);
+
+    MAPNIK_VECTOR_INLINE bool pop(std::size_t index, task_entry & task);
+
+    // Pops a task of a wait group from any queue
+    MAPNIK_VECTOR_INLINE bool pop_group(std::uint64_t group, task_entry & task);
+
+    MAPNIK_VECTOR_INLINE bool has_group_task(std::uint64_t group);
+
+    MAPNIK_VECTOR_INLINE void run(task_entry & task);
+
+    MAPNIK_VECTOR_INLINE void work(std::size_t index);
+
+public:
+    MAPNIK_VECTOR_INLINE explicit thread_pool(std::size_t thread_count = std::thread::hardware_concurrency());
+
+    MAPNIK_VECTOR_INLINE ~thread_pool();
+
+    std::size_t size() const
+    {
+        return threads_.size();
+    }
+
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> submit(F && f)
+    {
+        using result_type = typename std::result_of<F()>::type;
+        auto task = std::make_shared<std::packaged_task<result_type()>>(std::forward<F>(f));
+        std::future<result_type> result = task->get_future();
+        push([task]() { (*task)(); });
+        return result;
+    }
+
+    // Runs one pending task of the wait group of the calling thread,
+    // returns false if there was nothing to run.
+    MAPNIK_VECTOR_INLINE bool run_pending_task();
+
+    template <typename T>
+    T wait(std::future<T> & f)
+    {
+        std::uint64_t group = calling_group();
+        auto ready = [&f]()
+        {
+            return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        };
+        while (!ready())
+        {
+            if (run_pending_task())
+            {
+                continue;
+            }
+            // Tasks notify done_ under the lock once finished, so the
+            // future can not become ready unnoticed in between
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            done_.wait(lock, [&]() { return ready() || has_group_task(group); });
+        }
+        return f.get();
+    }
+};
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
+
+#if !defined(MAPNIK_VECTOR_TILE_LIBRARY)
+#include "vector_tile_thread_pool.ipp"
+#endif
+
+#endif // __MAPNIK_VECTOR_TILE_THREAD_POOL_H__
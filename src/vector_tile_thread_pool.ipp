@@ -0,0 +1,193 @@
+// std
+#include <algorithm>
+#include <iterator>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+MAPNIK_VECTOR_INLINE thread_pool::thread_pool(std::size_t thread_count)
+    : queues_(),
+      threads_(),
+      wake_mutex_(),
+      wake_(),
+      done_(),
+      pending_(0),
+      next_queue_(0),
+      stop_(false)
+{
+    thread_count = std::max<std::size_t>(thread_count, 1);
+    for (std::size_t i = 0; i < thread_count; ++i)
+    {
+        queues_.emplace_back(new worker_queue());
+    }
+    threads_.reserve(thread_count);
+    for (std::size_t i = 0; i < thread_count; ++i)
+    {
+        threads_.emplace_back(&thread_pool::work, this, i);
+    }
+}
+
+MAPNIK_VECTOR_INLINE thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto & thread : threads_)
+    {
+        thread.join();
+    }
+}
+
+MAPNIK_VECTOR_INLINE void thread_pool::push(task_type && task)
+{
+    worker_id const& worker = current_worker();
+    std::size_t index;
+    if (worker.pool == this)
+    {
+        index = worker.index;
+    }
+    else
+    {
+        index = next_queue_++ % queues_.size();
+    }
+    {
+        // Counted before it can be popped, so that pending_ never drops
+        // below the number of queued tasks
+        ++pending_;
+        worker_queue & queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task_entry { std::move(task), calling_group() });
+    }
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+    }
+    wake_.notify_one();
+}
+
+MAPNIK_VECTOR_INLINE bool thread_pool::pop(std::size_t index, task_entry & task)
+{
+    {
+        // Own queue first, newest task
+        worker_queue & queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            --pending_;
+            return true;
+        }
+    }
+    for (std::size_t i = 1; i < queues_.size(); ++i)
+    {
+        // Steal the oldest task of a sibling
+        worker_queue & queue = *queues_[(index + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            --pending_;
+            return true;
+        }
+    }
+    return false;
+}
+
+MAPNIK_VECTOR_INLINE bool thread_pool::pop_group(std::uint64_t group, task_entry & task)
+{
+    worker_id const& worker = current_worker();
+    std::size_t index = worker.pool == this ? worker.index : 0;
+    for (std::size_t i = 0; i < queues_.size(); ++i)
+    {
+        // Own queue first, newest task
+        worker_queue & queue = *queues_[(index + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        for (auto itr = queue.tasks.rbegin(); itr != queue.tasks.rend(); ++itr)
+        {
+            if (itr->group == group)
+            {
+                task = std::move(*itr);
+                queue.tasks.erase(std::next(itr).base());
+                --pending_;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+MAPNIK_VECTOR_INLINE bool thread_pool::has_group_task(std::uint64_t group)
+{
+    for (auto const& queue : queues_)
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        for (auto const& task : queue->tasks)
+        {
+            if (task.group == group)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+MAPNIK_VECTOR_INLINE void thread_pool::run(task_entry & task)
+{
+    // Subtasks submitted by the task are in a group of their own
+    std::uint64_t & group = current_group();
+    std::uint64_t previous = group;
+    group = new_group();
+    task.run();
+    group = previous;
+    task.run = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+    }
+    done_.notify_all();
+}
+
+MAPNIK_VECTOR_INLINE bool thread_pool::run_pending_task()
+{
+    if (pending_ == 0)
+    {
+        return false;
+    }
+    task_entry task;
+    if (!pop_group(calling_group(), task))
+    {
+        return false;
+    }
+    run(task);
+    return true;
+}
+
+MAPNIK_VECTOR_INLINE void thread_pool::work(std::size_t index)
+{
+    current_worker() = worker_id { this, index };
+    task_entry task;
+    while (true)
+    {
+        if (pop(index, task))
+        {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        wake_.wait(lock, [this]() { return stop_ || pending_ > 0; });
+        if (stop_ && pending_ == 0)
+        {
+            return;
+        }
+    }
+}
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
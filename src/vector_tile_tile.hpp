@@ -2,6 +2,7 @@
 #define __MAPNIK_VECTOR_TILE_TILE_H__
 
 // mapnik-vector-tile
+#include "vector_tile_buffer_pool.hpp"
 #include "vector_tile_config.hpp"
 #include "vector_tile_layer.hpp"
 
@@ -33,6 +34,7 @@ protected:
     mapnik::box2d<double> extent_;
     std::uint32_t tile_size_;
     std::int32_t buffer_size_;
+    bool partial_;
 
 public:
     tile(mapnik::box2d<double> const& extent,
@@ -45,7 +47,8 @@ public:
           layers_(),
           extent_(extent),
           tile_size_(tile_size),
-          buffer_size_(buffer_size) {}
+          buffer_size_(buffer_size),
+          partial_(false) {}
 
     tile(tile const& rhs) = default;
 
@@ -53,11 +56,22 @@ public:
 
     MAPNIK_VECTOR_INLINE bool add_layer(std::string const& name, std::string const& data);
 
+    // Adds the encoded layer message of a buffer that is taken over. The
+    // buffer becomes the tile buffer if the tile is still empty, the key
+    // and the length of the layer are then inserted in front of it in
+    // place. Otherwise it is appended and cleared, keeping its capacity.
+    MAPNIK_VECTOR_INLINE bool splice_layer(std::string const& name, std::string && data);
+
     bool add_layer(tile_layer const& layer)
     {
         return add_layer(layer.name(), layer.get_data());
     }
 
+    bool add_layer(tile_layer && layer)
+    {
+        return splice_layer(layer.name(), std::move(layer.get_data()));
+    }
+
     void add_empty_layer(std::string const& name)
     {
         empty_layers_.insert(name);
@@ -126,6 +140,18 @@ public:
         return layers_.empty();
     }
 
+    // The generation of the tile was cancelled, some of its layers lack
+    // features or are missing
+    bool is_partial() const
+    {
+        return partial_;
+    }
+
+    void set_partial(bool partial = true)
+    {
+        partial_ = partial;
+    }
+
     box2d<double> const& extent() const
     {
         return extent_;
@@ -178,6 +204,13 @@ public:
         return extent_ == other.extent_;
     }
 
+    // Hands the buffer over to a pool for other tiles and clears the tile
+    void release(buffer_pool & pool)
+    {
+        pool.release(std::move(buffer_));
+        clear();
+    }
+
     void clear()
     {
         buffer_.clear();
@@ -185,6 +218,7 @@ public:
         layers_.clear();
         layers_set_.clear();
         painted_layers_.clear();
+        partial_ = false;
     }
     
     bool has_layer(std::string const& name) const
@@ -42,6 +42,52 @@ MAPNIK_VECTOR_INLINE bool tile::add_layer(std::string const& name, std::string c
     return true;
 }
 
+MAPNIK_VECTOR_INLINE bool tile::splice_layer(std::string const& name, std::string && data)
+{
+    if (data.empty())
+    {
+        empty_layers_.insert(name);
+        return true;
+    }
+    if (buffer_.empty())
+    {
+        painted_layers_.insert(name);
+        auto p = layers_set_.insert(name);
+        if (!p.second)
+        {
+            // Layer already in tile
+            return false;
+        }
+        layers_.push_back(name);
+
+        // Insert the key and the length of the layer message in front of
+        // it, the buffer only reallocates when it has no spare capacity
+        std::uint64_t length = data.size();
+        char header[1 + protozero::max_varint_length];
+        std::size_t header_size = 0;
+        header[header_size++] = static_cast<char>((Tile_Encoding::LAYERS << 3) |
+                                                  static_cast<std::uint32_t>(protozero::pbf_wire_type::length_delimited));
+        while (length >= 0x80)
+        {
+            header[header_size++] = static_cast<char>((length & 0x7f) | 0x80);
+            length >>= 7;
+        }
+        header[header_size++] = static_cast<char>(length);
+        data.insert(0, header, header_size);
+        buffer_.swap(data);
+
+        auto itr = empty_layers_.find(name);
+        if (itr != empty_layers_.end())
+        {
+            empty_layers_.erase(itr);
+        }
+        return true;
+    }
+    bool added = append_layer_buffer(data.data(), data.size(), name);
+    data.clear();
+    return added;
+}
+
 MAPNIK_VECTOR_INLINE bool tile::append_layer_buffer(const char * data, std::size_t size, std::string const& name)
 {
     painted_layers_.insert(name);
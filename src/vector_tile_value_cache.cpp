@@ -0,0 +1,2 @@
+#include "vector_tile_value_cache.hpp"
+#include "vector_tile_value_cache.ipp"
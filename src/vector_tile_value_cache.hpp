@@ -0,0 +1,77 @@
+#ifndef __MAPNIK_VECTOR_TILE_VALUE_CACHE_H__
+#define __MAPNIK_VECTOR_TILE_VALUE_CACHE_H__
+
+// mapnik-vector-tile
+#include "vector_tile_config.hpp"
+
+// mapnik
+#include <mapnik/value.hpp>
+#include <mapnik/util/noncopyable.hpp>
+
+// protozero
+#include <protozero/pbf_writer.hpp>
+
+// std
+#include <array>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+/*
+  Interns the encoded Value messages of attribute values so that values
+  recurring across tiles, like road names or classes, are converted to
+  utf-8 and encoded once. The cache can be shared by any number of
+  processors and threads, it stops growing once it holds max_entries
+  values.
+*/
+
+class value_cache : private mapnik::util::noncopyable
+{
+    static constexpr std::size_t shard_count = 16;
+
+    struct shard
+    {
+        std::mutex mutex;
+        std::unordered_map<mapnik::value, std::string> entries;
+    };
+
+    std::array<shard, shard_count> shards_;
+    std::size_t max_shard_entries_;
+
+    shard & find_shard(mapnik::value const& val)
+    {
+        return shards_[std::hash<mapnik::value>()(val) % shard_count];
+    }
+
+public:
+    explicit value_cache(std::size_t max_entries = 1 << 20)
+        : shards_(),
+          max_shard_entries_((max_entries + shard_count - 1) / shard_count) {}
+
+    // Adds the encoded message of val under tag if it is cached
+    MAPNIK_VECTOR_INLINE bool add_value(protozero::pbf_writer & writer,
+                                        protozero::pbf_tag_type tag,
+                                        mapnik::value const& val);
+
+    MAPNIK_VECTOR_INLINE void insert(mapnik::value const& val, std::string && message);
+
+    MAPNIK_VECTOR_INLINE std::size_t size();
+
+    MAPNIK_VECTOR_INLINE void clear();
+};
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
+
+#if !defined(MAPNIK_VECTOR_TILE_LIBRARY)
+#include "vector_tile_value_cache.ipp"
+#endif
+
+#endif // __MAPNIK_VECTOR_TILE_VALUE_CACHE_H__
@@ -0,0 +1,54 @@
+namespace mapnik
+{
+
+namespace vector_tile_impl
+{
+
+MAPNIK_VECTOR_INLINE bool value_cache::add_value(protozero::pbf_writer & writer,
+                                                 protozero::pbf_tag_type tag,
+                                                 mapnik::value const& val)
+{
+    shard & s = find_shard(val);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto itr = s.entries.find(val);
+    if (itr == s.entries.end())
+    {
+        return false;
+    }
+    writer.add_message(tag, itr->second);
+    return true;
+}
+
+MAPNIK_VECTOR_INLINE void value_cache::insert(mapnik::value const& val, std::string && message)
+{
+    shard & s = find_shard(val);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.entries.size() < max_shard_entries_)
+    {
+        s.entries.emplace(val, std::move(message));
+    }
+}
+
+MAPNIK_VECTOR_INLINE std::size_t value_cache::size()
+{
+    std::size_t result = 0;
+    for (auto & s : shards_)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        result += s.entries.size();
+    }
+    return result;
+}
+
+MAPNIK_VECTOR_INLINE void value_cache::clear()
+{
+    for (auto & s : shards_)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.entries.clear();
+    }
+}
+
+} // end ns vector_tile_impl
+
+} // end ns mapnik
@@ -18,6 +18,7 @@ class merc_wafer
     unsigned span_;
     mapnik::box2d<double> extent_;
     std::vector<merc_tile> tiles_;
+    bool quadtree_clipping_;
 
 public:
     merc_wafer(std::uint64_t x,
@@ -30,7 +31,9 @@ public:
           y_(y),
           z_(z),
           span_(span),
-          extent_(merc_extent(x, y, z))
+          extent_(merc_extent(x, y, z)),
+          tiles_(),
+          quadtree_clipping_(false)
     {
         for (std::uint64_t j = y; j < y + span; ++j)
         {
@@ -52,6 +55,20 @@ public:
         return span_;
     }
 
+    // Geometries covering many sub-tiles are reduced to quadrants of the
+    // wafer recursively before they are clipped to every sub-tile, which
+    // is faster for large geometries. Coordinates where geometries leave
+    // a quadrant can differ by a unit from clipping them at once.
+    bool quadtree_clipping() const
+    {
+        return quadtree_clipping_;
+    }
+
+    void set_quadtree_clipping(bool quadtree_clipping)
+    {
+        quadtree_clipping_ = quadtree_clipping;
+    }
+
     std::vector<merc_tile> & tiles()
     {
         return tiles_;
@@ -94,6 +111,26 @@ public:
         return false;
     }
 
+    bool is_partial() const
+    {
+        for (auto const & tile : tiles_)
+        {
+            if (tile.is_partial())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void set_partial(bool partial = true)
+    {
+        for (auto & tile : tiles_)
+        {
+            tile.set_partial(partial);
+        }
+    }
+
     void add_empty_layer(std::string const& name)
     {
         for (auto & tile : tiles_)
@@ -113,6 +150,18 @@ public:
         }
         return added;
     }
+
+    bool add_layer(wafer_layer && layer)
+    {
+        bool added = false;
+        auto tile = tiles_.begin();
+        for (auto & buffer : layer.buffers())
+        {
+            tile->splice_layer(layer.name(), std::move(buffer));
+            ++tile;
+        }
+        return added;
+    }
 };
 
 }
@@ -435,3 +435,65 @@ TEST_CASE("raster tile output 3 -- should be able to round trip image with alpha
     }
 
 }
+
+TEST_CASE("raster wafer output")
+{
+    unsigned tile_size = 256;
+    mapnik::Map map(tile_size,tile_size,"+init=epsg:3857");
+    mapnik::layer lyr("layer",map.srs());
+    mapnik::parameters params;
+    params["type"] = "gdal";
+    params["file"] = "test/data/natural_earth.tif";
+    std::shared_ptr<mapnik::datasource> ds = mapnik::datasource_cache::instance().create(params);
+    lyr.set_datasource(ds);
+    map.add_layer(lyr);
+
+    mapnik::vector_tile_impl::processor ren(map);
+    ren.set_image_format("png32");
+    ren.set_scaling_method(mapnik::SCALING_BILINEAR);
+
+    // The raster is warped once for the whole wafer and cut into one
+    // image for each of its sub-tiles
+    mapnik::vector_tile_impl::merc_wafer wafer = ren.create_wafer(0, 0, 1, 2, tile_size, 0);
+    REQUIRE(4 == wafer.tiles().size());
+    for (auto const& sub_tile : wafer.tiles())
+    {
+        INFO(sub_tile.x() << "/" << sub_tile.y());
+        vector_tile::Tile tile;
+        REQUIRE(tile.ParseFromString(sub_tile.get_buffer()));
+        REQUIRE(1 == tile.layers_size());
+        vector_tile::Tile_Layer const& layer = tile.layers(0);
+        CHECK(std::string("layer") == layer.name());
+        CHECK(tile_size == layer.extent());
+        REQUIRE(1 == layer.features_size());
+        vector_tile::Tile_Feature const& f = layer.features(0);
+        CHECK(0 == f.geometry_size());
+        REQUIRE(f.has_raster());
+        std::string const& ras_buffer = f.raster();
+        std::unique_ptr<mapnik::image_reader> reader(mapnik::get_image_reader(ras_buffer.data(),ras_buffer.size()));
+        REQUIRE(reader.get());
+        CHECK(tile_size == reader->width());
+        CHECK(tile_size == reader->height());
+
+        // Same image size as the tile encoded on its own
+        mapnik::vector_tile_impl::merc_tile single = ren.create_tile(sub_tile.x(), sub_tile.y(), 1, tile_size, 0);
+        vector_tile::Tile single_tile;
+        REQUIRE(single_tile.ParseFromString(single.get_buffer()));
+        REQUIRE(1 == single_tile.layers_size());
+        REQUIRE(1 == single_tile.layers(0).features_size());
+        std::string const& single_buffer = single_tile.layers(0).features(0).raster();
+        std::unique_ptr<mapnik::image_reader> single_reader(mapnik::get_image_reader(single_buffer.data(),single_buffer.size()));
+        REQUIRE(single_reader.get());
+        CHECK(single_reader->width() == reader->width());
+        CHECK(single_reader->height() == reader->height());
+    }
+
+    // Images of the sub-tiles encoded by a pool are the same
+    ren.set_thread_pool(std::make_shared<mapnik::vector_tile_impl::thread_pool>(2));
+    mapnik::vector_tile_impl::merc_wafer pooled = ren.create_wafer(0, 0, 1, 2, tile_size, 0);
+    REQUIRE(wafer.tiles().size() == pooled.tiles().size());
+    for (std::size_t i = 0; i < wafer.tiles().size(); ++i)
+    {
+        CHECK(wafer.tiles()[i].get_buffer() == pooled.tiles()[i].get_buffer());
+    }
+}
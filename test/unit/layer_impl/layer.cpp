@@ -3,12 +3,25 @@
 // mapnik
 #include <mapnik/map.hpp>
 #include <mapnik/attribute.hpp>
+#include <mapnik/feature_factory.hpp>
 #include <mapnik/memory_datasource.hpp>
+#include <mapnik/unicode.hpp>
 
 // mapnik vector tile layer class
 #include "vector_tile_layer.hpp"
 #include "vector_tile_tile.hpp"
 
+// libprotobuf
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#include "vector_tile.pb.h"
+#pragma GCC diagnostic pop
+
+// std
+#include <string>
+#include <vector>
+
 TEST_CASE("Vector tile layer class")
 {
     SECTION("The constructor can produce a valid tile_layer with empty vars")
@@ -68,4 +81,100 @@ TEST_CASE("Vector tile layer class")
         REQUIRE(some_layer.get_query());
         CHECK( ( vars == some_layer.get_query()->variables() ) );
     }
+
+    SECTION("The data of a layer is the layer message without the reserved header")
+    {
+        mapnik::Map map(256, 256);
+
+        // Create memory datasource
+        mapnik::parameters params;
+        params["type"] = "memory";
+        auto ds = std::make_shared<mapnik::memory_datasource>(params);
+
+        mapnik::layer layer("layer", "+init=epsg:3857");
+        layer.set_datasource(ds);
+        mapnik::box2d<double> extent(-20037508.342789,-20037508.342789,20037508.342789,20037508.342789);
+        mapnik::vector_tile_impl::tile tile(extent, 256, 10);
+        const mapnik::attributes empty_vars;
+
+        mapnik::vector_tile_impl::tile_layer some_layer(map,
+                                                        layer,
+                                                        tile,
+                                                        1.0, // scale_factor
+                                                        0, // scale_denom
+                                                        0, // offset_x
+                                                        0, // offset_y
+                                                        false,
+                                                        0,
+                                                        empty_vars);
+        CHECK(some_layer.get_data().empty());
+        CHECK(some_layer.is_empty());
+
+        {
+            std::string & data = some_layer.get_data();
+            mapnik::vector_tile_impl::layer_builder_pbf builder("layer", 4096, data);
+            mapnik::context_ptr ctx = std::make_shared<mapnik::context_type>();
+            ctx->push("kind");
+            mapnik::feature_ptr feature(mapnik::feature_factory::create(ctx, 1));
+            feature->put("kind", static_cast<mapnik::value_integer>(1));
+            std::vector<std::uint32_t> tags;
+            builder.add_feature(*feature, tags);
+        }
+        CHECK(!some_layer.is_empty());
+
+        vector_tile::Tile_Layer parsed;
+        REQUIRE(parsed.ParseFromString(some_layer.get_data()));
+        CHECK(std::string("layer") == parsed.name());
+        CHECK(1 == parsed.keys_size());
+    }
+}
+
+TEST_CASE("Vector tile layer builder keys")
+{
+    std::string buffer;
+    mapnik::vector_tile_impl::layer_builder_pbf builder("layer", 4096, buffer);
+
+    mapnik::transcoder tr("utf-8");
+    mapnik::context_ptr ctx = std::make_shared<mapnik::context_type>();
+    ctx->push("name");
+    ctx->push("kind");
+    mapnik::feature_ptr first(mapnik::feature_factory::create(ctx, 1));
+    first->put("name", tr.transcode("a"));
+    first->put("kind", static_cast<mapnik::value_integer>(1));
+    std::vector<std::uint32_t> tags;
+    builder.add_feature(*first, tags);
+    // Attributes are ordered by name
+    CHECK((tags == std::vector<std::uint32_t> { 0, 0, 1, 1 }));
+
+    // Null values are skipped and do not add their key
+    mapnik::feature_ptr second(mapnik::feature_factory::create(ctx, 2));
+    second->put("kind", static_cast<mapnik::value_integer>(1));
+    tags.clear();
+    builder.add_feature(*second, tags);
+    CHECK((tags == std::vector<std::uint32_t> { 0, 0 }));
+
+    // A key added to the context after the first features
+    mapnik::feature_ptr third(mapnik::feature_factory::create(ctx, 3));
+    third->put_new("height", static_cast<mapnik::value_integer>(10));
+    third->put("name", tr.transcode("a"));
+    tags.clear();
+    builder.add_feature(*third, tags);
+    CHECK((tags == std::vector<std::uint32_t> { 2, 2, 1, 1 }));
+
+    // Features with another context find the same keys by name
+    mapnik::context_ptr other_ctx = std::make_shared<mapnik::context_type>();
+    other_ctx->push("name");
+    mapnik::feature_ptr fourth(mapnik::feature_factory::create(other_ctx, 4));
+    fourth->put("name", tr.transcode("b"));
+    tags.clear();
+    builder.add_feature(*fourth, tags);
+    CHECK((tags == std::vector<std::uint32_t> { 1, 3 }));
+
+    vector_tile::Tile_Layer layer;
+    REQUIRE(layer.ParseFromString(buffer));
+    REQUIRE(3 == layer.keys_size());
+    CHECK(std::string("kind") == layer.keys(0));
+    CHECK(std::string("name") == layer.keys(1));
+    CHECK(std::string("height") == layer.keys(2));
+    CHECK(4 == layer.values_size());
 }
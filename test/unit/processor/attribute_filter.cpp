@@ -0,0 +1,64 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// test utils
+#include "tile_util.hpp"
+
+// std
+#include <set>
+#include <string>
+
+namespace {
+
+std::set<std::string> encoded_keys(mapnik::parameters const& params, std::uint64_t z)
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/attribute_filter_style.xml");
+    set_datasource_parameters(map.get_layer(0), params);
+    vector_tile::Tile tile = encode_tile(map, 1ULL << (z - 1), 1ULL << (z - 1), z);
+    REQUIRE(1 == tile.layers_size());
+    vector_tile::Tile_Layer const& layer = tile.layers(0);
+    REQUIRE(layer.features_size() > 0);
+    std::set<std::string> keys;
+    for (int i = 0; i < layer.features_size(); ++i)
+    {
+        for (auto const& attribute : feature_attributes(layer, layer.features(i)))
+        {
+            keys.insert(attribute.first);
+        }
+    }
+    CHECK(keys.size() == static_cast<std::size_t>(layer.keys_size()));
+    return keys;
+}
+
+} // end anonymous namespace
+
+TEST_CASE("feature processor - attribute filter")
+{
+    using keys = std::set<std::string>;
+
+    CHECK((encoded_keys(mapnik::parameters(), 1) == keys { "name", "kind", "ref", "height" }));
+
+    mapnik::parameters include;
+    include["mvt_include_attributes"] = std::string("name, kind");
+    CHECK((encoded_keys(include, 1) == keys { "name", "kind" }));
+
+    mapnik::parameters exclude;
+    exclude["mvt_exclude_attributes"] = std::string("height");
+    CHECK((encoded_keys(exclude, 1) == keys { "name", "kind", "ref" }));
+
+    // Entries only apply to their range of zoom levels
+    mapnik::parameters params;
+    params["mvt_include_attributes"] = std::string("name, kind, ref:5, height:2-4");
+    params["mvt_exclude_attributes"] = std::string("kind:6");
+    CHECK((encoded_keys(params, 1) == keys { "name", "kind" }));
+    CHECK((encoded_keys(params, 3) == keys { "name", "kind", "height" }));
+    CHECK((encoded_keys(params, 5) == keys { "name", "kind", "ref" }));
+    CHECK((encoded_keys(params, 7) == keys { "name", "ref" }));
+
+    mapnik::parameters invalid;
+    invalid["mvt_include_attributes"] = std::string("name:x");
+    CHECK_THROWS(encoded_keys(invalid, 1));
+}
@@ -0,0 +1,99 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_buffer_pool.hpp"
+#include "vector_tile_processor.hpp"
+
+// std
+#include <memory>
+#include <string>
+
+TEST_CASE("buffer pool - buffers keep their capacity")
+{
+    mapnik::vector_tile_impl::buffer_pool pool(2, 1 << 20, 1024);
+    CHECK(0 == pool.size());
+    CHECK(0 == pool.estimate("layer"));
+
+    std::string buffer = pool.acquire("layer", 6);
+    CHECK(std::string(6, '\0') == buffer);
+    buffer.append(2000, 'x');
+    pool.record("layer", buffer.size());
+    CHECK(2006 == pool.estimate("layer"));
+    pool.release(std::move(buffer));
+    CHECK(1 == pool.size());
+
+    std::string reused = pool.acquire("layer", 6);
+    CHECK(0 == pool.size());
+    CHECK(std::string(6, '\0') == reused);
+    CHECK(reused.capacity() >= 2006);
+
+    // Estimates follow the recent sizes of a layer
+    pool.record("layer", 6);
+    CHECK(pool.estimate("layer") < 2006);
+    CHECK(pool.estimate("layer") > 6);
+    CHECK(pool.acquire("other", 6).capacity() >= 6);
+
+    // Empty buffers, buffers a string was moved from, buffers below the
+    // minimum or above the maximum capacity and buffers beyond the number
+    // limit are not kept
+    pool.release(std::string());
+    CHECK(0 == pool.size());
+    std::string moved_from(3000, 'x');
+    std::string moved_to(std::move(moved_from));
+    pool.release(std::move(moved_from));
+    CHECK(0 == pool.size());
+    pool.release(std::string(100, 'x'));
+    CHECK(0 == pool.size());
+    pool.release(std::string(2 << 20, 'x'));
+    CHECK(0 == pool.size());
+    pool.release(std::string(2000, 'x'));
+    pool.release(std::string(3000, 'x'));
+    pool.release(std::string(1500, 'x'));
+    CHECK(2 == pool.size());
+
+    pool.clear();
+    CHECK(0 == pool.size());
+    CHECK(0 == pool.estimate("layer"));
+}
+
+TEST_CASE("feature processor - buffer pool")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/points_style.xml");
+
+    processor ren(map);
+    CHECK(!ren.get_buffer_pool());
+    merc_tile expected = ren.create_tile(0, 0, 0, 4096, 0);
+    merc_tile expected_child = ren.create_tile(1, 1, 1, 4096, 0);
+
+    // The tiles of this map are small, so is the minimum capacity
+    auto pool = std::make_shared<buffer_pool>(64, 16 << 20, 16);
+    ren.set_buffer_pool(pool);
+    CHECK(pool == ren.get_buffer_pool());
+
+    // Tiles are the same whether their buffers come from the pool or not
+    merc_tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+    CHECK(expected.get_buffer() == out_tile.get_buffer());
+    CHECK(pool->estimate("points") > 0);
+    CHECK(pool->estimate("more_points") > 0);
+    // Layer buffers moved into the tile do not go back to the pool
+    CHECK(0 == pool->size());
+
+    ren.release_tile(out_tile);
+    CHECK(out_tile.get_buffer().empty());
+    CHECK(out_tile.is_empty());
+    CHECK(1 == pool->size());
+
+    for (int i = 0; i < 4; ++i)
+    {
+        merc_tile child = ren.create_tile(1, 1, 1, 4096, 0);
+        CHECK(expected_child.get_buffer() == child.get_buffer());
+        ren.release_tile(child);
+    }
+    CHECK(1 == pool->size());
+}
@@ -0,0 +1,137 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_processor.hpp"
+#include "vector_tile_byte_budget.hpp"
+
+// test utils
+#include "tile_util.hpp"
+
+// std
+#include <set>
+#include <string>
+
+TEST_CASE("feature processor - byte budget")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/byte_budget_style.xml");
+
+    processor ren(map);
+    CHECK(!ren.get_byte_budget().enabled());
+    tile unlimited = ren.create_tile(0, 0, 0, 4096, 0);
+    vector_tile::Tile full;
+    REQUIRE(full.ParseFromString(unlimited.get_buffer()));
+    REQUIRE(2 == full.layers_size());
+    REQUIRE(4 == full.layers(0).features_size());
+    std::size_t const full_layer_size = full.layers(0).ByteSize();
+
+    SECTION("a budget larger than the tile changes nothing")
+    {
+        byte_budget budget;
+        budget.layer_bytes = unlimited.size() * 2;
+        ren.set_byte_budget(budget);
+        CHECK(ren.get_byte_budget().enabled());
+        tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+        CHECK(unlimited.get_buffer() == out_tile.get_buffer());
+    }
+
+    SECTION("the largest polygons are kept first")
+    {
+        byte_budget budget;
+        budget.layer_bytes = full_layer_size - 1;
+        budget.priority = BUDGET_AREA;
+        ren.set_byte_budget(budget);
+        tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+        vector_tile::Tile result;
+        REQUIRE(result.ParseFromString(out_tile.get_buffer()));
+        vector_tile::Tile_Layer const* layer = find_layer(result, "polygons");
+        REQUIRE(layer != nullptr);
+        CHECK(layer->ByteSize() <= static_cast<int>(budget.layer_bytes));
+        std::set<std::string> names = attribute_values(*layer, "name");
+        CHECK(3 == names.size());
+        CHECK(names.count("a") == 0);
+        // Dropped values do not stay in the layer
+        CHECK(layer->values_size() == 6);
+    }
+
+    SECTION("features with the largest attribute are kept first")
+    {
+        byte_budget budget;
+        budget.layer_bytes = full_layer_size / 2;
+        budget.priority = BUDGET_ATTRIBUTE;
+        budget.attribute = "rank";
+        ren.set_byte_budget(budget);
+        tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+        vector_tile::Tile result;
+        REQUIRE(result.ParseFromString(out_tile.get_buffer()));
+        vector_tile::Tile_Layer const* layer = find_layer(result, "polygons");
+        REQUIRE(layer != nullptr);
+        CHECK(layer->ByteSize() <= static_cast<int>(budget.layer_bytes));
+        std::set<std::string> names = attribute_values(*layer, "name");
+        REQUIRE(!names.empty());
+        CHECK(names.size() < 4);
+        CHECK(names.count("c") == 1);
+        if (names.size() > 1)
+        {
+            CHECK(names.count("a") == 1);
+        }
+    }
+
+    SECTION("features read first are kept first")
+    {
+        byte_budget budget;
+        budget.layer_bytes = full_layer_size / 2;
+        ren.set_byte_budget(budget);
+        tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+        vector_tile::Tile result;
+        REQUIRE(result.ParseFromString(out_tile.get_buffer()));
+        vector_tile::Tile_Layer const* layer = find_layer(result, "polygons");
+        REQUIRE(layer != nullptr);
+        CHECK(layer->ByteSize() <= static_cast<int>(budget.layer_bytes));
+        REQUIRE(layer->features_size() > 0);
+        CHECK(layer->features_size() < 4);
+        CHECK(layer->features(0).id() == full.layers(0).features(0).id());
+    }
+
+    SECTION("the tile budget is shared between layers")
+    {
+        byte_budget budget;
+        budget.tile_bytes = unlimited.size() / 2;
+        budget.priority = BUDGET_AREA;
+        ren.set_byte_budget(budget);
+        tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+        CHECK(out_tile.size() <= budget.tile_bytes);
+        vector_tile::Tile result;
+        REQUIRE(result.ParseFromString(out_tile.get_buffer()));
+        CHECK(result.layers_size() > 0);
+    }
+
+    SECTION("the tile budget keeps the features read first before they are ordered")
+    {
+        byte_budget budget;
+        budget.tile_bytes = unlimited.size() / 2;
+        ren.set_byte_budget(budget);
+        tile read_order = ren.create_tile(0, 0, 0, 4096, 0);
+        vector_tile::Tile expected;
+        REQUIRE(expected.ParseFromString(read_order.get_buffer()));
+        vector_tile::Tile_Layer const* expected_layer = find_layer(expected, "polygons");
+        REQUIRE(expected_layer != nullptr);
+        REQUIRE(expected_layer->features_size() > 0);
+        REQUIRE(expected_layer->features_size() < 4);
+
+        ren.set_hilbert_order(true);
+        ren.set_compact_layers(true);
+        tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+        CHECK(out_tile.size() <= budget.tile_bytes);
+        vector_tile::Tile result;
+        REQUIRE(result.ParseFromString(out_tile.get_buffer()));
+        vector_tile::Tile_Layer const* layer = find_layer(result, "polygons");
+        REQUIRE(layer != nullptr);
+        CHECK(attribute_values(*expected_layer, "name") == attribute_values(*layer, "name"));
+    }
+}
@@ -0,0 +1,99 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_cancellation.hpp"
+#include "vector_tile_processor.hpp"
+
+// libprotobuf
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#include "vector_tile.pb.h"
+#pragma GCC diagnostic pop
+
+// std
+#include <chrono>
+#include <memory>
+#include <string>
+
+TEST_CASE("cancellation token")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    cancellation_token token;
+    CHECK(!token.cancelled());
+    token.set_timeout(std::chrono::hours(1));
+    CHECK(!token.cancelled());
+    token.cancel();
+    CHECK(token.cancelled());
+
+    cancellation_token expired(cancellation_token::clock::now() - std::chrono::seconds(1));
+    CHECK(expired.cancelled());
+    // Moving the deadline does not revive it
+    expired.set_timeout(std::chrono::hours(1));
+    CHECK(expired.cancelled());
+}
+
+TEST_CASE("feature processor - cancelled tile generation")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/points_style.xml");
+
+    processor ren(map);
+    CHECK(!ren.get_cancellation_token());
+    merc_tile expected = ren.create_tile(0, 0, 0, 4096, 0);
+    CHECK(!expected.is_partial());
+
+    SECTION("a token never cancelled changes nothing")
+    {
+        auto token = std::make_shared<cancellation_token>();
+        token->set_timeout(std::chrono::hours(1));
+        ren.set_cancellation_token(token);
+        CHECK(token == ren.get_cancellation_token());
+        merc_tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+        CHECK(!out_tile.is_partial());
+        CHECK(expected.get_buffer() == out_tile.get_buffer());
+    }
+
+    SECTION("an expired deadline stops before any layer")
+    {
+        auto token = std::make_shared<cancellation_token>(
+            cancellation_token::clock::now() - std::chrono::milliseconds(1));
+        ren.set_cancellation_token(token);
+        for (auto mode : { std::launch::deferred, std::launch::async })
+        {
+            ren.set_threading_mode(mode);
+            merc_tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+            CHECK(out_tile.is_partial());
+            CHECK(out_tile.is_empty());
+            CHECK(2 == out_tile.get_empty_layers().size());
+        }
+    }
+
+    SECTION("cancelling while a layer is encoded keeps the features encoded so far")
+    {
+        auto token = std::make_shared<cancellation_token>();
+        ren.set_cancellation_token(token);
+        // The first feature done cancels the tile
+        ren.set_slow_feature_callback([&token](slow_feature const&)
+        {
+            token->cancel();
+        }, std::chrono::nanoseconds(0));
+        merc_tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+        CHECK(out_tile.is_partial());
+
+        vector_tile::Tile tile;
+        REQUIRE(tile.ParseFromString(out_tile.get_buffer()));
+        REQUIRE(1 == tile.layers_size());
+        CHECK(std::string("points") == tile.layers(0).name());
+        CHECK(1 == tile.layers(0).features_size());
+
+        out_tile.clear();
+        CHECK(!out_tile.is_partial());
+    }
+}
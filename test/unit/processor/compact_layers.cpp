@@ -0,0 +1,87 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_processor.hpp"
+#include "vector_tile_thread_pool.hpp"
+
+// test utils
+#include "tile_util.hpp"
+
+// std
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Attributes of every feature of a layer
+std::vector<std::map<std::string, std::string> > attributes(vector_tile::Tile_Layer const& layer)
+{
+    std::vector<std::map<std::string, std::string> > result;
+    for (int i = 0; i < layer.features_size(); ++i)
+    {
+        result.push_back(feature_attributes(layer, layer.features(i)));
+    }
+    return result;
+}
+
+} // end anonymous namespace
+
+TEST_CASE("feature processor - compact layers")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::Map map(256, 256);
+    // Every point has a rare name while kind and level repeat
+    mapnik::load_map(map, "test/data/compact_layers_style.xml");
+
+    processor ren(map);
+    CHECK(!ren.get_compact_layers());
+    merc_tile expected = ren.create_tile(0, 0, 0, 4096, 0);
+    vector_tile::Tile expected_tile;
+    REQUIRE(expected_tile.ParseFromString(expected.get_buffer()));
+    REQUIRE(1 == expected_tile.layers_size());
+    vector_tile::Tile_Layer const& expected_layer = expected_tile.layers(0);
+    REQUIRE(200 == expected_layer.features_size());
+
+    ren.set_compact_layers(true);
+    CHECK(ren.get_compact_layers());
+
+    SECTION("single pass")
+    {
+    }
+
+    SECTION("chunked layers")
+    {
+        ren.set_thread_pool(std::make_shared<thread_pool>(2));
+        ren.set_layer_chunk_size(30);
+    }
+
+    merc_tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+    CHECK(out_tile.get_buffer().size() < expected.get_buffer().size());
+    vector_tile::Tile tile;
+    REQUIRE(tile.ParseFromString(out_tile.get_buffer()));
+    REQUIRE(1 == tile.layers_size());
+    vector_tile::Tile_Layer const& layer = tile.layers(0);
+    CHECK(attributes(expected_layer) == attributes(layer));
+    CHECK(expected_layer.keys_size() == layer.keys_size());
+    CHECK(expected_layer.values_size() == layer.values_size());
+
+    // The values shared by the most features come first
+    REQUIRE(layer.values_size() > 4);
+    CHECK(std::string("road") == layer.values(0).string_value());
+    CHECK(layer.values(1).has_sint_value());
+    CHECK(-1 == layer.values(1).sint_value());
+    for (int i = 0; i < layer.values_size(); ++i)
+    {
+        CHECK(!layer.values(i).has_int_value());
+    }
+    for (int i = 0; i < layer.features_size(); ++i)
+    {
+        CHECK(expected_layer.features(i).geometry_size() == layer.features(i).geometry_size());
+    }
+}
@@ -0,0 +1,149 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/feature_factory.hpp>
+#include <mapnik/load_map.hpp>
+#include <mapnik/unicode.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_geometry_feature.hpp"
+#include "vector_tile_processor.hpp"
+
+// test utils
+#include "tile_util.hpp"
+
+// std
+#include <memory>
+#include <string>
+
+namespace {
+
+vector_tile::Tile_Layer encode_layer(mapnik::parameters const& params)
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/feature_merging_style.xml");
+    set_datasource_parameters(map.get_layer(0), params);
+    vector_tile::Tile tile = encode_tile(map);
+    REQUIRE(1 == tile.layers_size());
+    return tile.layers(0);
+}
+
+std::string kind(vector_tile::Tile_Layer const& layer, vector_tile::Tile_Feature const& feature)
+{
+    REQUIRE(2 == feature.tags_size());
+    vector_tile::Tile_Value const* value = find_value(layer, feature, "kind");
+    REQUIRE(value);
+    return value->string_value();
+}
+
+// Number of MoveTo commands of the geometry of a feature
+int move_to_count(vector_tile::Tile_Feature const& feature)
+{
+    int count = 0;
+    int i = 0;
+    while (i < feature.geometry_size())
+    {
+        std::uint32_t command = feature.geometry(i) & 0x7;
+        std::uint32_t length = feature.geometry(i) >> 3;
+        ++i;
+        if (command == 1)
+        {
+            count += static_cast<int>(length);
+        }
+        if (command != 7)
+        {
+            i += static_cast<int>(length) * 2;
+        }
+    }
+    return count;
+}
+
+} // end anonymous namespace
+
+TEST_CASE("feature processor - feature merging")
+{
+    CHECK(8 == encode_layer(mapnik::parameters()).features_size());
+
+    mapnik::parameters params;
+    params["mvt_merge_features"] = std::string("true");
+
+    SECTION("features with the same tags are merged")
+    {
+        vector_tile::Tile_Layer layer = encode_layer(params);
+        REQUIRE(4 == layer.features_size());
+
+        vector_tile::Tile_Feature const& roads = layer.features(0);
+        CHECK("road" == kind(layer, roads));
+        CHECK(vector_tile::Tile_GeomType_LINESTRING == roads.type());
+        CHECK(1 == move_to_count(roads));
+        CHECK(roads.has_id());
+        CHECK(1 == roads.id());
+
+        vector_tile::Tile_Feature const& paths = layer.features(1);
+        CHECK("path" == kind(layer, paths));
+        CHECK(1 == move_to_count(paths));
+        CHECK(4 == paths.id());
+
+        vector_tile::Tile_Feature const& parks = layer.features(2);
+        CHECK("park" == kind(layer, parks));
+        CHECK(vector_tile::Tile_GeomType_POLYGON == parks.type());
+        CHECK(1 == move_to_count(parks));
+
+        vector_tile::Tile_Feature const& stops = layer.features(3);
+        CHECK("stop" == kind(layer, stops));
+        CHECK(vector_tile::Tile_GeomType_POINT == stops.type());
+        REQUIRE(stops.geometry_size() > 0);
+        CHECK(2 == (stops.geometry(0) >> 3));
+    }
+
+    SECTION("ids of merged features can be dropped")
+    {
+        params["mvt_merge_drop_ids"] = std::string("true");
+        vector_tile::Tile_Layer layer = encode_layer(params);
+        REQUIRE(4 == layer.features_size());
+        for (int i = 0; i < layer.features_size(); ++i)
+        {
+            CHECK(!layer.features(i).has_id());
+        }
+    }
+}
+
+TEST_CASE("feature merging - geometries rejected by the merger add no attributes")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    std::string buffer;
+    {
+        layer_builder_pbf builder("features", 4096, buffer);
+        builder.merger.reset(new feature_merger(false));
+
+        mapnik::transcoder tr("utf-8");
+        mapnik::context_ptr ctx = std::make_shared<mapnik::context_type>();
+        ctx->push("kind");
+        mapnik::feature_ptr kept(mapnik::feature_factory::create(ctx, 1));
+        kept->put("kind", tr.transcode("road"));
+        mapnik::feature_ptr rejected(mapnik::feature_factory::create(ctx, 2));
+        rejected->put("kind", tr.transcode("degenerate"));
+
+        mapbox::geometry::line_string<std::int64_t> line;
+        line.emplace_back(0, 0);
+        line.emplace_back(10, 0);
+        geometry_to_feature_pbf_visitor kept_encoder(*kept, builder);
+        kept_encoder(line);
+
+        mapbox::geometry::line_string<std::int64_t> single_point;
+        single_point.emplace_back(20, 20);
+        geometry_to_feature_pbf_visitor rejected_encoder(*rejected, builder);
+        rejected_encoder(single_point);
+        rejected_encoder(mapbox::geometry::multi_polygon<std::int64_t>());
+
+        builder.finalize();
+    }
+
+    vector_tile::Tile_Layer layer;
+    REQUIRE(layer.ParseFromString(buffer));
+    REQUIRE(1 == layer.features_size());
+    CHECK(1 == layer.keys_size());
+    REQUIRE(1 == layer.values_size());
+    CHECK("road" == layer.values(0).string_value());
+}
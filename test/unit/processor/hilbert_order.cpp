@@ -0,0 +1,89 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_processor.hpp"
+
+// libprotobuf
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#include "vector_tile.pb.h"
+#pragma GCC diagnostic pop
+
+// std
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::uint32_t curve_index(vector_tile::Tile_Feature const& feature, std::uint32_t extent)
+{
+    REQUIRE(3 == feature.geometry_size());
+    const double size = 3.0 * extent;
+    double x = (protozero::decode_zigzag32(feature.geometry(1)) + static_cast<double>(extent)) / size * 65535.0;
+    double y = (protozero::decode_zigzag32(feature.geometry(2)) + static_cast<double>(extent)) / size * 65535.0;
+    return mapnik::vector_tile_impl::detail::hilbert_index(static_cast<std::uint32_t>(x),
+                                                           static_cast<std::uint32_t>(y));
+}
+
+} // end anonymous namespace
+
+TEST_CASE("hilbert order - index of the quadrants")
+{
+    using mapnik::vector_tile_impl::detail::hilbert_index;
+    CHECK(0 == hilbert_index(0, 0));
+    CHECK((1u << 30) == hilbert_index(0, 32768));
+    CHECK((2u << 30) == hilbert_index(32768, 32768));
+    CHECK((3u << 30) == hilbert_index(32768, 0));
+    CHECK(hilbert_index(65535, 0) == 0xffffffff);
+}
+
+TEST_CASE("feature processor - hilbert order")
+{
+    mapnik::Map map(256, 256);
+    // Points scattered over the tile in no particular order
+    mapnik::load_map(map, "test/data/hilbert_order_style.xml");
+
+    mapnik::vector_tile_impl::processor ren(map);
+    CHECK(!ren.get_hilbert_order());
+    mapnik::vector_tile_impl::merc_tile expected = ren.create_tile(0, 0, 0, 4096, 0);
+    vector_tile::Tile expected_tile;
+    REQUIRE(expected_tile.ParseFromString(expected.get_buffer()));
+    REQUIRE(1 == expected_tile.layers_size());
+
+    ren.set_hilbert_order(true);
+    CHECK(ren.get_hilbert_order());
+    mapnik::vector_tile_impl::merc_tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+    vector_tile::Tile tile;
+    REQUIRE(tile.ParseFromString(out_tile.get_buffer()));
+    REQUIRE(1 == tile.layers_size());
+
+    vector_tile::Tile_Layer const& expected_layer = expected_tile.layers(0);
+    vector_tile::Tile_Layer const& layer = tile.layers(0);
+    REQUIRE(64 == layer.features_size());
+    REQUIRE(expected_layer.features_size() == layer.features_size());
+    CHECK(expected_layer.keys_size() == layer.keys_size());
+    CHECK(expected_layer.values_size() == layer.values_size());
+
+    std::vector<std::uint64_t> expected_ids;
+    std::vector<std::uint64_t> ids;
+    bool reordered = false;
+    std::uint32_t previous = 0;
+    for (int i = 0; i < layer.features_size(); ++i)
+    {
+        expected_ids.push_back(expected_layer.features(i).id());
+        ids.push_back(layer.features(i).id());
+        reordered = reordered || expected_ids.back() != ids.back();
+        std::uint32_t index = curve_index(layer.features(i), layer.extent());
+        CHECK(previous <= index);
+        previous = index;
+    }
+    CHECK(reordered);
+    std::sort(expected_ids.begin(), expected_ids.end());
+    std::sort(ids.begin(), ids.end());
+    CHECK(expected_ids == ids);
+}
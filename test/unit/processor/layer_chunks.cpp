@@ -0,0 +1,153 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_processor.hpp"
+#include "vector_tile_thread_pool.hpp"
+
+// test utils
+#include "tile_util.hpp"
+
+// std
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct decoded_feature
+{
+    std::uint64_t id;
+    std::string geometry;
+    std::map<std::string, std::string> attributes;
+
+    bool operator==(decoded_feature const& other) const
+    {
+        return id == other.id &&
+               geometry == other.geometry &&
+               attributes == other.attributes;
+    }
+};
+
+std::vector<decoded_feature> decode_features(vector_tile::Tile_Layer const& layer)
+{
+    std::vector<decoded_feature> result;
+    for (int i = 0; i < layer.features_size(); ++i)
+    {
+        vector_tile::Tile_Feature const& f = layer.features(i);
+        decoded_feature feature;
+        feature.id = f.id();
+        for (int j = 0; j < f.geometry_size(); ++j)
+        {
+            feature.geometry += std::to_string(f.geometry(j)) + ",";
+        }
+        feature.attributes = feature_attributes(layer, f);
+        result.push_back(feature);
+    }
+    return result;
+}
+
+} // end anonymous namespace
+
+TEST_CASE("feature processor - layer split into chunks")
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/layer_chunks_style.xml");
+
+    mapnik::vector_tile_impl::processor serial_ren(map);
+    mapnik::vector_tile_impl::tile expected_tile = serial_ren.create_tile(0, 0, 0, 4096, 0);
+    vector_tile::Tile expected;
+    REQUIRE(expected.ParseFromString(expected_tile.get_buffer()));
+    REQUIRE(1 == expected.layers_size());
+    REQUIRE(10 == expected.layers(0).features_size());
+
+    auto pool = std::make_shared<mapnik::vector_tile_impl::thread_pool>(3);
+    for (std::size_t chunk_size : { 1, 3, 4, 10, 100 })
+    {
+        mapnik::vector_tile_impl::processor ren(map);
+        ren.set_thread_pool(pool);
+        ren.set_layer_chunk_size(chunk_size);
+        CHECK(ren.get_layer_chunk_size() == chunk_size);
+        mapnik::vector_tile_impl::tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+
+        vector_tile::Tile result;
+        REQUIRE(result.ParseFromString(out_tile.get_buffer()));
+        REQUIRE(1 == result.layers_size());
+        vector_tile::Tile_Layer const& layer = result.layers(0);
+        CHECK(std::string("points") == layer.name());
+        CHECK(4096 == layer.extent());
+        CHECK(2 == layer.version());
+        CHECK(expected.layers(0).keys_size() == layer.keys_size());
+        CHECK(expected.layers(0).values_size() == layer.values_size());
+        CHECK(decode_features(expected.layers(0)) == decode_features(layer));
+    }
+}
+
+TEST_CASE("feature processor - layer split into chunks with a byte budget")
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/layer_chunks_style.xml");
+
+    auto pool = std::make_shared<mapnik::vector_tile_impl::thread_pool>(3);
+    for (auto priority : { mapnik::vector_tile_impl::BUDGET_FEATURE_ORDER,
+                           mapnik::vector_tile_impl::BUDGET_ATTRIBUTE })
+    {
+        mapnik::vector_tile_impl::byte_budget budget;
+        budget.layer_bytes = 120;
+        budget.priority = priority;
+        budget.attribute = "kind";
+
+        mapnik::vector_tile_impl::processor serial_ren(map);
+        serial_ren.set_byte_budget(budget);
+        mapnik::vector_tile_impl::tile expected_tile = serial_ren.create_tile(0, 0, 0, 4096, 0);
+        vector_tile::Tile expected;
+        REQUIRE(expected.ParseFromString(expected_tile.get_buffer()));
+        REQUIRE(1 == expected.layers_size());
+        REQUIRE(expected.layers(0).features_size() > 0);
+        REQUIRE(expected.layers(0).features_size() < 10);
+
+        // The budget applies to the whole layer, not to every chunk
+        for (std::size_t chunk_size : { 1, 3, 100 })
+        {
+            mapnik::vector_tile_impl::processor ren(map);
+            ren.set_byte_budget(budget);
+            ren.set_thread_pool(pool);
+            ren.set_layer_chunk_size(chunk_size);
+            mapnik::vector_tile_impl::tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+
+            vector_tile::Tile result;
+            REQUIRE(result.ParseFromString(out_tile.get_buffer()));
+            REQUIRE(1 == result.layers_size());
+            CHECK(result.layers(0).ByteSize() <= 120);
+            CHECK(decode_features(expected.layers(0)) == decode_features(result.layers(0)));
+        }
+    }
+}
+
+TEST_CASE("feature processor - reprojected layer split into chunks")
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/layer_chunks_style.xml");
+    // A projection that is not well known is transformed by proj4
+    map.get_layer(0).set_srs("+proj=longlat +ellps=bessel +no_defs");
+
+    mapnik::vector_tile_impl::processor serial_ren(map);
+    mapnik::vector_tile_impl::tile expected_tile = serial_ren.create_tile(0, 0, 0, 4096, 0);
+    vector_tile::Tile expected;
+    REQUIRE(expected.ParseFromString(expected_tile.get_buffer()));
+    REQUIRE(1 == expected.layers_size());
+    REQUIRE(10 == expected.layers(0).features_size());
+
+    auto pool = std::make_shared<mapnik::vector_tile_impl::thread_pool>(3);
+    mapnik::vector_tile_impl::processor ren(map);
+    ren.set_thread_pool(pool);
+    ren.set_layer_chunk_size(1);
+    for (int i = 0; i < 4; ++i)
+    {
+        mapnik::vector_tile_impl::tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+        CHECK(expected_tile.get_buffer() == out_tile.get_buffer());
+    }
+}
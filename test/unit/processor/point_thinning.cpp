@@ -0,0 +1,72 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// test utils
+#include "tile_util.hpp"
+
+// std
+#include <string>
+
+namespace {
+
+vector_tile::Tile_Layer encode_layer(mapnik::parameters const& params)
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/point_thinning_style.xml");
+    set_datasource_parameters(map.get_layer(0), params);
+    vector_tile::Tile tile = encode_tile(map);
+    REQUIRE(1 == tile.layers_size());
+    return tile.layers(0);
+}
+
+} // end anonymous namespace
+
+TEST_CASE("feature processor - point thinning")
+{
+    CHECK(6 == encode_layer(mapnik::parameters()).features_size());
+
+    mapnik::parameters params;
+    params["mvt_thin_grid"] = std::string("256");
+
+    SECTION("the first point of a cell is kept without priority")
+    {
+        vector_tile::Tile_Layer layer = encode_layer(params);
+        REQUIRE(3 == layer.features_size());
+        std::string names;
+        for (int i = 0; i < layer.features_size(); ++i)
+        {
+            vector_tile::Tile_Value const* name = find_value(layer, layer.features(i), "name");
+            REQUIRE(name);
+            names += name->string_value();
+            CHECK(!find_value(layer, layer.features(i), "count"));
+        }
+        CHECK("adf" == names);
+    }
+
+    SECTION("the point with the highest priority is kept and counts its cell")
+    {
+        params["mvt_thin_priority"] = std::string("rank");
+        params["mvt_thin_count"] = std::string("count");
+        vector_tile::Tile_Layer layer = encode_layer(params);
+        REQUIRE(3 == layer.features_size());
+        std::string names;
+        std::int64_t total = 0;
+        for (int i = 0; i < layer.features_size(); ++i)
+        {
+            vector_tile::Tile_Value const* name = find_value(layer, layer.features(i), "name");
+            vector_tile::Tile_Value const* count = find_value(layer, layer.features(i), "count");
+            REQUIRE(name);
+            REQUIRE(count);
+            names += name->string_value();
+            total += count->int_value();
+            if (name->string_value() == "b")
+            {
+                CHECK(3 == count->int_value());
+            }
+        }
+        CHECK("bdf" == names);
+        CHECK(6 == total);
+    }
+}
@@ -0,0 +1,66 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_processor.hpp"
+#include "vector_tile_projection_cache.hpp"
+
+// std
+#include <memory>
+#include <string>
+#include <thread>
+
+TEST_CASE("projection cache - interns projections")
+{
+    mapnik::vector_tile_impl::projection_cache cache;
+    auto merc_wgs84 = cache.get("+init=epsg:3857", "+init=epsg:4326");
+    REQUIRE(merc_wgs84);
+    CHECK(merc_wgs84->thread_safe());
+    CHECK(!merc_wgs84->transform.equal());
+    CHECK(merc_wgs84 == cache.get("+init=epsg:3857", "+init=epsg:4326"));
+    CHECK(1 == cache.size());
+
+    auto merc_merc = cache.get("+init=epsg:3857", "+init=epsg:3857");
+    CHECK(merc_merc != merc_wgs84);
+    CHECK(merc_merc->transform.equal());
+    CHECK(2 == cache.size());
+
+    // Well known transformations are shared between threads
+    mapnik::vector_tile_impl::layer_projections_ptr other_thread;
+    std::thread t([&]() { other_thread = cache.get("+init=epsg:3857", "+init=epsg:4326"); });
+    t.join();
+    CHECK(other_thread == merc_wgs84);
+
+    // Transformations relying on proj4 are never shared
+    auto merc_bessel = cache.get("+init=epsg:3857", "+proj=longlat +ellps=bessel +no_defs");
+    REQUIRE(merc_bessel);
+    CHECK(!merc_bessel->thread_safe());
+    CHECK(merc_bessel != cache.get("+init=epsg:3857", "+proj=longlat +ellps=bessel +no_defs"));
+    CHECK(2 == cache.size());
+
+    cache.clear();
+    CHECK(0 == cache.size());
+}
+
+TEST_CASE("feature processor - projection cache shared by processors")
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/points_style.xml");
+
+    mapnik::vector_tile_impl::processor uncached(map);
+    CHECK(!uncached.get_projection_cache());
+    mapnik::vector_tile_impl::tile expected = uncached.create_tile(0, 0, 0, 4096, 0);
+
+    auto cache = std::make_shared<mapnik::vector_tile_impl::projection_cache>();
+    for (int i = 0; i < 3; ++i)
+    {
+        mapnik::vector_tile_impl::processor ren(map);
+        ren.set_projection_cache(cache);
+        CHECK(ren.get_projection_cache() == cache);
+        mapnik::vector_tile_impl::tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+        CHECK(expected.get_buffer() == out_tile.get_buffer());
+        CHECK(1 == cache->size());
+    }
+}
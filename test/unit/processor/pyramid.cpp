@@ -0,0 +1,137 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/feature_factory.hpp>
+#include <mapnik/load_map.hpp>
+#include <mapnik/memory_datasource.hpp>
+#include <mapnik/unicode.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_processor.hpp"
+
+// std
+#include <atomic>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+using tile_id = std::tuple<std::uint64_t, std::uint64_t, std::uint64_t>;
+
+class counting_datasource : public mapnik::memory_datasource
+{
+public:
+    mutable std::atomic<int> queries;
+
+    explicit counting_datasource(double scale)
+        : mapnik::memory_datasource(mapnik::parameters()),
+          queries(0)
+    {
+        mapnik::transcoder tr("utf-8");
+        mapnik::context_ptr ctx = std::make_shared<mapnik::context_type>();
+        ctx->push("name");
+        int id = 1;
+        for (int i = -4; i < 4; ++i)
+        {
+            mapnik::feature_ptr point(mapnik::feature_factory::create(ctx, id++));
+            point->put("name", tr.transcode(std::to_string(i).c_str()));
+            point->set_geometry(mapnik::geometry::point<double>(i * 20.0 * scale + 1.0, i * 9.0 * scale + 1.0));
+            push(point);
+
+            mapnik::feature_ptr line(mapnik::feature_factory::create(ctx, id++));
+            line->put("name", tr.transcode(("line" + std::to_string(i)).c_str()));
+            mapnik::geometry::line_string<double> ls;
+            ls.add_coord(i * 20.0 * scale, -60.0 * scale);
+            ls.add_coord(i * 20.0 * scale + 3.0 * scale, 60.0 * scale);
+            line->set_geometry(std::move(ls));
+            push(line);
+        }
+    }
+
+    mapnik::featureset_ptr features(mapnik::query const& q) const override
+    {
+        ++queries;
+        return mapnik::memory_datasource::features(q);
+    }
+};
+
+const std::string style(R"xxx(
+    <Map srs="+init=epsg:3857">
+        <Layer name="geographic" srs="+init=epsg:4326">
+        </Layer>
+        <Layer name="mercator" srs="+init=epsg:3857">
+        </Layer>
+    </Map>)xxx");
+
+} // end anonymous namespace
+
+TEST_CASE("feature processor - pyramid of tiles")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::Map map(256, 256);
+    mapnik::load_map_string(map, style);
+    auto geographic = std::make_shared<counting_datasource>(1.0);
+    auto mercator = std::make_shared<counting_datasource>(100000.0);
+    map.get_layer(0).set_datasource(geographic);
+    map.get_layer(1).set_datasource(mercator);
+
+    processor ren(map);
+    std::vector<tile_id> order;
+    std::vector<merc_tile> tiles;
+    bool complete = ren.create_pyramid(1, 1, 1, 2, [&](merc_tile & t)
+    {
+        order.emplace_back(t.z(), t.x(), t.y());
+        tiles.push_back(std::move(t));
+    }, 4096, 64);
+    CHECK(complete);
+
+    CHECK(1 == geographic->queries);
+    CHECK(1 == mercator->queries);
+    REQUIRE(21 == tiles.size());
+    CHECK(tile_id(1, 1, 1) == order[0]);
+    CHECK(tile_id(2, 2, 2) == order[1]);
+    CHECK(tile_id(3, 4, 4) == order[2]);
+
+    // Every tile is the same as the tile created on its own, including the
+    // tiles of the layer reprojected from geographic coordinates
+    std::size_t painted = 0;
+    for (auto const& t : tiles)
+    {
+        CHECK(!t.is_partial());
+        merc_tile expected = ren.create_tile(t.x(), t.y(), t.z(), 4096, 64);
+        INFO(t.z() << "/" << t.x() << "/" << t.y());
+        CHECK(expected.get_buffer() == t.get_buffer());
+        CHECK(expected.get_empty_layers() == t.get_empty_layers());
+        if (!t.is_empty())
+        {
+            ++painted;
+        }
+    }
+    CHECK(painted > 1);
+}
+
+TEST_CASE("feature processor - cancelled pyramid")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::Map map(256, 256);
+    mapnik::load_map_string(map, style);
+    map.get_layer(0).set_datasource(std::make_shared<counting_datasource>(1.0));
+    map.get_layer(1).set_datasource(std::make_shared<counting_datasource>(100000.0));
+
+    processor ren(map);
+    auto token = std::make_shared<cancellation_token>();
+    ren.set_cancellation_token(token);
+    std::size_t count = 0;
+    bool complete = ren.create_pyramid(0, 0, 0, 3, [&](merc_tile &)
+    {
+        ++count;
+        token->cancel();
+    });
+    // The caller is told the pyramid is incomplete
+    CHECK(!complete);
+    CHECK(1 == count);
+}
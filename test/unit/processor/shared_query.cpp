@@ -0,0 +1,123 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/feature_factory.hpp>
+#include <mapnik/load_map.hpp>
+#include <mapnik/memory_datasource.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_processor.hpp"
+
+// libprotobuf
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#include "vector_tile.pb.h"
+#pragma GCC diagnostic pop
+
+// std
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+class counting_datasource : public mapnik::memory_datasource
+{
+public:
+    mutable std::atomic<int> queries;
+
+    counting_datasource()
+        : mapnik::memory_datasource(mapnik::parameters()),
+          queries(0)
+    {
+        mapnik::context_ptr ctx = std::make_shared<mapnik::context_type>();
+        ctx->push("kind");
+        for (int i = 0; i < 4; ++i)
+        {
+            mapnik::feature_ptr feature(mapnik::feature_factory::create(ctx, i + 1));
+            feature->put("kind", static_cast<mapnik::value_integer>(i % 2 + 1));
+            feature->set_geometry(mapnik::geometry::point<double>(i, i));
+            push(feature);
+        }
+    }
+
+    mapnik::featureset_ptr features(mapnik::query const& q) const override
+    {
+        ++queries;
+        return mapnik::memory_datasource::features(q);
+    }
+};
+
+const std::string style(R"xxx(
+    <Map srs="+init=epsg:3857">
+        <Style name="ones">
+            <Rule>
+                <Filter>[kind] = 1</Filter>
+                <PointSymbolizer />
+            </Rule>
+        </Style>
+        <Style name="all">
+            <Rule>
+                <PointSymbolizer />
+            </Rule>
+        </Style>
+        <Layer name="a" srs="+init=epsg:4326">
+            <StyleName>ones</StyleName>
+        </Layer>
+        <Layer name="b" srs="+init=epsg:4326">
+            <StyleName>all</StyleName>
+        </Layer>
+        <Layer name="c" srs="+init=epsg:4326">
+            <StyleName>ones</StyleName>
+        </Layer>
+    </Map>)xxx");
+
+} // end anonymous namespace
+
+TEST_CASE("feature processor - layers sharing a datasource query it once")
+{
+    mapnik::Map separate_map(256, 256);
+    mapnik::load_map_string(separate_map, style);
+    std::vector<std::shared_ptr<counting_datasource>> separate_ds;
+    for (std::size_t i = 0; i < separate_map.layer_count(); ++i)
+    {
+        separate_ds.push_back(std::make_shared<counting_datasource>());
+        separate_map.get_layer(i).set_datasource(separate_ds.back());
+    }
+    mapnik::vector_tile_impl::processor separate_ren(separate_map);
+    mapnik::vector_tile_impl::tile expected = separate_ren.create_tile(0, 0, 0, 4096, 0, 0.0, 0, 0, true);
+    for (auto const& ds : separate_ds)
+    {
+        CHECK(1 == ds->queries);
+    }
+
+    mapnik::Map map(256, 256);
+    mapnik::load_map_string(map, style);
+    auto ds = std::make_shared<counting_datasource>();
+    for (std::size_t i = 0; i < map.layer_count(); ++i)
+    {
+        map.get_layer(i).set_datasource(ds);
+    }
+
+    for (auto mode : { std::launch::deferred, std::launch::async })
+    {
+        ds->queries = 0;
+        mapnik::vector_tile_impl::processor ren(map);
+        ren.set_threading_mode(mode);
+        mapnik::vector_tile_impl::tile out_tile = ren.create_tile(0, 0, 0, 4096, 0, 0.0, 0, 0, true);
+        CHECK(1 == ds->queries);
+        CHECK(expected.get_buffer() == out_tile.get_buffer());
+
+        vector_tile::Tile tile;
+        REQUIRE(tile.ParseFromString(out_tile.get_buffer()));
+        REQUIRE(3 == tile.layers_size());
+        CHECK(std::string("a") == tile.layers(0).name());
+        CHECK(2 == tile.layers(0).features_size());
+        CHECK(std::string("b") == tile.layers(1).name());
+        CHECK(4 == tile.layers(1).features_size());
+        CHECK(std::string("c") == tile.layers(2).name());
+        CHECK(2 == tile.layers(2).features_size());
+    }
+}
@@ -0,0 +1,169 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_processor.hpp"
+#include "vector_tile_stats.hpp"
+#include "vector_tile_thread_pool.hpp"
+
+// test utils
+#include "tile_util.hpp"
+
+// std
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+void check_stats(mapnik::vector_tile_impl::tile_stats const& stats)
+{
+    using namespace mapnik::vector_tile_impl;
+
+    REQUIRE(2 == stats.layers().size());
+
+    layer_stats const* points = stats.find("points");
+    REQUIRE(points != nullptr);
+    CHECK(std::string("points") == points->name);
+    CHECK(5 == points->features_read);
+    CHECK(0 == points->features_filtered);
+    CHECK(4 == points->features_encoded);
+    CHECK(1 == points->features_clipped);
+    CHECK(5 == points->stage(STAGE_TRANSFORM).vertices_in);
+    CHECK(4 == points->stage(STAGE_CLIP).vertices_in);
+    CHECK(4 == points->stage(STAGE_ENCODE).vertices_in);
+    CHECK(4 == points->stage(STAGE_ENCODE).vertices_out);
+
+    layer_stats const* lines = stats.find("lines");
+    REQUIRE(lines != nullptr);
+    CHECK(2 == lines->features_read);
+    CHECK(2 == lines->features_encoded);
+    CHECK(6 == lines->stage(STAGE_TRANSFORM).vertices_in);
+    CHECK(6 == lines->stage(STAGE_UNIQUE).vertices_in);
+    CHECK(5 == lines->stage(STAGE_UNIQUE).vertices_out);
+    CHECK(0 == lines->stage(STAGE_SIMPLIFY).vertices_in);
+    CHECK(lines->total_time().count() > 0);
+
+    CHECK(nullptr == stats.find("missing"));
+}
+
+} // end anonymous namespace
+
+TEST_CASE("feature processor - pipeline statistics")
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/stats_style.xml");
+
+    mapnik::vector_tile_impl::processor ren(map);
+    CHECK(nullptr == ren.get_stats());
+    mapnik::vector_tile_impl::tile expected = ren.create_tile(0, 0, 0, 4096, 0);
+
+    mapnik::vector_tile_impl::tile_stats stats;
+    ren.set_stats(&stats);
+    CHECK(&stats == ren.get_stats());
+
+    // Collecting statistics does not change the output
+    mapnik::vector_tile_impl::tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+    CHECK(expected.get_buffer() == out_tile.get_buffer());
+    check_stats(stats);
+
+    // Statistics are replaced by every tile
+    ren.create_tile(0, 0, 0, 4096, 0);
+    check_stats(stats);
+}
+
+TEST_CASE("feature processor - pipeline statistics with a thread pool")
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/stats_style.xml");
+
+    auto pool = std::make_shared<mapnik::vector_tile_impl::thread_pool>(2);
+    mapnik::vector_tile_impl::tile_stats stats;
+    mapnik::vector_tile_impl::processor ren(map);
+    ren.set_thread_pool(pool);
+    ren.set_layer_chunk_size(2);
+    ren.set_stats(&stats);
+    ren.create_tile(0, 0, 0, 4096, 0);
+    check_stats(stats);
+}
+
+TEST_CASE("feature processor - slow feature reports")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/stats_style.xml");
+
+    processor ren(map);
+    CHECK(!ren.get_slow_feature_detector());
+    std::vector<slow_feature> reports;
+    ren.set_slow_feature_callback([&reports](slow_feature const& report)
+    {
+        reports.push_back(report);
+    }, std::chrono::nanoseconds(0));
+    CHECK(static_cast<bool>(ren.get_slow_feature_detector()));
+
+    // Every feature is slower than a zero threshold
+    ren.create_tile(0, 0, 0, 4096, 0);
+    REQUIRE(7 == reports.size());
+    std::size_t lines = 0;
+    for (auto const& report : reports)
+    {
+        CHECK(report.total_time >= report.slow_stage_time);
+        CHECK(report.slow_stage >= STAGE_TRANSFORM);
+        CHECK(report.slow_stage <= STAGE_ENCODE);
+        if (report.layer_name == "lines")
+        {
+            ++lines;
+            CHECK(3 == report.vertices_in);
+            CHECK(report.vertices_out >= 2);
+        }
+        else
+        {
+            CHECK(std::string("points") == report.layer_name);
+            CHECK(1 == report.vertices_in);
+        }
+    }
+    CHECK(2 == lines);
+
+    reports.clear();
+    ren.set_slow_feature_callback([&reports](slow_feature const& report)
+    {
+        reports.push_back(report);
+    }, std::chrono::hours(1));
+    ren.create_tile(0, 0, 0, 4096, 0);
+    CHECK(reports.empty());
+    CHECK(std::string("clip") == stage_name(STAGE_CLIP));
+}
+
+TEST_CASE("feature processor - pipeline statistics with point thinning")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/stats_style.xml");
+    mapnik::parameters params;
+    params["mvt_thin_grid"] = std::string("256");
+    set_datasource_parameters(map.get_layer(0), params);
+
+    tile_stats stats;
+    processor ren(map);
+    ren.set_stats(&stats);
+    ren.create_tile(0, 0, 0, 4096, 0);
+
+    // The four points in the tile share a cell, every feature is counted once
+    layer_stats const* points = stats.find("points");
+    REQUIRE(points != nullptr);
+    CHECK(5 == points->features_read);
+    CHECK(1 == points->features_encoded);
+    CHECK(3 == points->features_thinned);
+    CHECK(1 == points->features_clipped);
+    CHECK(points->features_read == points->features_filtered +
+                                   points->features_below_area_threshold +
+                                   points->features_clipped +
+                                   points->features_encoded +
+                                   points->features_thinned);
+}
@@ -0,0 +1,242 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/expression.hpp>
+#include <mapnik/expression_evaluator.hpp>
+#include <mapnik/feature_factory.hpp>
+#include <mapnik/feature_type_style.hpp>
+#include <mapnik/layer_descriptor.hpp>
+#include <mapnik/load_map.hpp>
+#include <mapnik/memory_datasource.hpp>
+#include <mapnik/rule.hpp>
+#include <mapnik/rule_cache.hpp>
+#include <mapnik/unicode.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_layer.hpp"
+#include "vector_tile_processor.hpp"
+#include "vector_tile_style_filter.hpp"
+
+// std
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<mapnik::rule_cache> make_rules(mapnik::rule const& rule)
+{
+    std::vector<mapnik::rule_cache> rules;
+    rules.emplace_back();
+    rules.back().add_rule(rule);
+    return rules;
+}
+
+// A datasource typing its name column
+class typed_datasource : public mapnik::memory_datasource
+{
+public:
+    explicit typed_datasource(mapnik::parameters const& params)
+        : mapnik::memory_datasource(params) {}
+
+    mapnik::layer_descriptor get_descriptor() const override
+    {
+        mapnik::layer_descriptor desc("typed", "utf-8");
+        desc.add_descriptor(mapnik::attribute_descriptor("name", mapnik::String));
+        return desc;
+    }
+};
+
+} // end anonymous namespace
+
+TEST_CASE("style filter - same result as mapnik")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::transcoder tr("utf-8");
+    mapnik::context_ptr ctx = std::make_shared<mapnik::context_type>();
+    ctx->push("name");
+    ctx->push("height");
+    std::vector<mapnik::feature_ptr> features;
+    for (int i = 0; i < 6; ++i)
+    {
+        mapnik::feature_ptr feature(mapnik::feature_factory::create(ctx, i + 1));
+        feature->put("name", tr.transcode(i % 2 ? "road" : "path"));
+        feature->put("height", static_cast<mapnik::value_integer>(i));
+        features.push_back(feature);
+    }
+    // A context growing after the first features
+    features.back()->put_new("width", 2.5);
+
+    std::vector<std::string> const filters {
+        "[name] = 'road'",
+        "[name] != 'road' and [height] >= 2",
+        "not ([height] < 3) or [name] = 'none'",
+        "[height] <= 1 or [height] > 4",
+        "[width] > 2",
+        "[missing] = null",
+        "[height] + 1 = 3",
+        "[name].match('r.*')"
+    };
+    mapnik::attributes vars;
+    for (auto const& text : filters)
+    {
+        INFO(text);
+        mapnik::rule rule;
+        rule.set_filter(mapnik::parse_expression(text));
+        style_filter filter(make_rules(rule));
+        CHECK(!filter.accepts_all());
+        CHECK(!filter.rejects_all());
+        style_filter_evaluator evaluator(filter);
+        for (auto const& feature : features)
+        {
+            mapnik::value expected = mapnik::util::apply_visitor(
+                mapnik::evaluate<mapnik::feature_impl, mapnik::value, mapnik::attributes>(*feature, vars),
+                *rule.get_filter());
+            CHECK(expected.to_bool() == evaluator(*feature));
+        }
+    }
+}
+
+TEST_CASE("style filter - rules accepting every feature")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::rule filtered;
+    filtered.set_filter(mapnik::parse_expression("[name] = 'road'"));
+    mapnik::rule unfiltered;
+    mapnik::rule other;
+    other.set_else(true);
+
+    CHECK(style_filter(make_rules(unfiltered)).accepts_all());
+
+    std::vector<mapnik::rule_cache> rules(make_rules(filtered));
+    rules.back().add_rule(other);
+    CHECK(style_filter(rules).accepts_all());
+
+    CHECK(!style_filter(make_rules(filtered)).accepts_all());
+    CHECK(style_filter(std::vector<mapnik::rule_cache>()).rejects_all());
+}
+
+TEST_CASE("style filter - SQL predicate")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::layer_descriptor desc("test", "utf-8");
+    desc.add_descriptor(mapnik::attribute_descriptor("name", mapnik::String));
+    desc.add_descriptor(mapnik::attribute_descriptor("kind", mapnik::String));
+    desc.add_descriptor(mapnik::attribute_descriptor("height", mapnik::Integer));
+    desc.add_descriptor(mapnik::attribute_descriptor("width", mapnik::Double));
+
+    auto predicate = [&](std::string const& text)
+    {
+        mapnik::rule rule;
+        rule.set_filter(mapnik::parse_expression(text));
+        return style_filter(make_rules(rule)).predicate(desc);
+    };
+
+    CHECK(R"(COALESCE("name" = 'road', FALSE))" == predicate("[name] = 'road'"));
+    CHECK(R"((COALESCE("kind" <> 'path', TRUE) AND COALESCE("height" >= 2, FALSE)))"
+          == predicate("[kind] != 'path' and [height] >= 2"));
+    CHECK(R"(((NOT ("name" IS NULL)) OR COALESCE("width" < 2.5, FALSE)))"
+          == predicate("not ([name] = null) or [width] < 2.5"));
+    // Expressions that are not translated select every feature
+    CHECK("TRUE" == predicate("[name] > 'road'"));
+    CHECK("TRUE" == predicate("[height] + 1 = 3"));
+    CHECK("TRUE" == predicate("[name].match('r.*')"));
+    // Values of different types are not compared
+    CHECK("TRUE" == predicate("[name] = 1"));
+    CHECK("TRUE" == predicate("[name] != 2.5"));
+    CHECK("TRUE" == predicate("[height] = '2'"));
+    CHECK("TRUE" == predicate("[name] = [height]"));
+    CHECK(R"(COALESCE("height" = "width", FALSE))" == predicate("[height] = [width]"));
+    // Nor attributes of unknown types
+    CHECK("TRUE" == predicate("[color] = 'red'"));
+    CHECK(R"(("color" IS NULL))" == predicate("[color] = null"));
+
+    mapnik::rule first;
+    first.set_filter(mapnik::parse_expression("[name] = 'road'"));
+    mapnik::rule second;
+    second.set_filter(mapnik::parse_expression("[height] > 1"));
+    std::vector<mapnik::rule_cache> rules(make_rules(first));
+    rules.back().add_rule(second);
+    CHECK(R"((COALESCE("name" = 'road', FALSE) OR COALESCE("height" > 1, FALSE)))"
+          == style_filter(rules).predicate(desc));
+
+    CHECK("TRUE" == style_filter(make_rules(mapnik::rule())).predicate(desc));
+    CHECK("FALSE" == style_filter(std::vector<mapnik::rule_cache>()).predicate(desc));
+}
+
+TEST_CASE("style filter - pushed down into the query")
+{
+    mapnik::Map map(256, 256);
+    mapnik::feature_type_style style;
+    mapnik::rule rule;
+    rule.set_filter(mapnik::parse_expression("[name] = 'road'"));
+    style.add_rule(std::move(rule));
+    map.insert_style("style", std::move(style));
+
+    mapnik::parameters params;
+    params["type"] = "memory";
+    params["mvt_filter_pushdown"] = "true";
+    auto ds = std::make_shared<typed_datasource>(params);
+    mapnik::layer layer("layer", "+init=epsg:3857");
+    layer.set_datasource(ds);
+    layer.add_style("style");
+
+    mapnik::box2d<double> extent(-20037508.342789,-20037508.342789,20037508.342789,20037508.342789);
+    mapnik::vector_tile_impl::tile tile(extent, 256, 10);
+    const mapnik::attributes vars { {"zoom_level", 20} };
+
+    mapnik::vector_tile_impl::tile_layer filtered(map, layer, tile, 1.0, 0, 0, 0, true, 0, vars);
+    REQUIRE(filtered.get_query());
+    mapnik::attributes const& query_vars = filtered.get_query()->variables();
+    CHECK(2 == query_vars.size());
+    REQUIRE(query_vars.count("mvt_filter") == 1);
+    CHECK(R"(COALESCE("name" = 'road', FALSE))" == query_vars.at("mvt_filter").to_string());
+
+    mapnik::vector_tile_impl::tile_layer unfiltered(map, layer, tile, 1.0, 0, 0, 0, false, 0, vars);
+    REQUIRE(unfiltered.get_query());
+    CHECK("TRUE" == unfiltered.get_query()->variables().at("mvt_filter").to_string());
+    CHECK(!filtered.shares_query(unfiltered));
+}
+
+TEST_CASE("feature processor - style filters compiled once per scale denominator")
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/rule_level_filter_style.xml");
+    mapnik::vector_tile_impl::processor ren(map);
+    CHECK(!ren.get_style_filter_cache());
+
+    const bool style_level_filter = true;
+    mapnik::vector_tile_impl::tile expected = ren.create_tile(
+        2048, 2047, 12, 4096, 0, -1, 0, 0, style_level_filter);
+
+    auto cache = std::make_shared<mapnik::vector_tile_impl::style_filter_cache>();
+    ren.set_style_filter_cache(cache);
+    mapnik::vector_tile_impl::tile cached_tile = ren.create_tile(
+        2048, 2047, 12, 4096, 0, -1, 0, 0, style_level_filter);
+    CHECK(2 == cache->size());
+    mapnik::vector_tile_impl::tile out_tile = ren.create_tile(
+        2048, 2047, 12, 4096, 0, -1, 0, 0, style_level_filter);
+    CHECK(2 == cache->size());
+    CHECK(expected.get_buffer() == cached_tile.get_buffer());
+    CHECK(expected.get_buffer() == out_tile.get_buffer());
+
+    // Filters are found by layer name and styles, not by layer address
+    mapnik::Map copy(map);
+    mapnik::vector_tile_impl::processor other(copy);
+    other.set_style_filter_cache(cache);
+    mapnik::vector_tile_impl::tile copy_tile = other.create_tile(
+        2048, 2047, 12, 4096, 0, -1, 0, 0, style_level_filter);
+    CHECK(2 == cache->size());
+    CHECK(expected.get_buffer() == copy_tile.get_buffer());
+
+    // A full cache is emptied before new filters are added
+    auto small_cache = std::make_shared<mapnik::vector_tile_impl::style_filter_cache>(1);
+    ren.set_style_filter_cache(small_cache);
+    mapnik::vector_tile_impl::tile bounded_tile = ren.create_tile(
+        2048, 2047, 12, 4096, 0, -1, 0, 0, style_level_filter);
+    CHECK(1 == small_cache->size());
+    CHECK(expected.get_buffer() == bounded_tile.get_buffer());
+}
@@ -0,0 +1,112 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_processor.hpp"
+#include "vector_tile_thread_pool.hpp"
+
+// libprotobuf
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#include "vector_tile.pb.h"
+#pragma GCC diagnostic pop
+
+// std
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST_CASE("thread pool - nested tasks")
+{
+    mapnik::vector_tile_impl::thread_pool pool(2);
+    CHECK(pool.size() == 2);
+
+    std::vector<std::future<int>> futures;
+    for (int i = 0; i < 16; ++i)
+    {
+        futures.push_back(pool.submit([&pool, i]()
+        {
+            std::vector<std::future<int>> subtasks;
+            for (int j = 0; j < 4; ++j)
+            {
+                subtasks.push_back(pool.submit([i, j]() { return i * j; }));
+            }
+            int sum = 0;
+            for (auto & f : subtasks)
+            {
+                sum += pool.wait(f);
+            }
+            return sum;
+        }));
+    }
+
+    int total = 0;
+    for (auto & f : futures)
+    {
+        total += pool.wait(f);
+    }
+    CHECK(total == 120 * 6);
+}
+
+TEST_CASE("thread pool - waiting runs only the tasks of the waiting thread")
+{
+    mapnik::vector_tile_impl::thread_pool pool(1);
+
+    // Keeps the only worker busy
+    std::promise<void> started;
+    std::promise<void> gate;
+    std::shared_future<void> gate_future(gate.get_future());
+    std::future<void> blocker = pool.submit([&started, gate_future]()
+    {
+        started.set_value();
+        gate_future.wait();
+    });
+    started.get_future().wait();
+
+    // A task of another thread
+    std::future<std::thread::id> other;
+    std::thread submitter([&pool, &other]()
+    {
+        other = pool.submit([]() { return std::this_thread::get_id(); });
+    });
+    submitter.join();
+
+    std::future<std::thread::id> own = pool.submit([]() { return std::this_thread::get_id(); });
+    CHECK(pool.wait(own) == std::this_thread::get_id());
+    CHECK(other.wait_for(std::chrono::seconds(0)) != std::future_status::ready);
+
+    // The waiting thread sleeps until the worker ran the task
+    gate.set_value();
+    CHECK(pool.wait(other) != std::this_thread::get_id());
+    pool.wait(blocker);
+}
+
+TEST_CASE("feature processor - layers processed by a shared thread pool")
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/style_level_filter_style.xml");
+
+    mapnik::vector_tile_impl::processor serial_ren(map);
+    mapnik::vector_tile_impl::tile expected = serial_ren.create_tile(2048, 2047, 12, 4096, 0);
+
+    auto pool = std::make_shared<mapnik::vector_tile_impl::thread_pool>(2);
+    for (int i = 0; i < 4; ++i)
+    {
+        mapnik::vector_tile_impl::processor ren(map);
+        ren.set_thread_pool(pool);
+        CHECK(ren.get_thread_pool() == pool);
+        mapnik::vector_tile_impl::tile out_tile = ren.create_tile(2048, 2047, 12, 4096, 0);
+        CHECK(out_tile.get_buffer() == expected.get_buffer());
+
+        vector_tile::Tile tile;
+        REQUIRE(tile.ParseFromString(out_tile.get_buffer()));
+        REQUIRE(2 == tile.layers_size());
+        CHECK(std::string("L1") == tile.layers(0).name());
+        CHECK(std::string("L2") == tile.layers(1).name());
+    }
+}
@@ -0,0 +1,75 @@
+#include "catch.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>
+
+// mapnik-vector-tile
+#include "vector_tile_processor.hpp"
+#include "vector_tile_thread_pool.hpp"
+#include "vector_tile_value_cache.hpp"
+
+// std
+#include <memory>
+#include <string>
+
+TEST_CASE("feature processor - value cache")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/points_style.xml");
+
+    processor ren(map);
+    CHECK(!ren.get_value_cache());
+    merc_tile expected = ren.create_tile(0, 0, 0, 4096, 0);
+    merc_tile expected_child = ren.create_tile(1, 1, 1, 4096, 0);
+
+    auto cache = std::make_shared<value_cache>();
+    ren.set_value_cache(cache);
+    CHECK(cache == ren.get_value_cache());
+
+    // Values are the same whether they are encoded or found in the cache
+    merc_tile out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+    CHECK(expected.get_buffer() == out_tile.get_buffer());
+    std::size_t const size = cache->size();
+    CHECK(size > 0);
+
+    out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+    CHECK(expected.get_buffer() == out_tile.get_buffer());
+    CHECK(size == cache->size());
+
+    merc_tile child = ren.create_tile(1, 1, 1, 4096, 0);
+    CHECK(expected_child.get_buffer() == child.get_buffer());
+    CHECK(size == cache->size());
+
+    // Layers encoded by several threads at once share the cache
+    auto pool = std::make_shared<thread_pool>(2);
+    ren.set_thread_pool(pool);
+    ren.set_layer_chunk_size(1);
+    for (int i = 0; i < 4; ++i)
+    {
+        out_tile = ren.create_tile(0, 0, 0, 4096, 0);
+        CHECK(expected.get_buffer() == out_tile.get_buffer());
+    }
+
+    cache->clear();
+    CHECK(0 == cache->size());
+}
+
+TEST_CASE("value cache stops growing once full")
+{
+    using namespace mapnik::vector_tile_impl;
+
+    value_cache cache(16);
+    for (int i = 0; i < 1000; ++i)
+    {
+        cache.insert(mapnik::value(static_cast<mapnik::value_integer>(i)), std::string("x"));
+    }
+    CHECK(cache.size() <= 16);
+    CHECK(cache.size() > 0);
+
+    std::string buffer;
+    protozero::pbf_writer writer(buffer);
+    CHECK(!cache.add_value(writer, 4, mapnik::value(static_cast<mapnik::value_integer>(-1))));
+    CHECK(buffer.empty());
+}
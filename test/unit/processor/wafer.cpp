@@ -9,6 +9,7 @@
 // test utils
 #include "decoding_util.hpp"
 #include "test_utils.hpp"
+#include "tile_util.hpp"
 
 // libprotobuf
 #pragma GCC diagnostic push
@@ -18,7 +19,10 @@
 #pragma GCC diagnostic pop
 
 // std
+#include <cstdlib>
+#include <memory>
 #include <set>
+#include <vector>
 
 TEST_CASE("vector wafer output - polygon")
 {
@@ -653,3 +657,239 @@ TEST_CASE("vector wafer output - layer buffer size")
     CHECK(g[2].y == Approx(5120.0));
 }
 
+
+TEST_CASE("vector wafer output - points on sub-tile corners")
+{
+    const std::string style(R"xxx(
+        <Map srs="+init=epsg:3857">
+            <Layer name="points" srs="+init=epsg:3857">
+                <Datasource>
+                    <Parameter name="type">csv</Parameter>
+                    <Parameter name="inline">
+                        x, y
+                        0, 0
+                        -12523442.714243, 12523442.714243
+                    </Parameter>
+                </Datasource>
+            </Layer>
+        </Map>)xxx");
+
+    mapnik::Map map(256, 256);
+    mapnik::load_map_string(map, style);
+
+    mapnik::vector_tile_impl::processor ren(map);
+
+    mapnik::vector_tile_impl::merc_wafer wafer = ren.create_wafer(0, 0, 3, 8, 4096, 64);
+    REQUIRE(wafer.tiles().size() == 64);
+
+    // The point at the center of the wafer is within the buffer of the
+    // four sub-tiles around it, the other one is within a single sub-tile
+    const std::set<std::size_t> non_empty_tile_indices {
+        1 * 8 + 1,
+        3 * 8 + 3, 3 * 8 + 4,
+        4 * 8 + 3, 4 * 8 + 4 };
+    std::size_t index = 0;
+    for (auto const & tile : wafer.tiles())
+    {
+        INFO(index);
+        if (non_empty_tile_indices.count(index))
+        {
+            REQUIRE(tile.has_layer("points") == true);
+            vector_tile::Tile mvt;
+            mvt.ParseFromString(tile.get_buffer());
+            REQUIRE(1 == mvt.layers_size());
+            REQUIRE(1 == mvt.layers(0).features_size());
+            vector_tile::Tile_Feature const& feature = mvt.layers(0).features(0);
+            REQUIRE(3 == feature.geometry_size());
+            const std::int32_t x = protozero::decode_zigzag32(feature.geometry(1));
+            const std::int32_t y = protozero::decode_zigzag32(feature.geometry(2));
+            if (index == 1 * 8 + 1)
+            {
+                CHECK(std::abs(x - 2048) <= 1);
+                CHECK(std::abs(y - 2048) <= 1);
+            }
+            else
+            {
+                CHECK((std::abs(x) <= 1 || std::abs(x - 4096) <= 1));
+                CHECK((std::abs(y) <= 1 || std::abs(y - 4096) <= 1));
+            }
+        }
+        else
+        {
+            CHECK(tile.has_layer("points") == false);
+        }
+        ++index;
+    }
+}
+
+TEST_CASE("vector wafer output - quadtree clipping")
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/wafer_shapes_style.xml");
+
+    mapnik::vector_tile_impl::processor ren(map);
+    CHECK(!ren.get_wafer_quadtree_clipping());
+    mapnik::vector_tile_impl::merc_wafer expected = ren.create_wafer(0, 0, 3, 8, 4096, 64);
+    CHECK(!expected.quadtree_clipping());
+
+    ren.set_wafer_quadtree_clipping(true);
+    CHECK(ren.get_wafer_quadtree_clipping());
+    mapnik::vector_tile_impl::merc_wafer wafer = ren.create_wafer(0, 0, 3, 8, 4096, 64);
+    CHECK(wafer.quadtree_clipping());
+    REQUIRE(expected.tiles().size() == wafer.tiles().size());
+
+    // The geometries of every sub-tile are the same but for the rounding of
+    // the points where they leave a quadrant
+    for (std::size_t i = 0; i < wafer.tiles().size(); ++i)
+    {
+        INFO(i);
+        CHECK(expected.tiles()[i].has_layer("shapes") == wafer.tiles()[i].has_layer("shapes"));
+        vector_tile::Tile expected_mvt;
+        vector_tile::Tile mvt;
+        expected_mvt.ParseFromString(expected.tiles()[i].get_buffer());
+        mvt.ParseFromString(wafer.tiles()[i].get_buffer());
+        REQUIRE(expected_mvt.layers_size() == mvt.layers_size());
+        if (mvt.layers_size() == 0)
+        {
+            continue;
+        }
+        vector_tile::Tile_Layer const& expected_layer = expected_mvt.layers(0);
+        vector_tile::Tile_Layer const& layer = mvt.layers(0);
+        REQUIRE(expected_layer.features_size() == layer.features_size());
+        for (int j = 0; j < layer.features_size(); ++j)
+        {
+            CHECK(expected_layer.features(j).type() == layer.features(j).type());
+            auto expected_bbox = geometry_bbox(expected_layer.features(j));
+            auto bbox = geometry_bbox(layer.features(j));
+            for (std::size_t k = 0; k < 4; ++k)
+            {
+                CHECK(std::abs(expected_bbox[k] - bbox[k]) <= 1);
+            }
+        }
+    }
+}
+
+TEST_CASE("vector wafer output - parallel sub-tiles")
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/wafer_shapes_style.xml");
+
+    mapnik::vector_tile_impl::processor ren(map);
+    mapnik::vector_tile_impl::merc_wafer expected = ren.create_wafer(0, 0, 3, 8, 4096, 64);
+
+    // The sub-tiles are encoded in parallel once the processor has a pool
+    ren.set_thread_pool(std::make_shared<mapnik::vector_tile_impl::thread_pool>(3));
+    mapnik::vector_tile_impl::merc_wafer wafer = ren.create_wafer(0, 0, 3, 8, 4096, 64);
+    REQUIRE(expected.tiles().size() == wafer.tiles().size());
+
+    std::size_t non_empty = 0;
+    for (std::size_t i = 0; i < wafer.tiles().size(); ++i)
+    {
+        INFO(i);
+        CHECK(expected.tiles()[i].is_painted() == wafer.tiles()[i].is_painted());
+        CHECK(expected.tiles()[i].get_buffer() == wafer.tiles()[i].get_buffer());
+        if (!wafer.tiles()[i].get_buffer().empty())
+        {
+            ++non_empty;
+        }
+    }
+    CHECK(non_empty > 1);
+}
+
+TEST_CASE("vector wafer output - streaming")
+{
+    const std::string style(R"xxx(
+        <Map srs="+init=epsg:3857">
+            <Layer name="lines" srs="+init=epsg:4326">
+                <Datasource>
+                    <Parameter name="type">geojson</Parameter>
+                    <Parameter name="inline">
+                        {"type":"LineString","coordinates":[[-170, -80], [0, 10], [170, 80]]}
+                    </Parameter>
+                </Datasource>
+            </Layer>
+            <Layer name="points" srs="+init=epsg:4326">
+                <Datasource>
+                    <Parameter name="type">csv</Parameter>
+                    <Parameter name="inline">
+                        x, y, name
+                        -100, 50, first
+                        100, -50, second
+                    </Parameter>
+                </Datasource>
+            </Layer>
+        </Map>)xxx");
+
+    mapnik::Map map(256, 256);
+    mapnik::load_map_string(map, style);
+
+    mapnik::vector_tile_impl::processor ren(map);
+    mapnik::vector_tile_impl::merc_wafer expected = ren.create_wafer(0, 0, 2, 4, 4096, 64);
+
+    std::vector<mapnik::vector_tile_impl::merc_tile> tiles;
+    ren.stream_wafer(0, 0, 2, 4, [&tiles](mapnik::vector_tile_impl::merc_tile & t)
+    {
+        tiles.push_back(std::move(t));
+    }, 4096, 64);
+
+    // The sub-tiles are handed over in the order of the tiles of a wafer
+    // and hold the same layers
+    REQUIRE(expected.tiles().size() == tiles.size());
+    for (std::size_t i = 0; i < tiles.size(); ++i)
+    {
+        INFO(i);
+        CHECK(expected.tiles()[i].x() == tiles[i].x());
+        CHECK(expected.tiles()[i].y() == tiles[i].y());
+        CHECK(expected.tiles()[i].z() == tiles[i].z());
+        CHECK(expected.tiles()[i].get_buffer() == tiles[i].get_buffer());
+        CHECK(expected.tiles()[i].get_layers() == tiles[i].get_layers());
+        CHECK(expected.tiles()[i].get_empty_layers() == tiles[i].get_empty_layers());
+    }
+}
+
+TEST_CASE("vector wafer output - quadtree clipping with an area threshold")
+{
+    mapnik::Map map(256, 256);
+    mapnik::load_map(map, "test/data/wafer_area_threshold_style.xml");
+
+    // The sliver polygon reaches into the right half of the wafer by less
+    // than the threshold but is larger than it
+    mapnik::vector_tile_impl::processor ren(map);
+    ren.set_area_threshold(500000.0);
+    mapnik::vector_tile_impl::merc_wafer expected = ren.create_wafer(0, 0, 3, 8, 4096, 64);
+    REQUIRE(expected.tiles().size() == 64);
+    CHECK(expected.tiles()[3 * 8 + 4].has_layer("polygons"));
+
+    ren.set_wafer_quadtree_clipping(true);
+    mapnik::vector_tile_impl::merc_wafer wafer = ren.create_wafer(0, 0, 3, 8, 4096, 64);
+    REQUIRE(expected.tiles().size() == wafer.tiles().size());
+
+    // The area threshold applies to the polygons, not to the parts of them
+    // within a quadrant
+    for (std::size_t i = 0; i < wafer.tiles().size(); ++i)
+    {
+        INFO(i);
+        REQUIRE(expected.tiles()[i].has_layer("polygons") == wafer.tiles()[i].has_layer("polygons"));
+        vector_tile::Tile expected_mvt;
+        vector_tile::Tile mvt;
+        expected_mvt.ParseFromString(expected.tiles()[i].get_buffer());
+        mvt.ParseFromString(wafer.tiles()[i].get_buffer());
+        REQUIRE(expected_mvt.layers_size() == mvt.layers_size());
+        if (mvt.layers_size() == 0)
+        {
+            continue;
+        }
+        vector_tile::Tile_Layer const& expected_layer = expected_mvt.layers(0);
+        vector_tile::Tile_Layer const& layer = mvt.layers(0);
+        REQUIRE(expected_layer.features_size() == layer.features_size());
+        for (int j = 0; j < layer.features_size(); ++j)
+        {
+            auto expected_bbox = geometry_bbox(expected_layer.features(j));
+            auto bbox = geometry_bbox(layer.features(j));
+            for (std::size_t k = 0; k < 4; ++k)
+            {
+                CHECK(std::abs(expected_bbox[k] - bbox[k]) <= 1);
+            }
+        }
+    }
+}
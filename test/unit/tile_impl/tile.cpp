@@ -1,5 +1,6 @@
 #include "catch.hpp"
 #include <memory>
+#include <string>
 
 // mapnik vector tile tile class
 #include "vector_tile_tile.hpp"
@@ -342,6 +343,51 @@ TEST_CASE("Vector tile base class")
         CHECK(tile.is_empty() == false);
     }
 
+    SECTION("spliced layers are the same as copied layers")
+    {
+        mapnik::vector_tile_impl::tile copied(global_extent);
+        mapnik::vector_tile_impl::tile spliced(global_extent);
+
+        vector_tile::Tile_Layer small_layer;
+        small_layer.set_version(2);
+        small_layer.set_name("small");
+        std::string small_buffer;
+        small_layer.SerializePartialToString(&small_buffer);
+
+        // Long enough to need a multi byte length
+        vector_tile::Tile_Layer large_layer;
+        large_layer.set_version(2);
+        large_layer.set_name("large");
+        for (int i = 0; i < 1000; ++i)
+        {
+            large_layer.add_keys("key" + std::to_string(i));
+        }
+        std::string large_buffer;
+        large_layer.SerializePartialToString(&large_buffer);
+
+        copied.add_layer("large", large_buffer);
+        copied.add_layer("small", small_buffer);
+        copied.add_layer("empty", std::string());
+
+        std::string spliced_large(large_buffer);
+        std::string spliced_small(small_buffer);
+        CHECK(spliced.splice_layer("large", std::move(spliced_large)) == true);
+        CHECK(spliced.splice_layer("small", std::move(spliced_small)) == true);
+        CHECK(spliced.splice_layer("empty", std::string()) == true);
+        CHECK(spliced_small.empty());
+
+        CHECK(spliced.get_buffer() == copied.get_buffer());
+        CHECK(spliced.get_layers() == copied.get_layers());
+        CHECK(spliced.get_empty_layers() == copied.get_empty_layers());
+        CHECK(spliced.get_painted_layers() == copied.get_painted_layers());
+
+        vector_tile::Tile parsed;
+        REQUIRE(parsed.ParseFromString(spliced.get_buffer()));
+        REQUIRE(parsed.layers_size() == 2);
+        CHECK(parsed.layers(0).keys_size() == 1000);
+        CHECK(parsed.layers(1).name() == "small");
+    }
+
     SECTION("has same extent works correctly")
     {
         mapnik::vector_tile_impl::tile tile1(global_extent);
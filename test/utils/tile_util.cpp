@@ -0,0 +1,156 @@
+#include "catch.hpp"
+
+// mapnik vector tile
+#include "vector_tile_processor.hpp"
+
+// mapnik
+#include <mapnik/datasource.hpp>
+#include <mapnik/datasource_cache.hpp>
+
+// protozero
+#include <protozero/varint.hpp>
+
+// test utils
+#include "tile_util.hpp"
+
+// std
+#include <algorithm>
+#include <limits>
+
+void set_datasource_parameters(mapnik::layer & layer, mapnik::parameters const& params)
+{
+    REQUIRE(layer.datasource());
+    mapnik::parameters ds_params = layer.datasource()->params();
+    for (auto const& param : params)
+    {
+        ds_params[param.first] = param.second;
+    }
+    layer.set_datasource(mapnik::datasource_cache::instance().create(ds_params));
+}
+
+vector_tile::Tile encode_tile(mapnik::Map const& map,
+                              std::uint64_t x,
+                              std::uint64_t y,
+                              std::uint64_t z)
+{
+    mapnik::vector_tile_impl::processor ren(map);
+    mapnik::vector_tile_impl::merc_tile out_tile = ren.create_tile(x, y, z, 4096, 0);
+    vector_tile::Tile tile;
+    REQUIRE(tile.ParseFromString(out_tile.get_buffer()));
+    return tile;
+}
+
+vector_tile::Tile_Layer const* find_layer(vector_tile::Tile const& tile, std::string const& name)
+{
+    for (int i = 0; i < tile.layers_size(); ++i)
+    {
+        if (tile.layers(i).name() == name)
+        {
+            return &tile.layers(i);
+        }
+    }
+    return nullptr;
+}
+
+vector_tile::Tile_Value const* find_value(vector_tile::Tile_Layer const& layer,
+                                          vector_tile::Tile_Feature const& feature,
+                                          std::string const& key)
+{
+    for (int i = 0; i + 1 < feature.tags_size(); i += 2)
+    {
+        if (layer.keys(feature.tags(i)) == key)
+        {
+            return &layer.values(feature.tags(i + 1));
+        }
+    }
+    return nullptr;
+}
+
+std::string value_string(vector_tile::Tile_Value const& value)
+{
+    if (value.has_string_value())
+    {
+        return value.string_value();
+    }
+    if (value.has_int_value())
+    {
+        return std::to_string(value.int_value());
+    }
+    if (value.has_sint_value())
+    {
+        return std::to_string(value.sint_value());
+    }
+    if (value.has_uint_value())
+    {
+        return std::to_string(value.uint_value());
+    }
+    if (value.has_double_value())
+    {
+        return std::to_string(value.double_value());
+    }
+    if (value.has_float_value())
+    {
+        return std::to_string(value.float_value());
+    }
+    if (value.has_bool_value())
+    {
+        return value.bool_value() ? "true" : "false";
+    }
+    return std::string();
+}
+
+std::map<std::string, std::string> feature_attributes(vector_tile::Tile_Layer const& layer,
+                                                      vector_tile::Tile_Feature const& feature)
+{
+    std::map<std::string, std::string> attributes;
+    for (int i = 0; i + 1 < feature.tags_size(); i += 2)
+    {
+        attributes[layer.keys(feature.tags(i))] = value_string(layer.values(feature.tags(i + 1)));
+    }
+    return attributes;
+}
+
+std::set<std::string> attribute_values(vector_tile::Tile_Layer const& layer, std::string const& key)
+{
+    std::set<std::string> values;
+    for (int i = 0; i < layer.features_size(); ++i)
+    {
+        vector_tile::Tile_Value const* value = find_value(layer, layer.features(i), key);
+        if (value)
+        {
+            values.insert(value_string(*value));
+        }
+    }
+    return values;
+}
+
+std::array<std::int32_t, 4> geometry_bbox(vector_tile::Tile_Feature const& feature)
+{
+    std::array<std::int32_t, 4> bbox {{ std::numeric_limits<std::int32_t>::max(),
+                                        std::numeric_limits<std::int32_t>::max(),
+                                        std::numeric_limits<std::int32_t>::min(),
+                                        std::numeric_limits<std::int32_t>::min() }};
+    std::int32_t x = 0;
+    std::int32_t y = 0;
+    int i = 0;
+    while (i < feature.geometry_size())
+    {
+        const std::uint32_t command = feature.geometry(i) & 0x7;
+        const std::uint32_t length = feature.geometry(i) >> 3;
+        ++i;
+        if (command == 7)
+        {
+            continue;
+        }
+        for (std::uint32_t k = 0; k < length && i + 1 < feature.geometry_size(); ++k, i += 2)
+        {
+            x += protozero::decode_zigzag32(feature.geometry(i));
+            y += protozero::decode_zigzag32(feature.geometry(i + 1));
+            bbox[0] = std::min(bbox[0], x);
+            bbox[1] = std::min(bbox[1], y);
+            bbox[2] = std::max(bbox[2], x);
+            bbox[3] = std::max(bbox[3], y);
+        }
+    }
+    return bbox;
+}
@@ -0,0 +1,51 @@
+#ifndef __MAPNIK_VECTOR_TILE_TEST_TILE_UTIL_H__
+#define __MAPNIK_VECTOR_TILE_TEST_TILE_UTIL_H__
+
+// mapnik
+#include <mapnik/layer.hpp>
+#include <mapnik/map.hpp>
+#include <mapnik/params.hpp>
+
+// libprotobuf
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#include "vector_tile.pb.h"
+#pragma GCC diagnostic pop
+
+// std
+#include <array>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+
+// Recreates the datasource of a layer with extra parameters, for the mvt_*
+// parameters of the styles in test/data
+void set_datasource_parameters(mapnik::layer & layer, mapnik::parameters const& params);
+
+// Tile of a map created by a processor with the default options
+vector_tile::Tile encode_tile(mapnik::Map const& map,
+                              std::uint64_t x = 0,
+                              std::uint64_t y = 0,
+                              std::uint64_t z = 0);
+
+vector_tile::Tile_Layer const* find_layer(vector_tile::Tile const& tile, std::string const& name);
+
+vector_tile::Tile_Value const* find_value(vector_tile::Tile_Layer const& layer,
+                                          vector_tile::Tile_Feature const& feature,
+                                          std::string const& key);
+
+// Value as text, whatever the type it was encoded with
+std::string value_string(vector_tile::Tile_Value const& value);
+
+std::map<std::string, std::string> feature_attributes(vector_tile::Tile_Layer const& layer,
+                                                      vector_tile::Tile_Feature const& feature);
+
+// Values of an attribute over all the features of a layer
+std::set<std::string> attribute_values(vector_tile::Tile_Layer const& layer, std::string const& key);
+
+// Bounding box of the encoded geometry of a feature as min x, min y, max x, max y
+std::array<std::int32_t, 4> geometry_bbox(vector_tile::Tile_Feature const& feature);
+
+#endif // __MAPNIK_VECTOR_TILE_TEST_TILE_UTIL_H__